@@ -0,0 +1,56 @@
+//===-- DSACanonicalize.h - Canonicalize IR before running DSA ------------===//
+//
+//                     The LLVM Compiler Infrastructure
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+//
+// Run the AssistDS transforms that make DSA graphs smaller and less collapsed,
+// in order, until the module stops changing.
+//
+//===----------------------------------------------------------------------===//
+
+#ifndef ASSISTDS_DSACANONICALIZE_H
+#define ASSISTDS_DSACANONICALIZE_H
+
+#include "llvm/Module.h"
+#include "llvm/Pass.h"
+
+namespace llvm {
+  //
+  // Class: DSACanonicalize
+  //
+  // Description:
+  //  A module pass that runs ArgCast, SimplifyGEP, MergeArrayGEP, Int2PtrCmp,
+  //  StructRet, SimplifyEV, SimplifyIV and SimplifyLoad (with dead code
+  //  cleanup in between) to a fixed point.  Optionally, it measures the Local
+  //  DSA graphs before and after to report how much they shrank.
+  //
+  class DSACanonicalize : public ModulePass {
+  public:
+    //
+    // Struct: GraphSize
+    //
+    // Description:
+    //  Totals over all Local graphs, including the globals graph.
+    //
+    struct GraphSize {
+      unsigned Nodes;
+      unsigned Collapsed;
+      unsigned CallSites;
+      GraphSize() : Nodes(0), Collapsed(0), CallSites(0) {}
+    };
+
+    static char ID;
+    DSACanonicalize() : ModulePass(ID) {}
+    virtual bool runOnModule(Module& M);
+
+  private:
+    bool runOnce(Module& M);
+    GraphSize measure(Module& M);
+  };
+}
+
+#endif
@@ -18,6 +18,7 @@
 #include "dsa/DSGraph.h"
 #include "dsa/DSNode.h"
 
+#include "llvm/ADT/DenseMap.h"
 #include "llvm/ADT/EquivalenceClasses.h"
 
 #include <vector>
@@ -28,21 +29,51 @@ typedef std::vector<const Function *> FunctionList;
 typedef FunctionList::iterator FunctionList_it;
 
 class DSNodeEquivs : public ModulePass {
+public:
+  // Returned for nodes and values that have no equivalence class.
+  static const unsigned NoClass = ~0U;
+
 private:
+  // Pairs of node IDs that belong to the same class.
+  typedef std::vector<std::pair<unsigned, unsigned> > NodePairList;
+
+  // Every node seen so far, indexed by its dense ID.
+  std::vector<const DSNode *> Nodes;
+  DenseMap<const DSNode *, unsigned> NodeIDs;
+
+  // Union-find forest over node IDs.  Once the pass has run, every node's
+  // parent is the root of its set and ClassOf holds its dense class number.
+  std::vector<unsigned> Parent;
+  std::vector<unsigned char> Rank;
+  std::vector<unsigned> ClassOf;
+  unsigned NumClasses;
+
+  // Node ID of every value with an entry in a function or globals graph.
+  DenseMap<const Value *, unsigned> ValueIndex;
+
+  // Built from the union-find forest the first time a client asks for it.
   EquivalenceClasses<const DSNode*> Classes;
+  bool ClassesBuilt;
 
   void buildDSNodeEquivs(Module &M);
 
+  unsigned addNode(const DSNode *N);
+  unsigned findRoot(unsigned ID);
+  void unionNodes(unsigned ID1, unsigned ID2);
+
   void addNodesFromGraph(DSGraph *G);
+  void indexValuesInGraph(DSGraph *G, bool GlobalsOnly);
   FunctionList getCallees(CallSite &CS);
-  void equivNodesThroughCallsite(CallInst *CI);
-  void equivNodesToGlobals(DSGraph *G);
-  void equivNodeMapping(DSGraph::NodeMapTy & NM);
+  void equivNodesThroughCallsite(CallInst *CI, NodePairList &Pairs);
+  void equivNodesToGlobals(DSGraph *G, NodePairList &Pairs);
+  void equivNodeMapping(DSGraph::NodeMapTy & NM, NodePairList &Pairs);
+  void mergePairs(const NodePairList &Pairs);
+  void numberClasses();
   
 public:
   static char ID;
 
-  DSNodeEquivs() : ModulePass(ID) {}
+  DSNodeEquivs() : ModulePass(ID), NumClasses(0), ClassesBuilt(false) {}
 
   void getAnalysisUsage(AnalysisUsage &AU) const {
     AU.addRequiredTransitive<TDDataStructures>();
@@ -50,12 +81,20 @@ public:
   }
 
   bool runOnModule(Module &M);
+  void releaseMemory();
+  void print(raw_ostream &O, const Module *M) const;
 
   // Returns the computed equivalence classes.
   const EquivalenceClasses<const DSNode*> &getEquivalenceClasses();
 
   // Returns the DSNode in the equivalence classes for the specified value.
   const DSNode *getMemberForValue(const Value *V);
+
+  // Returns the dense class number (below getNumClasses()) of the specified
+  // node or value, or NoClass if it has none.
+  unsigned getClassForNode(const DSNode *N) const;
+  unsigned getClassForValue(const Value *V);
+  unsigned getNumClasses() const { return NumClasses; }
 };
 
 }
@@ -23,6 +23,8 @@
 #include "llvm/Support/Debug.h"
 #include "llvm/Support/raw_ostream.h"
 
+#include <vector>
+
 namespace llvm {
 
 class DataStructureCallGraph : public ModulePass, public CallGraph {
@@ -38,6 +40,12 @@ class DataStructureCallGraph : public ModulePass, public CallGraph {
   // indirect calls or calling an external function.
   CallGraphNode *CallsExternalNode;
 
+  // TargetNodes - One function-less node per indirect call site, with edges to
+  // the DSA targets of that site.  Each call site keeps a single edge, which
+  // is what CallGraphSCCPasses such as the inliner expect, while the SCC
+  // ordering still sees every target.
+  std::vector<CallGraphNode *> TargetNodes;
+
   typedef dsa::CallTargetFinder<TDDataStructures> CallTargetFinderTy;
 
 public:
@@ -62,6 +70,9 @@ public:
     }
     
     CallGraph::print(OS, 0);
+
+    for (unsigned i = 0, e = TargetNodes.size(); i != e; ++i)
+      TargetNodes[i]->print(OS);
   }
 
   virtual void releaseMemory() {
@@ -99,6 +110,12 @@ private:
       delete CallsExternalNode;
       CallsExternalNode = 0;
     }
+    // Neither are the per call site target nodes.
+    for (unsigned i = 0, e = TargetNodes.size(); i != e; ++i) {
+      TargetNodes[i]->allReferencesDropped();
+      delete TargetNodes[i];
+    }
+    TargetNodes.clear();
     CallGraph::destroy();
   }
 };
@@ -23,6 +23,7 @@
 #include "llvm/DerivedTypes.h"
 #include "llvm/Support/InstVisitor.h"
 #include "llvm/Target/TargetData.h"
+#include "llvm/Analysis/ProfileInfo.h"
 
 using namespace llvm;
 
@@ -43,27 +44,48 @@ namespace llvm {
       // Access to the target data analysis pass
       TargetData * TD;
 
+      // Execution counts of the call targets, if a profile is loaded
+      ProfileInfo * PI;
+
       // Worklist of call sites to transform
       std::vector<Instruction *> Worklist;
 
       // A cache of indirect call targets that have been converted already
       std::map<const Function *, std::set<const Function *> > bounceCache;
 
+      // Calls to each function through a pointer, estimated from the profile
+      std::map<const Function *, double> IndirectCounts;
+
+      // Tables of targets searched by address, sorted when the program starts
+      std::vector<GlobalVariable *> SearchTables;
+
+      // The qsort() comparison function for the search tables
+      Function * SearchCompare;
+
     protected:
       void makeDirectCall (CallSite & CS);
       Function* buildBounce (CallSite cs,std::vector<const Function*>& Targets);
+      BasicBlock* buildSearch (Function * F, Value * FArg,
+                               std::vector<const Function*>& Targets,
+                               std::map<const Function*, BasicBlock*>& targets,
+                               BasicBlock * Miss);
+      Function* getSearchCompare (Module & M);
+      void buildSearchSort (Module & M);
+      void computeIndirectCounts (Module & M);
+      double getCount (const Function * F);
       const Function* findInCache (const CallSite & CS,
                                    std::set<const Function*>& Targets);
 
     public:
       static char ID;
-      Devirtualize() : ModulePass(ID), CTF(0) {}
+      Devirtualize() : ModulePass(ID), CTF(0), PI(0), SearchCompare(0) {}
 
       virtual bool runOnModule(Module & M);
 
       virtual void getAnalysisUsage(AnalysisUsage &AU) const {
         AU.addRequired<dsa::CallTargetFinder<EQTDDataStructures> >();
         AU.addRequired<TargetData>();
+        AU.addRequired<ProfileInfo>();
       }
 
       // Visitor methods for analyzing instructions
@@ -30,6 +30,7 @@ namespace llvm {
     static char ID;
     FuncSpec() : ModulePass(ID) {}
     virtual bool runOnModule(Module& M);
+    virtual void getAnalysisUsage(AnalysisUsage &AU) const;
   };
 }
 
@@ -29,6 +29,7 @@ namespace llvm {
     static char ID;
     GEPExprArgs() : ModulePass(ID) {}
     virtual bool runOnModule(Module& M);
+    virtual void getAnalysisUsage(AnalysisUsage &AU) const;
   };
 }
 
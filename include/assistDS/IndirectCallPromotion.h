@@ -0,0 +1,48 @@
+//===- IndirectCallPromotion.h - Promote single target indirect calls -----===//
+//
+//                     The LLVM Compiler Infrastructure
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+//
+// This file defines a transform that turns indirect calls that DSA resolves
+// to exactly one function into direct calls, so that the inliner and other
+// interprocedural passes can see the callee.
+//
+//===----------------------------------------------------------------------===//
+
+#ifndef _INDIRECT_CALL_PROMOTION_H
+#define _INDIRECT_CALL_PROMOTION_H
+
+#include "dsa/CallTargets.h"
+#include "dsa/DataStructure.h"
+
+#include "llvm/Module.h"
+#include "llvm/Pass.h"
+
+namespace llvm {
+  //
+  // Class: IndirectCallPromotion
+  //
+  // Description:
+  //  Replace the called value of every complete indirect call site that has a
+  //  single DSA call target of the right type with that target.
+  //
+  class IndirectCallPromotion : public ModulePass {
+    typedef dsa::CallTargetFinder<TDDataStructures> CallTargetFinderTy;
+
+  public:
+    static char ID;
+    IndirectCallPromotion() : ModulePass(ID) {}
+
+    virtual bool runOnModule(Module &M);
+
+    virtual void getAnalysisUsage(AnalysisUsage &AU) const {
+      AU.addRequired<CallTargetFinderTy>();
+    }
+  };
+}
+
+#endif // _INDIRECT_CALL_PROMOTION_H
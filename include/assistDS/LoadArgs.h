@@ -31,6 +31,7 @@ namespace llvm {
     static char ID;
     LoadArgs() : ModulePass(ID) {}
     virtual bool runOnModule(Module& M);
+    virtual void getAnalysisUsage(AnalysisUsage &AU) const;
   };
 }
 
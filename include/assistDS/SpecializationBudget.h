@@ -0,0 +1,112 @@
+//===-- SpecializationBudget.h - Shared Cost Model For Cloning Passes -----===//
+//
+//                     The LLVM Compiler Infrastructure
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+//
+// Bookkeeping shared by the passes that clone functions to specialize them
+// (FuncSpec, IndClone, ArgSimplify, LoadArgs and GEPExprArgs).  It holds a
+// single clone cache and a module-wide code growth budget, and provides the
+// cost model used to decide which specializations are worth their size.
+//
+//===----------------------------------------------------------------------===//
+
+#ifndef ASSISTDS_SPECIALIZATIONBUDGET_H
+#define ASSISTDS_SPECIALIZATIONBUDGET_H
+
+#include "llvm/Constants.h"
+#include "llvm/Function.h"
+#include "llvm/Instructions.h"
+#include "llvm/Module.h"
+#include "llvm/Pass.h"
+#include "llvm/Analysis/ProfileInfo.h"
+#include "llvm/Support/ValueHandle.h"
+
+#include <map>
+#include <string>
+#include <vector>
+
+namespace llvm {
+  //
+  // Class: SpecializationBudget
+  //
+  // Description:
+  //  An immutable pass that lives for the whole pass manager run, so that all
+  //  specializing passes draw from the same growth budget and reuse each
+  //  other's clones when they ask for the same specialization twice.
+  //
+  class SpecializationBudget : public ImmutablePass {
+  public:
+    // Arguments a clone is specialized for, and the value bound to each
+    typedef std::vector<std::pair<unsigned, Constant*> > ArgBindings;
+
+    //
+    // Struct: Candidate
+    //
+    // Description:
+    //  One specialization a pass would like to make.  Benefit is the weighted
+    //  sum over the call sites that would use the clone; Cost is the size of
+    //  the clone in instructions.
+    //
+    struct Candidate {
+      Function * F;
+      ArgBindings Bindings;
+      double Benefit;
+      unsigned Cost;
+
+      Candidate (Function * F, const ArgBindings & Bindings) :
+        F(F), Bindings(Bindings), Benefit(0), Cost(getCost (F)) {}
+    };
+
+  private:
+    typedef std::pair<std::pair<Function*, std::string>, ArgBindings> CloneKey;
+
+    // The clone, and the original it was made from.  The handles go null when
+    // either function is deleted, which invalidates the entry.
+    struct CloneEntry {
+      WeakVH Original;
+      WeakVH Clone;
+    };
+
+    // Clones made so far, by original function, kind of clone and bindings.
+    // Specializations that keep the signature have an empty kind.
+    std::map<CloneKey, CloneEntry> Clones;
+
+    // Instructions the module may still grow by; negative means unlimited
+    long Remaining;
+
+    // Whether the budget has been sized from the module yet
+    bool Initialized;
+
+  public:
+    static char ID;
+    SpecializationBudget() : ImmutablePass(ID), Remaining(-1),
+                             Initialized(false) {}
+
+    // Clone cache.  A specialization that keeps F's signature and folds the
+    // bound constants into its body is fully described by F and the
+    // bindings, so all passes share it.  Clones of any other shape also
+    // give the kind of clone.
+    Function * getClone (Function * F, const ArgBindings & Bindings);
+    void addClone (Function * F, const ArgBindings & Bindings,
+                   Function * Clone);
+    Function * getClone (Function * F, StringRef Kind,
+                         const ArgBindings & Bindings);
+    void addClone (Function * F, StringRef Kind,
+                   const ArgBindings & Bindings, Function * Clone);
+
+    // Growth budget
+    bool charge (Module & M, unsigned Cost);
+
+    // Cost model
+    static unsigned getCost (const Function * F);
+    static double getBenefit (const Function * F, const ArgBindings & Bindings);
+    static double getSiteWeight (const Instruction * I, ProfileInfo * PI);
+    static void rank (std::vector<Candidate> & Candidates);
+  };
+}
+
+#endif
@@ -23,6 +23,7 @@
 #include "llvm/Support/CallSite.h"
 #include "llvm/Analysis/Dominators.h"
 #include "llvm/Analysis/LoopInfo.h"
+#include "llvm/Analysis/ScalarEvolution.h"
 
 #include <map>
 #include <list>
@@ -62,6 +63,9 @@ private:
   bool initShadow(Module &M);
   void addTypeMap(Module &M) ;
   void optimizeChecks(Module &M);
+  void coalesceRangeChecks(BasicBlock &BB);
+  void hoistStridedChecks(Loop *L, DominatorTree &DT, ScalarEvolution &SE);
+  void inlineChecks(Module &M);
   void initRuntimeCheckPrototypes(Module &M);
   
   bool visitMain(Module &M, Function &F); 
@@ -103,6 +107,7 @@ public:
     AU.addRequired<TargetData>();
     AU.addRequired<DominatorTree>();
     AU.addRequired<LoopInfo>();
+    AU.addRequired<ScalarEvolution>();
     AU.addRequired<AddressTakenAnalysis>();
   }
 
@@ -14,14 +14,17 @@
 #ifndef TYPE_CHECKS_OPT_H
 #define TYPE_CHECKS_OPT_H
 
+#include "dsa/DataStructure.h"
 #include "dsa/TypeSafety.h"
 
 #include "llvm/Instructions.h"
 #include "llvm/Pass.h"
 #include "llvm/Target/TargetData.h"
 #include "llvm/Support/CallSite.h"
+#include "llvm/ADT/DenseSet.h"
 
 #include <list>
+#include <set>
 
 namespace llvm {
 
@@ -34,8 +37,18 @@ private:
 
   // Analysis from other passes.
   dsa::TypeSafety<TDDataStructures> *TS;
+  TDDataStructures *DS;
   std::list<Instruction *> toDelete;
 
+  // Nodes whose shadow memory may be read outside of their own DSGraph,
+  // and the graphs already scanned for them.
+  DenseSet<const DSNode *> ObservedNodes;
+  std::set<const DSGraph *> ScannedGraphs;
+
+  const DSNode *getNode(Value *V, Function *F);
+  void findObservedNodes(const DSGraph *G);
+  bool needsNoTracking(Value *V, Function *F);
+
 public:
   static char ID;
   TypeChecksOpt() : ModulePass(ID) {}
@@ -43,6 +56,7 @@ public:
 
   virtual void getAnalysisUsage(AnalysisUsage &AU) const {
     AU.addRequired<dsa::TypeSafety<TDDataStructures> >();
+    AU.addRequired<TDDataStructures>();
   }
 
 };
@@ -482,6 +482,9 @@ public:
   ///
   void viewGraph() const;
 
+  /// writeGraphToFile - Stream the graph to GraphName.dot, or GraphName.ndjson
+  /// with -dsa-print-format=ndjson, honoring the -dsa-print-slice options.
+  ///
   void writeGraphToFile(llvm::raw_ostream &O, const std::string &GraphName) const;
 
   /// maskNodeTypes - Apply a mask to all of the node types in the graph.  This
@@ -677,6 +680,11 @@ public:
   ///
   void mergeCallSite(DSCallSite &DestCS, const DSCallSite &SrcCS);
 
+  /// getDestNodes - Add the destination graph nodes that the nodes cloned so
+  /// far were cloned or merged into to Nodes.
+  ///
+  void getDestNodes(std::set<DSNode*> &Nodes) const;
+
   DSCallSite cloneCallSite(const DSCallSite& SrcCS);
 
   bool clonedAnyNodes() const { return !NodeMap.empty(); }
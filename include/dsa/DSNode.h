@@ -26,6 +26,7 @@
 
 #include <map>
 #include <set>
+#include <vector>
 
 namespace llvm {
 
@@ -47,7 +48,7 @@ public:
 private:
   friend struct ilist_sentinel_traits<DSNode>;
   //Sentinel
-  DSNode() : NumReferrers(0), Size(0), NodeType(0) {}
+  DSNode() : NumReferrers(0), Size(0), NodeType(0), NodeID(0) {}
   
   /// NumReferrers - The number of DSNodeHandles pointing to this node... if
   /// this is a forwarding node, then this is the number of node handles which
@@ -84,6 +85,19 @@ private:
   ///
   svset<const GlobalValue*> Globals;
 
+  /// NodeTable - Every node, indexed by the ID that DSNodeHandles store
+  /// instead of a pointer.  Entry 0 is the null node.  IDs are never reused:
+  /// the entry of a deleted node stays null, so a handle that outlives its
+  /// node can never reach another one.  Nodes move between graphs when graphs
+  /// are spliced or cloned, so the table is shared rather than per graph.
+  /// The table is not locked: DSA must only be run from one thread at a time.
+  static std::vector<DSNode*> NodeTable;
+
+  /// allocateNodeID/releaseNodeID - Enter this node into, or remove it from,
+  /// the node table.
+  void allocateNodeID();
+  void releaseNodeID();
+
   void operator=(const DSNode &); // DO NOT IMPLEMENT
   DSNode(const DSNode &);         // DO NOT IMPLEMENT
 public:
@@ -123,6 +137,9 @@ public:
   ///
 private:
   unsigned short NodeType;
+
+  /// NodeID - The index of this node in NodeTable, 0 for the sentinel.
+  unsigned NodeID;
 public:
 
   /// DSNode ctor - Create a node of the specified type, inserting it into the
@@ -455,6 +472,16 @@ private:
 //===----------------------------------------------------------------------===//
 // Define inline DSNodeHandle functions that depend on the definition of DSNode
 //
+inline void DSNodeHandle::setNodeID(unsigned ID) const {
+  NodeID = ID;
+}
+
+inline DSNode *DSNodeHandle::getRawNode() const {
+  DSNode *N = DSNode::NodeTable[NodeID];
+  assert((NodeID == 0 || N) && "DSNodeHandle refers to a deleted node!");
+  return N;
+}
+
 inline DSNode *DSNodeHandle::getNode() const {
   // Disabling this assertion because it is failing on a "magic" struct
   // in named (from bind).  The fourth field is an array of length 0,
@@ -469,7 +496,10 @@ inline DSNode *DSNodeHandle::getNode() const {
           (int(Offset) < 0 && -int(Offset) < int(N->Size)) ||
           N->isForwarding()) && "Node handle offset out of range!");
   */
-  if (N == 0 || !N->isForwarding())
+  if (NodeID == 0)
+    return 0;
+  DSNode *N = getRawNode();
+  if (!N->isForwarding())
     return N;
 
   return HandleForwarding();
@@ -477,8 +507,11 @@ inline DSNode *DSNodeHandle::getNode() const {
 
 inline void DSNodeHandle::setTo(DSNode *n, unsigned NewOffset) const {
   assert((!n || !n->isForwarding()) && "Cannot set node to a forwarded node!");
-  if (N) getNode()->NumReferrers--;
-  N = n;
+  // A handle may be dropped after its node is gone; there is no count left to
+  // update then.
+  if (NodeID && DSNode::NodeTable[NodeID]) getNode()->NumReferrers--;
+  DSNode *N = n;
+  setNodeID(N ? N->NodeID : 0);
   Offset = NewOffset;
   if (N) {
     N->NumReferrers++;
@@ -494,7 +527,7 @@ inline void DSNodeHandle::setTo(DSNode *n, unsigned NewOffset) const {
 }
 
 inline bool DSNodeHandle::hasLink(unsigned Num) const {
-  assert(N && "DSNodeHandle does not point to a node yet!");
+  assert(NodeID && "DSNodeHandle does not point to a node yet!");
   return getNode()->hasLink(Num+Offset);
 }
 
@@ -503,16 +536,16 @@ inline bool DSNodeHandle::hasLink(unsigned Num) const {
 /// some sort.  This method will return the pointer a mem[this+Num]
 ///
 inline const DSNodeHandle &DSNodeHandle::getLink(unsigned Off) const {
-  assert(N && "DSNodeHandle does not point to a node yet!");
+  assert(NodeID && "DSNodeHandle does not point to a node yet!");
   return getNode()->getLink(Offset+Off);
 }
 inline DSNodeHandle &DSNodeHandle::getLink(unsigned Off) {
-  assert(N && "DSNodeHandle does not point to a node yet!");
+  assert(NodeID && "DSNodeHandle does not point to a node yet!");
   return getNode()->getLink(Off+Offset);
 }
 
 inline void DSNodeHandle::setLink(unsigned Off, const DSNodeHandle &NH) {
-  assert(N && "DSNodeHandle does not point to a node yet!");
+  assert(NodeID && "DSNodeHandle does not point to a node yet!");
   getNode()->setLink(Off+Offset, NH);
 }
 
@@ -520,7 +553,7 @@ inline void DSNodeHandle::setLink(unsigned Off, const DSNodeHandle &NH) {
 /// can cause merging of nodes in the graph.
 ///
 inline void DSNodeHandle::addEdgeTo(unsigned Off, const DSNodeHandle &NH) {
-  assert(N && "DSNodeHandle does not point to a node yet!");
+  assert(NodeID && "DSNodeHandle does not point to a node yet!");
   getNode()->addEdgeTo(Off+Offset, NH);
 }
 
@@ -46,24 +46,30 @@ class ReachabilityCloner;
 /// graph from getting out of date.  This class represents a "pointer" in the
 /// graph, whose destination is an indexed offset into a node.
 ///
+/// The node is stored as its 32-bit index in the node table (see
+/// DSNode::NodeTable) rather than as a pointer, which packs a handle into 8
+/// bytes on 64-bit hosts.  Index 0 is the null node.  Indices are never
+/// reused, so a handle left pointing at a deleted node finds a null entry.
+///
 /// Note: some functions that are marked as inline in DSNodeHandle are actually
 /// defined in DSNode.h because they need knowledge of DSNode operation. Putting
 /// them in a CPP file wouldn't help making them inlined and keeping DSNode and
 /// DSNodeHandle (and friends) in one file complicates things.
 ///
 class DSNodeHandle {
-  mutable DSNode *N;
+  mutable unsigned NodeID;
   mutable unsigned Offset;
   void operator==(const DSNode *N);  // DISALLOW, use to promote N to nodehandle
+  inline void setNodeID(unsigned ID) const;  // Defined inline in DSNode.h
 public:
 
-  DSNodeHandle() : N(0), Offset(0) {}
+  DSNodeHandle() : NodeID(0), Offset(0) {}
 
   // Allow construction, destruction, and assignment...
-  DSNodeHandle(DSNode *n, unsigned offs = 0) : N(0), Offset(0) {
+  DSNodeHandle(DSNode *n, unsigned offs = 0) : NodeID(0), Offset(0) {
     setTo(n, offs);
   }
-  DSNodeHandle(const DSNodeHandle &H) : N(0), Offset(0) {
+  DSNodeHandle(const DSNodeHandle &H) : NodeID(0), Offset(0) {
     DSNode *NN = H.getNode();
     setTo(NN, H.Offset);  // Must read offset AFTER the getNode()
   }
@@ -76,7 +82,8 @@ public:
   }
 
   bool operator<(const DSNodeHandle &H) const {  // Allow sorting
-    return getNode() < H.getNode() || (N == H.N && Offset < H.Offset);
+    return getNode() < H.getNode() ||
+      (NodeID == H.NodeID && Offset < H.Offset);
   }
   bool operator>(const DSNodeHandle &H) const { return H < *this; }
   bool operator==(const DSNodeHandle &H) const { // Allow comparison
@@ -87,13 +94,13 @@ public:
 
   inline void swap(DSNodeHandle &NH) {
     std::swap(Offset, NH.Offset);
-    std::swap(N, NH.N);
+    std::swap(NodeID, NH.NodeID);
   }
 
   /// isNull - Check to see if getNode() == 0, without going through the trouble
   /// of checking to see if we are forwarding...
   ///
-  bool isNull() const { return N == 0; }
+  bool isNull() const { return NodeID == 0; }
 
   // Allow explicit conversion to DSNode...
   DSNode *getNode() const;  // Defined inline in DSNode.h
@@ -136,6 +143,10 @@ public:
 private:
   DSNode *HandleForwarding() const;
 
+  /// getRawNode - Return the node the handle refers to, without following
+  /// forwarding.  Defined inline in DSNode.h.
+  DSNode *getRawNode() const;
+
   /// isForwarding - Return true if this NodeHandle is forwarding to another
   /// one.
   bool isForwarding() const;
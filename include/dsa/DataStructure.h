@@ -61,6 +61,8 @@ class DataStructures : public ModulePass {
 
   void buildGlobalECs(svset<const GlobalValue*>& ECGlobals);
 
+  void unionGlobalsInNode(DSNode* N, svset<const GlobalValue*>& ECGlobals);
+
   void eliminateUsesOfECGlobals(DSGraph& G, const svset<const GlobalValue*> &ECGlobals);
 
   // DSInfo, one graph for each function
@@ -78,6 +80,10 @@ protected:
   /// with other global values in the DSGraphs.
   EquivalenceClasses<const GlobalValue*> GlobalECs;
 
+  /// PendingECGlobals - Globals equated by updateGlobalECs that may still be
+  /// used in the function graphs.  formGlobalECs eliminates them.
+  svset<const GlobalValue*> PendingECGlobals;
+
   SuperSet<Type*>* TypeSS;
 
   // Callgraph, as computed so far
@@ -90,8 +96,10 @@ protected:
   void init(TargetData* T);
 
   void formGlobalECs();
+  void updateGlobalECs(const std::set<DSNode*>& Nodes);
   
-  void cloneIntoGlobals(DSGraph* G, unsigned cloneFlags);
+  void cloneIntoGlobals(DSGraph* G, unsigned cloneFlags,
+                        std::set<DSNode*>* DestNodes = 0);
   void cloneGlobalsInto(DSGraph* G, unsigned cloneFlags);
 
   void restoreCorrectCallGraph();
@@ -269,6 +277,13 @@ private:
 
   void CloneAuxIntoGlobal(DSGraph* G);
 
+  // CalleeSummaries - Reduced copies of callee graphs inlined in their place
+  // when -dsa-bu-summarize is given, keyed by the graph they summarize.
+  std::map<const DSGraph*, DSGraph*> CalleeSummaries;
+  DSGraph *getCalleeSummary(DSGraph *G);
+  void invalidateCalleeSummary(const DSGraph *G);
+  void clearCalleeSummaries();
+
   void getAllCallees(const DSCallSite &CS, FuncSet &Callees);
   void getAllAuxCallees (DSGraph* G, FuncSet &Callees);
   void applyCallsiteFilter(const DSCallSite &DCS, FuncSet &Callees);
@@ -340,6 +340,39 @@ namespace PA {
                                  std::vector<OnePool> &ResultPools);
   };
 
+  //===-- CostModel Heuristic ---------------------------------------------===//
+  //
+  // This heuristic weighs the per-pool cost (a pool descriptor, slab rounding
+  // and an extra function argument) against the locality a private pool buys.
+  // Large, array, recursive and heavily used DSNodes get their own pool; small
+  // singleton DSNodes with the same size, alignment and lifetime share one.
+  //
+  class CostModelHeuristic : public Heuristic, public ModulePass {
+    public:
+      static char ID;
+      virtual void *getAdjustedAnalysisPointer(AnalysisID ID) {
+        if (ID == &Heuristic::ID)
+          return (Heuristic*)this;
+        return this;
+      }
+
+      CostModelHeuristic (char & IDp = ID) : ModulePass (IDp) { }
+      virtual ~CostModelHeuristic () {return;}
+      virtual bool runOnModule (Module & M);
+
+      virtual void getAnalysisUsage(AnalysisUsage &AU) const {
+        // We require DSA while this pass is still responding to queries
+        AU.addRequiredTransitive<EQTDDataStructures>();
+
+        // This pass does not modify anything when it runs
+        AU.setPreservesAll();
+      }
+
+      virtual void AssignToPools(const DSNodeList_t & NodesToPA,
+                                 Function *F, DSGraph* G,
+                                 std::vector<OnePool> &ResultPools);
+  };
+
   //===-- AllInOneGlobalPool Heuristic ------------------------------------===//
   //
   // This heuristic puts all memory in the whole program into a single global
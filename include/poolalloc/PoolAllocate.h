@@ -213,9 +213,11 @@ class PoolAllocate : public PoolAllocateGroup {
 public:
 
   Constant *PoolInit, *PoolDestroy, *PoolAlloc, *PoolRealloc, *PoolMemAlign, *PoolThreadWrapper;
-  Constant *PoolFree;
+  Constant *PoolInitLazy, *PoolInitSharded;
+  Constant *PoolFree, *PoolFreeSized;
   Constant *PoolCalloc;
   Constant *PoolStrdup;
+  Constant *PoolObjSize;
 
   // Function which will initialize global pools
   Function * GlobalPoolCtor;
@@ -324,7 +326,9 @@ protected:
   GlobalVariable *CreateGlobalPool(unsigned RecSize, unsigned Alignment,
                                    std::string name = "GlobalPool", Instruction *IPHint = 0);
 
-  /// getPoolType - Return the type of a pool descriptor
+  /// getPoolType - Return the type of a pool descriptor.  The FL2 runtime's
+  /// PoolTy must fit in it on every target; it checks this against its own
+  /// PoolDescriptorWords, which must match the count used here.
   /// FIXME: These constants should be chosen by the client
   Type * getPoolType(LLVMContext* C) {
     IntegerType * IT = IntegerType::getInt8Ty(*C);
@@ -332,7 +336,7 @@ protected:
     if (SAFECodeEnabled)
       return ArrayType::get(VoidPtrType, 92);
     else
-      return ArrayType::get(VoidPtrType, 16);
+      return ArrayType::get(VoidPtrType, 18);
   }
 
   virtual DSGraph* getDSGraph (const Function & F) const {
@@ -506,6 +510,25 @@ protected:
                             std::multimap<AllocaInst*, CallInst*> &PoolFrees);
 
   void CalculateLivePoolFreeBlocks(std::set<BasicBlock*> &LiveBlocks,Value *PD);
+
+  /// getExpectedPoolBytes - Estimate how many bytes will be allocated from
+  /// the pool described by PD over its lifetime, from the constant sizes of
+  /// the allocations it serves and the trip counts of the loops around them.
+  /// Returns 0 if nothing useful is known.
+  uint64_t getExpectedPoolBytes(Value *PD, unsigned Depth = 0);
+
+  /// BlockTripCounts - The loop trip count products that getBlockTripCount
+  /// has read out of LoopInfo, for the functions in TripCountsComputed.
+  /// Blocks outside of counted loops are left out.
+  std::map<const BasicBlock*, uint64_t> BlockTripCounts;
+  std::set<const Function*> TripCountsComputed;
+  uint64_t getBlockTripCount(BasicBlock *BB);
+
+  /// AddCapacityHints - Replace poolinit and poolinit_lazy calls whose pools
+  /// have a known expected size with calls to poolinit_hint and
+  /// poolinit_lazy_hint, so that the runtime can size the first slab of the
+  /// pool accordingly.
+  void AddCapacityHints(Module &M);
 };
 
 
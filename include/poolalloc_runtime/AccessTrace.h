@@ -0,0 +1,71 @@
+//===- AccessTrace.h - Binary pool access trace format ----------*- C++ -*-===//
+//
+//                       The LLVM Compiler Infrastructure
+//
+// This file was developed by the LLVM research group and is distributed under
+// the University of Illinois Open Source License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+//
+// This file describes the on-disk format of the traces written by the
+// poolaccesstrace runtime (see the -poolaccesstrace pass) and read back by the
+// pa-trace tool.
+//
+// A trace file starts with a FileHeader, followed by DataSize bytes of chunks.
+// Each chunk is a ChunkHeader followed by NumRecords Records, all sampled by
+// one thread.  A chunk header with NumRecords == 0 ends the data early; this
+// happens when the file filled up while threads were still flushing.
+//
+//===----------------------------------------------------------------------===//
+
+#ifndef POOLALLOC_RUNTIME_ACCESSTRACE_H
+#define POOLALLOC_RUNTIME_ACCESSTRACE_H
+
+#include <stdint.h>
+
+namespace PoolTrace {
+
+enum {
+  Version = 1,
+  // Addresses are recorded at this granularity (log2 of bytes).
+  BlockShift = 5
+};
+
+static const char Magic[8] = { 'P', 'A', 'T', 'R', 'A', 'C', 'E', 0 };
+
+struct FileHeader {
+  char Magic[8];
+  uint32_t Version;
+  uint32_t SampleRate;     // One in SampleRate deduplicated accesses is kept.
+  uint32_t BlockShift;
+  uint32_t NumThreads;
+  uint64_t DataSize;       // Bytes of chunk data following the header.
+  uint64_t Dropped;        // Samples lost because the file was full.
+};
+
+struct ChunkHeader {
+  uint32_t ThreadID;
+  uint32_t NumRecords;
+};
+
+struct Record {
+  uint64_t Block;          // Address >> BlockShift.
+  uint32_t PoolID;         // hashPoolDescriptor() of the pool accessed.
+  uint32_t Time;           // Low bits of the per-thread access count.
+};
+
+/// hashPoolDescriptor - Map a pool descriptor address to a 32-bit pool ID.
+/// This is a pure function of the address, so the runtime needs no table of
+/// live pools.  Zero is never returned.
+static inline uint32_t hashPoolDescriptor(const void *PD) {
+  uint64_t X = (uint64_t)(uintptr_t)PD;
+  X ^= X >> 33;
+  X *= 0xff51afd7ed558ccdULL;
+  X ^= X >> 33;
+  uint32_t ID = (uint32_t)X;
+  return ID ? ID : 1;
+}
+
+} // end namespace PoolTrace
+
+#endif
@@ -0,0 +1,61 @@
+/*===- DynCount.h - Binary load/store count format ---------------*- C -*-===//
+//
+//                       The LLVM Compiler Infrastructure
+//
+// This file was developed by the LLVM research group and is distributed under
+// the University of Illinois Open Source License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+//
+// This file describes the site table emitted by the -dyncount pass, and the
+// on-disk format of the counts written by the DynCount runtime and read back
+// by the dyncount-report tool.  It is plain C so that the runtime can use it.
+//
+// A count file starts with a DynCountHeader, followed by NumSites
+// DynCountRecords (one per instrumented load or store, in site order) and
+// then NamesSize bytes of NUL terminated function names; a record's Function
+// field indexes into this list.
+//
+//===----------------------------------------------------------------------===*/
+
+#ifndef POOLALLOC_RUNTIME_DYNCOUNT_H
+#define POOLALLOC_RUNTIME_DYNCOUNT_H
+
+#include <stdint.h>
+
+#define DYNCOUNT_MAGIC   "DYNCOUNT"
+#define DYNCOUNT_VERSION 1
+
+/* Name of the count file written when the program exits */
+#define DYNCOUNT_FILE    "dyncount.bin"
+
+enum {
+  DynCountLoad = 0,
+  DynCountStore = 1
+};
+
+/* One instrumented access, as laid out in the table the pass emits */
+typedef struct {
+  uint32_t Function;       /* Index of the enclosing function's name */
+  uint32_t Index;          /* Position of the access within that function */
+  uint32_t Node;           /* DSNode accessed; 0 if DSA has none */
+  uint8_t Kind;            /* DynCountLoad or DynCountStore */
+  uint8_t Safe;            /* Whether the access is type safe */
+  uint16_t Reserved;
+} DynCountSite;
+
+typedef struct {
+  char Magic[8];
+  uint32_t Version;
+  uint32_t NumSites;
+  uint32_t NumFunctions;
+  uint32_t NumThreads;     /* Threads that executed instrumented code */
+  uint64_t NamesSize;
+} DynCountHeader;
+
+typedef struct {
+  uint64_t Count;
+  DynCountSite Site;
+} DynCountRecord;
+
+#endif
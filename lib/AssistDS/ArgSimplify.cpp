@@ -8,6 +8,8 @@
 //===----------------------------------------------------------------------===//
 #define DEBUG_TYPE "argsimpl"
 
+#include "assistDS/SpecializationBudget.h"
+
 #include "llvm/Instructions.h"
 #include "llvm/Constants.h"
 #include "llvm/Module.h"
@@ -30,8 +32,10 @@ namespace {
   // F - Function to modify
   // arg_count - The argument to function I that may be changed
   // type - Declared type of the argument
+  // Budget - Shared clone cache and growth budget
 
-  static void simplify(Function *F, unsigned arg_count, Type* type) {
+  static void simplify(Function *F, unsigned arg_count, Type* type,
+                       SpecializationBudget &Budget) {
 
     // Go through all uses of the function
     for(Value::use_iterator ui = F->use_begin(), ue = F->use_end();
@@ -49,21 +53,21 @@ namespace {
                     // if I is ever called as a bitcasted function
                     if(F->getReturnType() == CI->getType()){
                       // if the return types match.
-                      if(F->arg_size() == (CI->getNumOperands()-1)){
+                      if(F->arg_size() == CI->getNumArgOperands()){
                         // and the numeber of args match too
-                        unsigned arg_count1 = 1;
+                        unsigned arg_count1 = 0;
                         bool change = true;
                         for (Function::arg_iterator ii1 = F->arg_begin(), ee1 = F->arg_end();
                              ii1 != ee1; ++ii1,arg_count1++) {
-                          if(arg_count1 == (arg_count + 1)) {
-                            if(ii1->getType() == CI->getOperand(arg_count1)->getType()){
+                          if(arg_count1 == arg_count) {
+                            if(ii1->getType() == CI->getArgOperand(arg_count1)->getType()){
                               change = false;
                               break;
                             }
                             else 
                               continue;
                           }
-                          if(ii1->getType() != CI->getOperand(arg_count1)->getType()) {
+                          if(ii1->getType() != CI->getArgOperand(arg_count1)->getType()) {
                             change = false;
                             break;
                           }
@@ -74,52 +78,64 @@ namespace {
                           // create a new function, to do the cast from ptr to int,
                           // and call the original function, with the casted value
                           std::vector<Type*>TP;
-                          for(unsigned c = 1; c<CI->getNumOperands();c++) {
-                            TP.push_back(CI->getOperand(c)->getType());
+                          for(unsigned c = 0; c<CI->getNumArgOperands();c++) {
+                            TP.push_back(CI->getArgOperand(c)->getType());
                           }
                           FunctionType *NewFTy = FunctionType::
                             get(CI->getType(), TP, false);
                           
+                          // Call sites with the same signature share
+                          // one bounce function.
+                          SpecializationBudget::ArgBindings Key;
+                          Key.push_back(std::make_pair(arg_count,
+                                        UndefValue::get(PointerType::getUnqual(NewFTy))));
                           Module *M = F->getParent();
-                          Function *NewF = Function::Create(NewFTy,
-                                                            GlobalValue::InternalLinkage,
-                                                            "argbounce",
-                                                            M);
-                          std::vector<Value*> fargs;
-                          for(Function::arg_iterator ai = NewF->arg_begin(), 
-                              ae= NewF->arg_end(); ai != ae; ++ai) {
-                            fargs.push_back(ai);
-                            ai->setName("arg");
-                          }
-                          Value *CastedVal;
-                          BasicBlock* entryBB = BasicBlock::
-                            Create (M->getContext(), "entry", NewF);
+                          Function *NewF = Budget.getClone(F, "argbounce", Key);
+                          if(!NewF) {
+                            // cast, call and return
+                            if(!Budget.charge(*M, 3))
+                              continue;
+                            NewF = Function::Create(NewFTy,
+                                                    GlobalValue::InternalLinkage,
+                                                    "argbounce",
+                                                    M);
+                            Budget.addClone(F, "argbounce", Key, NewF);
+                            std::vector<Value*> fargs;
+                            for(Function::arg_iterator ai = NewF->arg_begin(), 
+                                ae= NewF->arg_end(); ai != ae; ++ai) {
+                              fargs.push_back(ai);
+                              ai->setName("arg");
+                            }
+                            Value *CastedVal;
+                            BasicBlock* entryBB = BasicBlock::
+                              Create (M->getContext(), "entry", NewF);
                        
-                          Type *FromTy = fargs.at(arg_count)->getType();
-                          if(FromTy->isPointerTy()) {
-                            CastedVal = CastInst::CreatePointerCast(fargs.at(arg_count), 
-                                                         type, "castd", entryBB);
-                          } else {
-                            CastedVal = CastInst::CreateIntegerCast(fargs.at(arg_count), 
-                                                                    type, false, "casted", entryBB);
-                          }
+                            Type *FromTy = fargs.at(arg_count)->getType();
+                            if(FromTy->isPointerTy()) {
+                              CastedVal = CastInst::CreatePointerCast(fargs.at(arg_count), 
+                                                           type, "castd", entryBB);
+                            } else {
+                              CastedVal = CastInst::CreateIntegerCast(fargs.at(arg_count), 
+                                                                      type, false, "casted", entryBB);
+                            }
 
-                          SmallVector<Value*, 8> Args;
-                          for(Function::arg_iterator ai = NewF->arg_begin(),
-                              ae= NewF->arg_end(); ai != ae; ++ai) {
-                            if(ai->getArgNo() == arg_count)
-                              Args.push_back(CastedVal);
+                            SmallVector<Value*, 8> Args;
+                            for(Function::arg_iterator ai = NewF->arg_begin(),
+                                ae= NewF->arg_end(); ai != ae; ++ai) {
+                              if(ai->getArgNo() == arg_count)
+                                Args.push_back(CastedVal);
+                              else 
+                                Args.push_back(ai);
+                            }
+
+                            CallInst * CallI = CallInst::Create(F,Args, 
+                                                                "", entryBB);
+                            if(CallI->getType()->isVoidTy())
+                              ReturnInst::Create(M->getContext(), entryBB);
                             else 
-                              Args.push_back(ai);
+                              ReturnInst::Create(M->getContext(), CallI, entryBB);
                           }
 
-                          CallInst * CallI = CallInst::Create(F,Args, 
-                                                              "", entryBB);
-                          if(CallI->getType()->isVoidTy())
-                            ReturnInst::Create(M->getContext(), entryBB);
-                          else 
-                            ReturnInst::Create(M->getContext(), CallI, entryBB);
-
                           CI->setCalledFunction(NewF);
                           numTransformable++;
                         }
@@ -140,7 +156,12 @@ namespace {
     static char ID;
     ArgSimplify() : ModulePass(ID) {}
 
+    void getAnalysisUsage(AnalysisUsage &AU) const {
+      AU.addRequired<SpecializationBudget>();
+    }
+
     bool runOnModule(Module& M) {
+      SpecializationBudget &Budget = getAnalysis<SpecializationBudget>();
 
       for (Module::iterator I = M.begin(); I != M.end(); ++I) 
         if (!I->isDeclaration() && !I->mayBeOverridden()) {
@@ -161,7 +182,7 @@ namespace {
             // if this argument is only used in ICMP instructions, we can
             // replace it.
             if(change) {
-              simplify(I, ii->getArgNo(), ii->getType()); 
+              simplify(I, ii->getArgNo(), ii->getType(), Budget);
             }
           }
         }
@@ -0,0 +1,237 @@
+//===-- DSACanonicalize.cpp - Canonicalize IR before running DSA ----------===//
+//
+//                     The LLVM Compiler Infrastructure
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+//
+// Each of the AssistDS simplifications removes a source of DSA imprecision:
+// casts of arguments, GEPs through bitcasts, chains of array GEPs, integer
+// round trips of pointers, aggregates returned or built by value, and loads
+// of casted pointers.  Running one often exposes work for another, so this
+// pass runs them in a fixed order until the module stops changing.
+//
+// The transforms return true whether or not they changed anything, so the
+// fixed point is detected by fingerprinting the module after each round.
+//
+//===----------------------------------------------------------------------===//
+
+#define DEBUG_TYPE "dsa-canonicalize"
+
+#include "assistDS/DSACanonicalize.h"
+#include "assistDS/ArgCast.h"
+#include "assistDS/Int2PtrCmp.h"
+#include "assistDS/MergeGEP.h"
+#include "assistDS/SimplifyExtractValue.h"
+#include "assistDS/SimplifyGEP.h"
+#include "assistDS/SimplifyInsertValue.h"
+#include "assistDS/SimplifyLoad.h"
+#include "assistDS/StructReturnToPointer.h"
+#include "dsa/DataStructure.h"
+#include "dsa/DSGraph.h"
+
+#include "llvm/PassManager.h"
+#include "llvm/Target/TargetData.h"
+#include "llvm/Transforms/IPO.h"
+#include "llvm/Transforms/Scalar.h"
+#include "llvm/ADT/Statistic.h"
+#include "llvm/Support/CommandLine.h"
+#include "llvm/Support/Debug.h"
+#include "llvm/Support/raw_ostream.h"
+
+#include <stdint.h>
+
+using namespace llvm;
+
+// Pass ID variable
+char DSACanonicalize::ID = 0;
+
+// Register the pass
+static RegisterPass<DSACanonicalize>
+X("dsa-canonicalize", "Simplify IR for DSA to a fixed point");
+
+// Pass statistics
+STATISTIC(numRounds,          "Number of canonicalization rounds run");
+STATISTIC(numNodesBefore,     "Local DSNodes before canonicalization");
+STATISTIC(numNodesAfter,      "Local DSNodes after canonicalization");
+STATISTIC(numCollapsedBefore, "Collapsed Local DSNodes before canonicalization");
+STATISTIC(numCollapsedAfter,  "Collapsed Local DSNodes after canonicalization");
+STATISTIC(numCallsBefore,     "Local call sites before canonicalization");
+STATISTIC(numCallsAfter,      "Local call sites after canonicalization");
+
+namespace {
+  cl::opt<unsigned> MaxRounds("dsa-canonicalize-max-rounds",
+         cl::desc("Maximum number of rounds -dsa-canonicalize runs"),
+         cl::init(8));
+
+  cl::opt<bool> Measure("dsa-canonicalize-measure",
+         cl::desc("Compare the Local DSA graphs before and after "
+                  "-dsa-canonicalize"),
+         cl::init(false));
+
+  //
+  // Class: LocalGraphSizer
+  //
+  // Description:
+  //  Record the size of the Local DSA graphs of the module it is run on.
+  //
+  class LocalGraphSizer : public ModulePass {
+    DSACanonicalize::GraphSize & Size;
+  public:
+    static char ID;
+    LocalGraphSizer(DSACanonicalize::GraphSize & Size) :
+      ModulePass(ID), Size(Size) {}
+
+    virtual bool runOnModule(Module & M) {
+      LocalDataStructures & DS = getAnalysis<LocalDataStructures>();
+      count (*DS.getGlobalsGraph());
+      for (Module::iterator F = M.begin(), E = M.end(); F != E; ++F)
+        if (DS.hasDSGraph (*F))
+          count (*DS.getDSGraph (*F));
+      return false;
+    }
+
+    virtual void getAnalysisUsage(AnalysisUsage & AU) const {
+      AU.addRequired<LocalDataStructures>();
+      AU.setPreservesAll();
+    }
+
+  private:
+    void count(const DSGraph & G) {
+      for (DSGraph::node_const_iterator N = G.node_begin(), E = G.node_end();
+           N != E; ++N) {
+        ++Size.Nodes;
+        if (N->isCollapsedNode())
+          ++Size.Collapsed;
+      }
+      Size.CallSites += G.getFunctionCalls().size();
+    }
+  };
+
+  char LocalGraphSizer::ID = 0;
+
+  //
+  // Function: fingerprint()
+  //
+  // Description:
+  //  Hash the identity and operands of every instruction in the module.  Two
+  //  fingerprints taken without a change to the module in between are equal.
+  //
+  uint64_t
+  fingerprint (Module & M) {
+    uint64_t Hash = 14695981039346656037ULL;
+    for (Module::iterator F = M.begin(), FE = M.end(); F != FE; ++F) {
+      Hash = (Hash ^ (uintptr_t) &*F) * 1099511628211ULL;
+      for (Function::iterator B = F->begin(), BE = F->end(); B != BE; ++B)
+        for (BasicBlock::iterator I = B->begin(), IE = B->end(); I != IE; ++I) {
+          Hash = (Hash ^ (uintptr_t) &*I) * 1099511628211ULL;
+          Hash = (Hash ^ I->getOpcode()) * 1099511628211ULL;
+          for (User::op_iterator O = I->op_begin(), OE = I->op_end();
+               O != OE; ++O)
+            Hash = (Hash ^ (uintptr_t) O->get()) * 1099511628211ULL;
+        }
+    }
+    return Hash;
+  }
+}
+
+//
+// Method: measure()
+//
+// Description:
+//  Run Local DSA on the module as it is now and return the size of the
+//  graphs.
+//
+DSACanonicalize::GraphSize
+DSACanonicalize::measure (Module & M) {
+  GraphSize Size;
+  PassManager PM;
+  PM.add (new TargetData (&M));
+  PM.add (new LocalGraphSizer (Size));
+  PM.run (M);
+  return Size;
+}
+
+//
+// Method: runOnce()
+//
+// Description:
+//  Run one round of the simplifications.
+//
+// Return value:
+//  true  - The module was modified.
+//  false - The module was not modified.
+//
+bool
+DSACanonicalize::runOnce (Module & M) {
+  uint64_t Before = fingerprint (M);
+
+  //
+  // Casts of arguments first, so that the GEP and load simplifications see
+  // the real types.  Aggregate returns are turned into pointer arguments
+  // before extract/insert value chains are simplified.
+  //
+  PassManager PM;
+  PM.add (new TargetData (&M));
+  PM.add (new ArgCast());
+  PM.add (createDeadInstEliminationPass());
+  PM.add (new SimplifyGEP());
+  PM.add (createDeadInstEliminationPass());
+  PM.add (new MergeArrayGEP());
+  PM.add (createDeadInstEliminationPass());
+  PM.add (new Int2PtrCmp());
+  PM.add (createDeadInstEliminationPass());
+  PM.add (new StructRet());
+  PM.add (createDeadArgEliminationPass());
+  PM.add (new SimplifyEV());
+  PM.add (new SimplifyIV());
+  PM.add (createDeadCodeEliminationPass());
+  PM.add (new SimplifyLoad());
+  PM.add (createDeadCodeEliminationPass());
+  PM.run (M);
+
+  return fingerprint (M) != Before;
+}
+
+//
+// Method: runOnModule()
+//
+// Description:
+//  Entry point for this LLVM pass.
+//
+// Return value:
+//  true  - The module was modified.
+//  false - The module was not modified.
+//
+bool
+DSACanonicalize::runOnModule (Module & M) {
+  GraphSize Before;
+  if (Measure)
+    Before = measure (M);
+
+  bool Changed = false;
+  for (unsigned Round = 0; Round < MaxRounds; ++Round) {
+    ++numRounds;
+    if (!runOnce (M))
+      break;
+    Changed = true;
+  }
+
+  if (Measure) {
+    GraphSize After = measure (M);
+    numNodesBefore += Before.Nodes;
+    numNodesAfter += After.Nodes;
+    numCollapsedBefore += Before.Collapsed;
+    numCollapsedAfter += After.Collapsed;
+    numCallsBefore += Before.CallSites;
+    numCallsAfter += After.CallSites;
+    DEBUG (errs() << "dsa-canonicalize: nodes " << Before.Nodes << " -> "
+                  << After.Nodes << ", collapsed " << Before.Collapsed
+                  << " -> " << After.Collapsed << ", call sites "
+                  << Before.CallSites << " -> " << After.CallSites << "\n");
+  }
+
+  return Changed;
+}
@@ -12,50 +12,111 @@
 //
 //===----------------------------------------------------------------------===//
 
+#define DEBUG_TYPE "dsnodeequivs"
+
 #include "assistDS/DSNodeEquivs.h"
 
 #include "llvm/Constants.h"
 #include "llvm/Module.h"
 #include "llvm/Support/InstIterator.h"
 #include "llvm/ADT/SmallSet.h"
+#include "llvm/ADT/Statistic.h"
 
 #include <deque>
+#include <string>
 
 namespace llvm {
 
 char DSNodeEquivs::ID = 0;
+const unsigned DSNodeEquivs::NoClass;
 
 static RegisterPass<DSNodeEquivs>
 X("dsnodeequivs", "Compute DSNode equivalence classes");
 
+STATISTIC(NumEquivNodes, "Number of DSNodes placed in equivalence classes");
+STATISTIC(NumEquivClasses, "Number of DSNode equivalence classes");
+
 // Build equivalence classes of DSNodes that are mapped between graphs.
 void DSNodeEquivs::buildDSNodeEquivs(Module &M) {
   TDDataStructures &TDDS = getAnalysis<TDDataStructures>();
+  DSGraph *GlobalsGraph = TDDS.getGlobalsGraph();
 
+  // Number the nodes of every graph up front, so that each node is in a
+  // singleton class even if nothing maps to it.
   Module::iterator FuncIt = M.begin(), FuncItEnd = M.end();
-  for (; FuncIt != FuncItEnd; ++FuncIt) {
+  for (; FuncIt != FuncItEnd; ++FuncIt)
+    if (TDDS.hasDSGraph(*FuncIt))
+      addNodesFromGraph(TDDS.getDSGraph(*FuncIt));
+  addNodesFromGraph(GlobalsGraph);
+
+  // Each function only contributes pairs of node IDs; they are merged into
+  // the forest once the function has been walked.
+  NodePairList Pairs;
+  for (FuncIt = M.begin(); FuncIt != FuncItEnd; ++FuncIt) {
     Function &F = *FuncIt;
 
     if (!TDDS.hasDSGraph(F))
       continue;
 
+    Pairs.clear();
+
     inst_iterator InstIt = inst_begin(F), InstItEnd = inst_end(F);
     for (; InstIt != InstItEnd; ++InstIt) {
       if (CallInst *Call = dyn_cast<CallInst>(&*InstIt)) {
-        equivNodesThroughCallsite(Call);
+        equivNodesThroughCallsite(Call, Pairs);
       }
     }
 
-    DSGraph *Graph = TDDS.getDSGraph(F);
+    equivNodesToGlobals(TDDS.getDSGraph(F), Pairs);
+    mergePairs(Pairs);
+  }
+
+  // Index the values of every graph so that clients need not find the graph
+  // a value belongs to.  Globals are indexed by their globals graph node.
+  for (FuncIt = M.begin(); FuncIt != FuncItEnd; ++FuncIt)
+    if (TDDS.hasDSGraph(*FuncIt))
+      indexValuesInGraph(TDDS.getDSGraph(*FuncIt), false);
+  indexValuesInGraph(GlobalsGraph, true);
 
-    // Ensure all nodes from this function's graph are in an equivalence class.
-    addNodesFromGraph(Graph);
+  numberClasses();
+
+  NumEquivNodes += Nodes.size();
+  NumEquivClasses += NumClasses;
+}
+
+// Return the ID of the given node, numbering it if it has not been seen.
+unsigned DSNodeEquivs::addNode(const DSNode *N) {
+  std::pair<DenseMap<const DSNode *, unsigned>::iterator, bool> Entry =
+    NodeIDs.insert(std::make_pair(N, Nodes.size()));
+  if (Entry.second) {
+    Nodes.push_back(N);
+    Parent.push_back(Entry.first->second);
+    Rank.push_back(0);
+  }
+  return Entry.first->second;
+}
 
-    equivNodesToGlobals(Graph);
+// Return the root of the set containing the given node ID, halving the path
+// to it on the way.
+unsigned DSNodeEquivs::findRoot(unsigned ID) {
+  while (Parent[ID] != ID) {
+    Parent[ID] = Parent[Parent[ID]];
+    ID = Parent[ID];
   }
+  return ID;
+}
 
-  // Ensure all nodes from the globals graph are in an equivalence class.
-  addNodesFromGraph(TDDS.getGlobalsGraph());
+// Merge the sets containing the two node IDs, by rank.
+void DSNodeEquivs::unionNodes(unsigned ID1, unsigned ID2) {
+  unsigned Root1 = findRoot(ID1), Root2 = findRoot(ID2);
+  if (Root1 == Root2)
+    return;
+
+  if (Rank[Root1] < Rank[Root2])
+    std::swap(Root1, Root2);
+  Parent[Root2] = Root1;
+  if (Rank[Root1] == Rank[Root2])
+    ++Rank[Root1];
 }
 
 // Add nodes from the given graph into the equivalence classes.
@@ -63,7 +124,26 @@ void DSNodeEquivs::addNodesFromGraph(DSGraph *Graph) {
   DSGraph::node_iterator NodeIt = Graph->node_begin();
   DSGraph::node_iterator NodeItEnd = Graph->node_end();
   for (; NodeIt != NodeItEnd; ++NodeIt)
-    Classes.insert(&*NodeIt);
+    addNode(&*NodeIt);
+}
+
+// Record the node of every value in the given graph's scalar map.  Only the
+// globals are taken from the globals graph; function graphs contribute their
+// other values.
+void DSNodeEquivs::indexValuesInGraph(DSGraph *Graph, bool GlobalsOnly) {
+  DSScalarMap &ScalarMap = Graph->getScalarMap();
+  DSScalarMap::iterator ValueIt = ScalarMap.begin();
+  DSScalarMap::iterator ValueItEnd = ScalarMap.end();
+  for (; ValueIt != ValueItEnd; ++ValueIt) {
+    if (isa<GlobalValue>(ValueIt->first) != GlobalsOnly)
+      continue;
+
+    DSNode *Node = ValueIt->second.getNode();
+    if (!Node)
+      continue;
+
+    ValueIndex[ValueIt->first] = addNode(Node);
+  }
 }
 
 FunctionList DSNodeEquivs::getCallees(CallSite &CS) {
@@ -121,7 +201,8 @@ FunctionList DSNodeEquivs::getCallees(CallSite &CS) {
 }
 
 // Compute mappings through the given call site.
-void DSNodeEquivs::equivNodesThroughCallsite(CallInst *CI) {
+void DSNodeEquivs::equivNodesThroughCallsite(CallInst *CI,
+                                             NodePairList &Pairs) {
   TDDataStructures &TDDS = getAnalysis<TDDataStructures>();
   DSGraph &Graph = *TDDS.getDSGraph(*CI->getParent()->getParent());
   CallSite CS(CI);
@@ -162,12 +243,12 @@ void DSNodeEquivs::equivNodesThroughCallsite(CallInst *CI) {
 
     // Merge information from the computed node mapping into the equivalence
     // classes.
-    equivNodeMapping(NodeMap);
+    equivNodeMapping(NodeMap, Pairs);
   }
 }
 
 // Compute mappings with the globals graph.
-void DSNodeEquivs::equivNodesToGlobals(DSGraph *G) {
+void DSNodeEquivs::equivNodesToGlobals(DSGraph *G, NodePairList &Pairs) {
   DSGraph *GlobalsGr = G->getGlobalsGraph();
   DSGraph::NodeMapTy NodeMap;
   DSScalarMap &ScalarMap = GlobalsGr->getScalarMap();
@@ -191,12 +272,13 @@ void DSNodeEquivs::equivNodesToGlobals(DSGraph *G) {
     DSGraph::computeNodeMapping(LocalNode, GlobalNode, NodeMap, false);
 
     // Build EC's with this mapping.
-    equivNodeMapping(NodeMap);
+    equivNodeMapping(NodeMap, Pairs);
   }
 }
 
-// Utility function to put nodes that map together into equivalence classes.
-void DSNodeEquivs::equivNodeMapping(DSGraph::NodeMapTy &NodeMap) {
+// Utility function to record the pairs of nodes that map together.
+void DSNodeEquivs::equivNodeMapping(DSGraph::NodeMapTy &NodeMap,
+                                    NodePairList &Pairs) {
   DSGraph::NodeMapTy::iterator NodeMapIt = NodeMap.begin();
   DSGraph::NodeMapTy::iterator NodeMapItEnd = NodeMap.end();
   for (; NodeMapIt != NodeMapItEnd; ++NodeMapIt) {
@@ -207,7 +289,29 @@ void DSNodeEquivs::equivNodeMapping(DSGraph::NodeMapTy &NodeMap) {
     const DSNode *N1 = NodeMapIt->first;
     const DSNode *N2 = NH.getNode();
 
-    Classes.unionSets(N1, N2);
+    Pairs.push_back(std::make_pair(addNode(N1), addNode(N2)));
+  }
+}
+
+// Put each recorded pair of nodes into the same equivalence class.
+void DSNodeEquivs::mergePairs(const NodePairList &Pairs) {
+  NodePairList::const_iterator PairIt = Pairs.begin();
+  NodePairList::const_iterator PairItEnd = Pairs.end();
+  for (; PairIt != PairItEnd; ++PairIt)
+    unionNodes(PairIt->first, PairIt->second);
+}
+
+// Point every node directly at the root of its set and give each set a
+// dense class number, in order of the lowest node ID in it.
+void DSNodeEquivs::numberClasses() {
+  ClassOf.assign(Nodes.size(), NoClass);
+  NumClasses = 0;
+  for (unsigned ID = 0, E = Nodes.size(); ID != E; ++ID) {
+    unsigned Root = findRoot(ID);
+    Parent[ID] = Root;
+    if (ClassOf[Root] == NoClass)
+      ClassOf[Root] = NumClasses++;
+    ClassOf[ID] = ClassOf[Root];
   }
 }
 
@@ -217,15 +321,93 @@ bool DSNodeEquivs::runOnModule(Module &M) {
   return false;
 }
 
+void DSNodeEquivs::releaseMemory() {
+  Nodes.clear();
+  NodeIDs.clear();
+  Parent.clear();
+  Rank.clear();
+  ClassOf.clear();
+  NumClasses = 0;
+  ValueIndex.clear();
+  Classes = EquivalenceClasses<const DSNode*>();
+  ClassesBuilt = false;
+}
+
+// Print the classes, listing the named values in each.
+void DSNodeEquivs::print(raw_ostream &O, const Module *M) const {
+  O << Nodes.size() << " DSNodes in " << NumClasses
+    << " equivalence classes\n";
+  if (!M)
+    return;
+
+  std::vector<std::string> Members(NumClasses);
+  for (Module::const_iterator F = M->begin(), E = M->end(); F != E; ++F) {
+    std::vector<const Value *> Values;
+    for (Function::const_arg_iterator A = F->arg_begin(), AE = F->arg_end();
+         A != AE; ++A)
+      Values.push_back(A);
+    for (const_inst_iterator I = inst_begin(F), IE = inst_end(F); I != IE; ++I)
+      Values.push_back(&*I);
+
+    for (unsigned Index = 0; Index < Values.size(); ++Index) {
+      const Value *V = Values[Index];
+      DenseMap<const Value *, unsigned>::const_iterator Entry =
+        ValueIndex.find(V);
+      if (!V->hasName() || Entry == ValueIndex.end())
+        continue;
+      std::string &List = Members[ClassOf[Entry->second]];
+      List += " %" + V->getName().str() + " in @" + F->getName().str();
+    }
+  }
+
+  for (unsigned Class = 0; Class < NumClasses; ++Class)
+    if (!Members[Class].empty())
+      O << "  Class " << Class << ":" << Members[Class] << "\n";
+}
+
 // Returns the computed equivalence classes.
 const EquivalenceClasses<const DSNode *> &
 DSNodeEquivs::getEquivalenceClasses() {
+  if (!ClassesBuilt) {
+    for (unsigned ID = 0, E = Nodes.size(); ID != E; ++ID) {
+      Classes.insert(Nodes[ID]);
+      if (Parent[ID] != ID)
+        Classes.unionSets(Nodes[Parent[ID]], Nodes[ID]);
+    }
+    ClassesBuilt = true;
+  }
   return Classes;
 }
 
+// Returns the class number of the specified node, or NoClass if the node is
+// not in any of the graphs.
+unsigned DSNodeEquivs::getClassForNode(const DSNode *N) const {
+  DenseMap<const DSNode *, unsigned>::const_iterator Entry = NodeIDs.find(N);
+  if (Entry == NodeIDs.end())
+    return NoClass;
+  return ClassOf[Entry->second];
+}
+
+// Returns the class number of the node for the specified value, or NoClass if
+// the value has no node.
+unsigned DSNodeEquivs::getClassForValue(const Value *V) {
+  DenseMap<const Value *, unsigned>::const_iterator Entry = ValueIndex.find(V);
+  if (Entry != ValueIndex.end())
+    return ClassOf[Entry->second];
+
+  const DSNode *N = getMemberForValue(V);
+  return N ? getClassForNode(N) : NoClass;
+}
+
 // Returns the DSNode in the equivalence classes for the specified value.
 // Returns null for a node that was not found.
 const DSNode *DSNodeEquivs::getMemberForValue(const Value *V) {
+  // Values with a node in some graph were indexed when the classes were
+  // built.
+  DenseMap<const Value *, unsigned>::const_iterator Entry = ValueIndex.find(V);
+  if (Entry != ValueIndex.end())
+    return Nodes[Entry->second];
+
   TDDataStructures &TDDS = getAnalysis<TDDataStructures>();
   DSNodeHandle *NHForV = 0;
 
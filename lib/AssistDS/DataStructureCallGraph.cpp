@@ -110,17 +110,25 @@ void DataStructureCallGraph::addToCallGraph(Function *F) {
     } else {
       // Indirect call: Use CallTargetFinder to determine the set of targets to
       // the indirect call site. Be conservative about incomplete call sites.
+      //
+      // The call site gets a single edge to a node of its own, which in turn
+      // calls the targets. CallGraphSCCPasses check that indirect call sites
+      // have exactly one edge to a node without a function, so this lets the
+      // inliner run on this call graph and still visit the targets first.
+      CallGraphNode *Targets = new CallGraphNode(0);
+      TargetNodes.push_back(Targets);
+      Node->addCalledFunction(CS, Targets);
 
       if (!CTF.isComplete(CS)) {
         // Add CallsExternalNode as a target of incomplete call sites.
-        Node->addCalledFunction(CS, CallsExternalNode);
+        Targets->addCalledFunction(CallSite(), CallsExternalNode);
       }
 
-      SmallPtrSet<const Function *, 16> Targets(CTF.begin(CS), CTF.end(CS));
+      SmallPtrSet<const Function *, 16> Callees(CTF.begin(CS), CTF.end(CS));
 
       for (SmallPtrSet<const Function *, 16>::const_iterator
-           TI = Targets.begin(), TE = Targets.end(); TI != TE; ++TI) {
-        Node->addCalledFunction(CS, getOrInsertFunction(*TI));
+           TI = Callees.begin(), TE = Callees.end(); TI != TE; ++TI) {
+        Targets->addCalledFunction(CallSite(), getOrInsertFunction(*TI));
       }
     }
   }
@@ -26,6 +26,21 @@ char Devirtualize::ID = 0;
 // Pass statistics
 STATISTIC(FuncAdded, "Number of bounce functions added");
 STATISTIC(CSConvert, "Number of call sites converted");
+STATISTIC(HotGuards, "Number of call sites calling a hot target directly");
+
+namespace {
+  cl::opt<unsigned> SearchThreshold("devirt-search-threshold",
+         cl::desc("Dispatch targets past this many in a bounce function "
+                  "with a binary search"),
+         cl::init(8));
+  cl::opt<unsigned> HotGuardPercent("devirt-hot-guard",
+         cl::desc("Call a target directly at the call site when it gets at "
+                  "least this percentage of the profiled calls.  Profiles "
+                  "do not record which target an indirect call reached, so "
+                  "each target's share is estimated from its entry count "
+                  "less the profiled direct calls to it"),
+         cl::init(80));
+}
 
 // Pass registration
 RegisterPass<Devirtualize>
@@ -124,6 +139,310 @@ Devirtualize::findInCache (const CallSite & CS,
   return 0;
 }
 
+//
+// Method: computeIndirectCounts()
+//
+// Description:
+//  Estimate how often each function is called through a pointer: the number
+//  of times it was entered according to the loaded profile, less the counts
+//  of the blocks that call it directly.  This must run before any bounce
+//  function adds direct calls of its own.
+//
+void
+Devirtualize::computeIndirectCounts (Module & M) {
+  for (Module::iterator MI = M.begin(); MI != M.end(); ++MI) {
+    Function * F = MI;
+    double Count = PI->getExecutionCount (F);
+    if (Count == ProfileInfo::MissingValue)
+      continue;
+    for (Value::use_iterator U = F->use_begin(); U != F->use_end(); ++U) {
+      CallSite CS (*U);
+      if (!CS.getInstruction() || CS.getCalledFunction() != F)
+        continue;
+      double Calls = PI->getExecutionCount (CS.getInstruction()->getParent());
+      if (Calls != ProfileInfo::MissingValue)
+        Count -= Calls;
+    }
+    IndirectCounts[F] = std::max (Count, 0.0);
+  }
+}
+
+//
+// Method: getCount()
+//
+// Description:
+//  Return the estimated number of calls to the function through a pointer,
+//  or zero if there is no profile for it.
+//
+double
+Devirtualize::getCount (const Function * F) {
+  std::map<const Function *, double>::iterator I = IndirectCounts.find (F);
+  return (I != IndirectCounts.end()) ? I->second : 0;
+}
+
+//
+// Function object: HotterThan
+//
+// Description:
+//  Order call targets by decreasing execution count.
+//
+namespace {
+  struct HotterThan {
+    std::map<const Function *, double> & Counts;
+    HotterThan (std::map<const Function *, double> & C) : Counts(C) {}
+    bool operator() (const Function * A, const Function * B) const {
+      return Counts[A] > Counts[B];
+    }
+  };
+}
+
+//
+// Method: getSearchCompare()
+//
+// Description:
+//  Return the function that qsort() uses to order the entries of a search
+//  table by their function address, creating it the first time.
+//
+Function*
+Devirtualize::getSearchCompare (Module & M) {
+  if (SearchCompare)
+    return SearchCompare;
+
+  LLVMContext & Context = M.getContext();
+  Type * VoidPtrType = getVoidPtrType (Context);
+  Type * Int32Type = IntegerType::getInt32Ty (Context);
+  Type * IntPtrType = TD->getIntPtrType (Context);
+  std::vector<Type *> Params (2, VoidPtrType);
+  FunctionType * CompareTy = FunctionType::get (Int32Type, Params, false);
+  SearchCompare = Function::Create (CompareTy,
+                                    GlobalValue::InternalLinkage,
+                                    "devirt.compare",
+                                    &M);
+
+  //
+  // Each entry starts with the function pointer.
+  //
+  BasicBlock * BB = BasicBlock::Create (Context, "entry", SearchCompare);
+  Type * EntryPtrType = PointerType::getUnqual (VoidPtrType);
+  Value * Keys[2];
+  Function::arg_iterator Arg = SearchCompare->arg_begin();
+  for (unsigned index = 0; index < 2; ++index, ++Arg) {
+    Value * Entry = new BitCastInst (Arg, EntryPtrType, "", BB);
+    Value * Fn = new LoadInst (Entry, "", BB);
+    Keys[index] = new PtrToIntInst (Fn, IntPtrType, "", BB);
+  }
+  CmpInst * Less = CmpInst::Create (Instruction::ICmp,
+                                    CmpInst::ICMP_ULT,
+                                    Keys[0],
+                                    Keys[1],
+                                    "lt",
+                                    BB);
+  CmpInst * Greater = CmpInst::Create (Instruction::ICmp,
+                                       CmpInst::ICMP_UGT,
+                                       Keys[0],
+                                       Keys[1],
+                                       "gt",
+                                       BB);
+  Value * One = new ZExtInst (Greater, Int32Type, "", BB);
+  Value * Result = SelectInst::Create (Less,
+                                       ConstantInt::getSigned (Int32Type, -1),
+                                       One,
+                                       "",
+                                       BB);
+  ReturnInst::Create (Context, Result, BB);
+  return SearchCompare;
+}
+
+//
+// Method: buildSearch()
+//
+// Description:
+//  Build a binary search for the function pointer FArg among the given
+//  targets.  Nothing is known about the order of function addresses when
+//  the program is compiled, so the targets go into a table of (function,
+//  index) pairs that buildSearchSort() sorts by address when the program
+//  starts.  The index of the entry found selects the target block with a
+//  switch.  A pointer that is not found, which can only happen if the table
+//  is used before it is sorted, branches to Miss.
+//
+// Return value:
+//  The basic block at the root of the search.
+//
+BasicBlock*
+Devirtualize::buildSearch (Function * F, Value * FArg,
+                           std::vector<const Function*>& Targets,
+                           std::map<const Function*, BasicBlock*>& targets,
+                           BasicBlock * Miss) {
+  Module * M = F->getParent();
+  LLVMContext & Context = M->getContext();
+  Type * VoidPtrType = getVoidPtrType (Context);
+  Type * Int32Type = IntegerType::getInt32Ty (Context);
+  Type * IntPtrType = TD->getIntPtrType (Context);
+
+  //
+  // Create the table, with the targets in the order given.
+  //
+  std::vector<Type *> Fields;
+  Fields.push_back (VoidPtrType);
+  Fields.push_back (Int32Type);
+  StructType * EntryType = StructType::get (Context, Fields);
+  std::vector<Constant *> Entries;
+  for (unsigned index = 0; index < Targets.size(); ++index) {
+    std::vector<Constant *> Entry;
+    Entry.push_back (ConstantExpr::getBitCast (const_cast<Function*>(Targets[index]),
+                                               VoidPtrType));
+    Entry.push_back (ConstantInt::get (Int32Type, index));
+    Entries.push_back (ConstantStruct::get (EntryType, Entry));
+  }
+  ArrayType * TableType = ArrayType::get (EntryType, Entries.size());
+  GlobalVariable * Table = new GlobalVariable (*M,
+                                               TableType,
+                                               false,
+                                               GlobalValue::InternalLinkage,
+                                               ConstantArray::get (TableType,
+                                                                   Entries),
+                                               F->getName() + ".table");
+  SearchTables.push_back (Table);
+
+  BasicBlock * SearchBB = BasicBlock::Create (Context, "search", F);
+  BasicBlock * LoopBB = BasicBlock::Create (Context, "search.loop", F);
+  BasicBlock * BodyBB = BasicBlock::Create (Context, "search.body", F);
+  BasicBlock * StepBB = BasicBlock::Create (Context, "search.step", F);
+  BasicBlock * FoundBB = BasicBlock::Create (Context, "search.found", F);
+  Value * Zero = ConstantInt::get (Int32Type, 0);
+  Value * One = ConstantInt::get (Int32Type, 1);
+
+  Value * Key = new PtrToIntInst (FArg, IntPtrType, "key", SearchBB);
+  BranchInst::Create (LoopBB, SearchBB);
+
+  //
+  // Search the entries in [Low, High).
+  //
+  PHINode * Low = PHINode::Create (Int32Type, 2, "low", LoopBB);
+  PHINode * High = PHINode::Create (Int32Type, 2, "high", LoopBB);
+  CmpInst * More = CmpInst::Create (Instruction::ICmp,
+                                    CmpInst::ICMP_ULT,
+                                    Low,
+                                    High,
+                                    "more",
+                                    LoopBB);
+  BranchInst::Create (BodyBB, Miss, More, LoopBB);
+
+  Value * Sum = BinaryOperator::CreateAdd (Low, High, "", BodyBB);
+  Value * Mid = BinaryOperator::CreateLShr (Sum, One, "mid", BodyBB);
+  Value * Idx[3] = {Zero, Mid, Zero};
+  Value * FnPtr = GetElementPtrInst::Create (Table, Idx, "", BodyBB);
+  Value * Fn = new LoadInst (FnPtr, "", BodyBB);
+  Value * FnInt = new PtrToIntInst (Fn, IntPtrType, "", BodyBB);
+  CmpInst * Equal = CmpInst::Create (Instruction::ICmp,
+                                     CmpInst::ICMP_EQ,
+                                     Key,
+                                     FnInt,
+                                     "sc",
+                                     BodyBB);
+  BranchInst::Create (FoundBB, StepBB, Equal, BodyBB);
+
+  CmpInst * Below = CmpInst::Create (Instruction::ICmp,
+                                     CmpInst::ICMP_ULT,
+                                     Key,
+                                     FnInt,
+                                     "below",
+                                     StepBB);
+  Value * Next = BinaryOperator::CreateAdd (Mid, One, "", StepBB);
+  Value * NewLow = SelectInst::Create (Below, Low, Next, "", StepBB);
+  Value * NewHigh = SelectInst::Create (Below, Mid, High, "", StepBB);
+  BranchInst::Create (LoopBB, StepBB);
+  Low->addIncoming (Zero, SearchBB);
+  Low->addIncoming (NewLow, StepBB);
+  High->addIncoming (ConstantInt::get (Int32Type, Targets.size()), SearchBB);
+  High->addIncoming (NewHigh, StepBB);
+
+  Idx[2] = One;
+  Value * IndexPtr = GetElementPtrInst::Create (Table, Idx, "", FoundBB);
+  Value * Index = new LoadInst (IndexPtr, "index", FoundBB);
+  SwitchInst * Switch = SwitchInst::Create (Index, Miss, Targets.size(),
+                                            FoundBB);
+  for (unsigned index = 0; index < Targets.size(); ++index)
+    Switch->addCase (cast<ConstantInt>(ConstantInt::get (Int32Type, index)),
+                     targets[Targets[index]]);
+  return SearchBB;
+}
+
+//
+// Method: buildSearchSort()
+//
+// Description:
+//  Add a constructor that sorts every search table by function address with
+//  qsort() before the program runs.
+//
+void
+Devirtualize::buildSearchSort (Module & M) {
+  if (SearchTables.empty())
+    return;
+
+  LLVMContext & Context = M.getContext();
+  Type * VoidType = Type::getVoidTy (Context);
+  Type * VoidPtrType = getVoidPtrType (Context);
+  Type * Int32Type = IntegerType::getInt32Ty (Context);
+  Type * IntPtrType = TD->getIntPtrType (Context);
+  Function * Compare = getSearchCompare (M);
+  Constant * QSort = M.getOrInsertFunction ("qsort",
+                                            VoidType,
+                                            VoidPtrType,
+                                            IntPtrType,
+                                            IntPtrType,
+                                            Compare->getType(),
+                                            NULL);
+
+  Function * SortFunc = Function::Create (FunctionType::get (VoidType, false),
+                                          GlobalValue::InternalLinkage,
+                                          "devirt.sort",
+                                          &M);
+  BasicBlock * BB = BasicBlock::Create (Context, "entry", SortFunc);
+  for (unsigned index = 0; index < SearchTables.size(); ++index) {
+    GlobalVariable * Table = SearchTables[index];
+    ArrayType * TableType = cast<ArrayType>(Table->getType()->getElementType());
+    Value * Args[4];
+    Args[0] = ConstantExpr::getBitCast (Table, VoidPtrType);
+    Args[1] = ConstantInt::get (IntPtrType, TableType->getNumElements());
+    Args[2] = ConstantInt::get (IntPtrType,
+                    TD->getTypeAllocSize (TableType->getElementType()));
+    Args[3] = Compare;
+    CallInst::Create (QSort, Args, "", BB);
+  }
+  ReturnInst::Create (Context, BB);
+
+  //
+  // Append the constructor to llvm.global_ctors.  A call through a bounce
+  // function made before it runs still finds its target: the search misses
+  // and the targets are then tested one at a time.
+  //
+  std::vector<Constant *> CtorInit;
+  CtorInit.push_back (ConstantInt::get (Int32Type, 65535));
+  CtorInit.push_back (SortFunc);
+  Constant * SortCtor = ConstantStruct::getAnon (Context, CtorInit);
+
+  std::vector<Constant *> CurrentCtors;
+  GlobalVariable * GVCtor = M.getNamedGlobal ("llvm.global_ctors");
+  if (GVCtor) {
+    if (Constant * C = GVCtor->getInitializer()) {
+      for (unsigned index = 0; index < C->getNumOperands(); ++index) {
+        CurrentCtors.push_back (cast<Constant>(C->getOperand (index)));
+      }
+    }
+    GVCtor->eraseFromParent();
+  }
+  CurrentCtors.push_back (SortCtor);
+
+  ArrayType * AT = ArrayType::get (SortCtor->getType(), CurrentCtors.size());
+  new GlobalVariable (M,
+                      AT,
+                      false,
+                      GlobalValue::AppendingLinkage,
+                      ConstantArray::get (AT, CurrentCtors),
+                      "llvm.global_ctors");
+}
+
 //
 // Method: buildBounce()
 //
@@ -131,7 +450,8 @@ Devirtualize::findInCache (const CallSite & CS,
 //  Replaces the given call site with a call to a bounce function.  The
 //  bounce function compares the function pointer to one of the given
 //  target functions and calls the function directly if the pointer
-//  matches.
+//  matches.  Targets are tested hottest first.  Past SearchThreshold
+//  targets, the remaining ones are found with a binary search.
 //
 Function*
 Devirtualize::buildBounce (CallSite CS, std::vector<const Function*>& Targets) {
@@ -192,10 +512,11 @@ Devirtualize::buildBounce (CallSite CS, std::vector<const Function*>& Targets) {
     BasicBlock* BL = BasicBlock::Create (M->getContext(), FL->getName(), F);
     targets[FL] = BL;
     // Create the direct function call
-    Value* directCall = CallInst::Create (const_cast<Function*>(FL),
-                                          fargs,
-                                          "",
-                                          BL);
+    CallInst* directCall = CallInst::Create (const_cast<Function*>(FL),
+                                             fargs,
+                                             "",
+                                             BL);
+    directCall->setCallingConv (FL->getCallingConv());
 
     // Add the return instruction for the basic block
     if (CS.getType()->isVoidTy())
@@ -219,19 +540,44 @@ Devirtualize::buildBounce (CallSite CS, std::vector<const Function*>& Targets) {
   //
   BranchInst * InsertPt = BranchInst::Create (failBB, entryBB);
 
+  //
+  // Test the hottest targets first.  The tests are built from the last one
+  // back, each falling through to the one built before it.
+  //
+  std::map<const Function *, double> Counts;
+  for (unsigned index = 0; index < Targets.size(); ++index)
+    Counts[Targets[index]] = getCount (Targets[index]);
+  std::vector<const Function*> Chain (Targets);
+  std::stable_sort (Chain.begin(), Chain.end(), HotterThan (Counts));
+
+  std::vector<const Function*> Searched;
+  if (Chain.size() > SearchThreshold + 1) {
+    Searched.assign (Chain.begin() + SearchThreshold, Chain.end());
+    Chain.resize (SearchThreshold);
+  }
+
   //
   // Create basic blocks which will test the value of the incoming function
   // pointer and branch to the appropriate basic block to call the function.
+  // The searched targets are also tested one at a time if the search misses.
   //
   Type * VoidPtrType = getVoidPtrType (M->getContext());
   Value * FArg = castTo (F->arg_begin(), VoidPtrType, "", InsertPt);
   BasicBlock * tailBB = failBB;
-  for (unsigned index = 0; index < Targets.size(); ++index) {
+  std::vector<const Function*> Tests (Chain);
+  Tests.insert (Tests.end(), Searched.begin(), Searched.end());
+  for (unsigned index = Tests.size(); index-- > 0; ) {
+    //
+    // The search goes between the hot targets and the fallback tests.
+    //
+    if (index + 1 == Chain.size() && !Searched.empty())
+      tailBB = buildSearch (F, FArg, Searched, targets, tailBB);
+
     //
     // Cast the function pointer to an integer.  This can go in the entry
     // block.
     //
-    Value * TargetInt = castTo (const_cast<Function*>(Targets[index]),
+    Value * TargetInt = castTo (const_cast<Function*>(Tests[index]),
                                 VoidPtrType,
                                 "",
                                 InsertPt);
@@ -242,9 +588,9 @@ Devirtualize::buildBounce (CallSite CS, std::vector<const Function*>& Targets) {
     // basic block performing the direct call for that function; otherwise,
     // we'll branch to the next function call target.
     //
-    BasicBlock* TB = targets[Targets[index]];
+    BasicBlock* TB = targets[Tests[index]];
     BasicBlock* newB = BasicBlock::Create (M->getContext(),
-                                           "test." + Targets[index]->getName(),
+                                           "test." + Tests[index]->getName(),
                                            F);
     CmpInst * setcc = CmpInst::Create (Instruction::ICmp,
                                        CmpInst::ICMP_EQ,
@@ -260,6 +606,8 @@ Devirtualize::buildBounce (CallSite CS, std::vector<const Function*>& Targets) {
     //
     tailBB = newB;
   }
+  if (Chain.empty() && !Searched.empty())
+    tailBB = buildSearch (F, FArg, Searched, targets, tailBB);
 
   //
   // Make the entry basic block branch to the first comparison basic block.
@@ -316,11 +664,80 @@ Devirtualize::makeDirectCall (CallSite & CS) {
       bounceCache[NF] = targetSet;
     }
 
+    //
+    // Find the hottest target.  If the profile shows that it gets most of
+    // the calls, test for it at the call site and call it directly there.
+    // The profile does not say which target each call reached, so the share
+    // of a target is taken from its calls through pointers anywhere in the
+    // program.  A call site that the profile shows never ran is left alone.
+    //
+    const Function * Hot = 0;
+    double Total = 0;
+    for (unsigned index = 0; index < Targets.size(); ++index) {
+      double Count = getCount (Targets[index]);
+      Total += Count;
+      if (!Hot || Count > getCount (Hot))
+        Hot = Targets[index];
+    }
+    Value * CalledValue = CS.getCalledValue();
+    double SiteCount = PI->getExecutionCount (CS.getInstruction()->getParent());
+    bool Guard = (SiteCount != 0) && (Total > 0) &&
+                 (getCount (Hot) * 100 >= Total * HotGuardPercent) &&
+                 (Hot->getType() == CalledValue->getType()) &&
+                 isa<CallInst>(CS.getInstruction());
+
     //
     // Replace the original call with a call to the bounce function.
     //
-    if (CallInst* CI = dyn_cast<CallInst>(CS.getInstruction())) {
-      std::vector<Value*> Params (CI->op_begin(), CI->op_end());
+    if (Guard) {
+      CallInst * CI = cast<CallInst>(CS.getInstruction());
+      LLVMContext & Context = CI->getContext();
+      BasicBlock * Head = CI->getParent();
+      Function * Caller = Head->getParent();
+      BasicBlock * Cont = Head->splitBasicBlock (CI, "devirt.cont");
+      BasicBlock * HotBB = BasicBlock::Create (Context, "devirt.hot",
+                                               Caller, Cont);
+      BasicBlock * ColdBB = BasicBlock::Create (Context, "devirt.cold",
+                                                Caller, Cont);
+      Head->getTerminator()->eraseFromParent();
+      CmpInst * setcc = CmpInst::Create (Instruction::ICmp,
+                                         CmpInst::ICMP_EQ,
+                                         CalledValue,
+                                         const_cast<Function*>(Hot),
+                                         "hot",
+                                         Head);
+      BranchInst::Create (HotBB, ColdBB, setcc, Head);
+
+      std::vector<Value*> Args (CS.arg_begin(), CS.arg_end());
+      CallInst * HotCall = CallInst::Create (const_cast<Function*>(Hot),
+                                             Args,
+                                             "",
+                                             HotBB);
+      HotCall->setCallingConv (CI->getCallingConv());
+      HotCall->setAttributes (CI->getAttributes());
+      BranchInst::Create (Cont, HotBB);
+      std::vector<Value*> Params;
+      Params.push_back (CS.getCalledValue());
+      Params.insert (Params.end(), CS.arg_begin(), CS.arg_end());
+      CallInst * ColdCall = CallInst::Create (const_cast<Function*>(NF),
+                                              Params,
+                                              "",
+                                              ColdBB);
+      BranchInst::Create (Cont, ColdBB);
+
+      if (!CI->getType()->isVoidTy()) {
+        std::string name = CI->hasName() ? CI->getName().str() + ".dv" : "";
+        PHINode * PN = PHINode::Create (CI->getType(), 2, name, &Cont->front());
+        PN->addIncoming (HotCall, HotBB);
+        PN->addIncoming (ColdCall, ColdBB);
+        CI->replaceAllUsesWith(PN);
+      }
+      CI->eraseFromParent();
+      ++HotGuards;
+    } else if (CallInst* CI = dyn_cast<CallInst>(CS.getInstruction())) {
+      std::vector<Value*> Params;
+      Params.push_back (CS.getCalledValue());
+      Params.insert (Params.end(), CS.arg_begin(), CS.arg_end());
       std::string name = CI->hasName() ? CI->getName().str() + ".dv" : "";
       CallInst* CN = CallInst::Create (const_cast<Function*>(NF),
                                        Params,
@@ -329,7 +746,9 @@ Devirtualize::makeDirectCall (CallSite & CS) {
       CI->replaceAllUsesWith(CN);
       CI->eraseFromParent();
     } else if (InvokeInst* CI = dyn_cast<InvokeInst>(CS.getInstruction())) {
-      std::vector<Value*> Params (CI->op_begin(), CI->op_end());
+      std::vector<Value*> Params;
+      Params.push_back (CS.getCalledValue());
+      Params.insert (Params.end(), CS.arg_begin(), CS.arg_end());
       std::string name = CI->hasName() ? CI->getName().str() + ".dv" : "";
       InvokeInst* CN = InvokeInst::Create(const_cast<Function*>(NF),
                                           CI->getNormalDest(),
@@ -401,6 +820,12 @@ Devirtualize::runOnModule (Module & M) {
   //
   TD = &getAnalysis<TargetData>();
 
+  //
+  // Get the execution counts used to order the targets.
+  //
+  PI = &getAnalysis<ProfileInfo>();
+  computeIndirectCounts (M);
+
   // Visit all of the call instructions in this function and record those that
   // are indirect function calls.
   //
@@ -416,6 +841,11 @@ Devirtualize::runOnModule (Module & M) {
     makeDirectCall (CS);
   }
 
+  //
+  // Sort the search tables of the bounce functions when the program starts.
+  //
+  buildSearchSort (M);
+
   //
   // Conservatively assume that we've changed one or more call sites.
   //
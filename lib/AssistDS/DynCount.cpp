@@ -7,8 +7,10 @@
 //
 //===----------------------------------------------------------------------===//
 //
-// This file implements a test pass which helps test the generation of formulas
-// and constraints.
+// This file implements a pass that counts, per load and store, how often each
+// one executes, along with whether DSA considers it type safe and which DSNode
+// it touches.  The counts are kept per thread and written out by the DynCount
+// runtime in the format described in poolalloc_runtime/DynCount.h.
 //
 //===----------------------------------------------------------------------===//
 
@@ -16,15 +18,39 @@
 #include "llvm/Module.h"
 #include "llvm/Instructions.h"
 #include "llvm/Constants.h"
+#include "llvm/DerivedTypes.h"
 #include "llvm/Target/TargetData.h"
+#include "assistDS/DSNodeEquivs.h"
+#include "dsa/DataStructure.h"
+#include "dsa/DSGraph.h"
 #include "dsa/TypeSafety.h"
+#include "poolalloc_runtime/DynCount.h"
+
+#include <string>
+#include <vector>
 
 using namespace llvm;
 class Dyncount : public ModulePass {
 protected:
-  void instrumentLoad (GlobalVariable * Counter, LoadInst * LI);
-  void instrumentStore (GlobalVariable * Counter, StoreInst * SI);
+  // An instrumented load or store and its entry in the site table
+  struct Site {
+    Instruction * I;
+    unsigned Function;
+    unsigned Index;
+    unsigned Node;
+    bool IsStore;
+    bool Safe;
+  };
+
+  void instrument (GlobalVariable * Shard, unsigned SiteNo, Instruction * I);
+  void registerThread (Function & F, GlobalVariable * Shard,
+                       GlobalVariable * Registered);
+  unsigned getNodeID (Value * Ptr, Function * F);
   dsa::TypeSafety<TDDataStructures> *TS;
+  TDDataStructures * DS;
+
+  // Classes of DSNodes that stand for the same memory in different graphs
+  DSNodeEquivs * Equivs;
 
 public:
   static char ID;
@@ -35,7 +61,9 @@ public:
   virtual bool runOnModule (Module & M);
   virtual void getAnalysisUsage(AnalysisUsage &AU) const {
     AU.addRequired<TargetData>();
+    AU.addRequired<TDDataStructures>();
     AU.addRequired<dsa::TypeSafety<TDDataStructures> >();
+    AU.addRequired<DSNodeEquivs>();
   }
 };
 
@@ -43,38 +71,106 @@ char Dyncount::ID = 0;
 static RegisterPass<Dyncount>
 X ("dyncount", "Instrument code to count number of Load/Stores");
 
+//
+// Method: getNodeID()
+//
+// Description:
+//  Return the number identifying the memory that the pointer points to: one
+//  more than the DSNodeEquivs class of its DSNode, from the function's graph
+//  or, for globals, from the globals graph.  Each function's graph has its
+//  own copy of a node, so the class is what makes accesses to one object from
+//  different functions report the same number.
+//
+unsigned
+Dyncount::getNodeID (Value * Ptr, Function * F) {
+  DSNodeHandle DSH;
+  if (DS->hasDSGraph (*F) && DS->getDSGraph (*F)->hasNodeForValue (Ptr))
+    DSH = DS->getDSGraph (*F)->getNodeForValue (Ptr);
+  if (DSH.isNull() && isa<GlobalValue>(Ptr) &&
+      DS->getGlobalsGraph()->hasNodeForValue (Ptr))
+    DSH = DS->getGlobalsGraph()->getNodeForValue (Ptr);
+
+  const DSNode * N = DSH.getNode();
+  if (!N)
+    return 0;
+  unsigned Class = Equivs->getClassForNode (N);
+  if (Class == DSNodeEquivs::NoClass)
+    return 0;
+  return Class + 1;
+}
 
+//
+// Method: instrument()
+//
+// Description:
+//  Increment the calling thread's counter for the site right before the
+//  access.  The shard is thread local, so the plain load, add and store
+//  neither race with nor share cache lines with other threads.
+//
 void
-Dyncount::instrumentLoad (GlobalVariable * Counter, LoadInst * LI) {
-  //
-  // Generate a load, increment, and store right before the GEP.
-  //
-  LLVMContext & Context = Counter->getParent()->getContext();
+Dyncount::instrument (GlobalVariable * Shard, unsigned SiteNo,
+                      Instruction * I) {
+  LLVMContext & Context = Shard->getParent()->getContext();
+  Constant * Idx[2] = {
+    ConstantInt::get (Type::getInt32Ty(Context), 0),
+    ConstantInt::get (Type::getInt32Ty(Context), SiteNo)
+  };
+  Constant * Counter = ConstantExpr::getGetElementPtr (Shard, Idx);
   ConstantInt * One = ConstantInt::get (Type::getInt64Ty(Context), 1); 
-  LoadInst * OldValue = new LoadInst (Counter, "count", LI);
+  LoadInst * OldValue = new LoadInst (Counter, "count", I);
   Instruction * NewValue = BinaryOperator::Create (BinaryOperator::Add,
                                                    OldValue,
                                                    One,
                                                    "count",
-                                                   LI);
-  new StoreInst (NewValue, Counter, LI);
+                                                   I);
+  new StoreInst (NewValue, Counter, I);
   return;
 }
+
+//
+// Method: registerThread()
+//
+// Description:
+//  Make the function hand the calling thread's shard to the runtime the
+//  first time the thread runs instrumented code, so that the runtime can add
+//  it to the totals when the thread or the program exits.
+//
 void
-Dyncount::instrumentStore (GlobalVariable * Counter, StoreInst * SI) {
+Dyncount::registerThread (Function & F, GlobalVariable * Shard,
+                          GlobalVariable * Registered) {
+  Module & M = *F.getParent();
+  LLVMContext & Context = M.getContext();
+
   //
-  // Generate a load, increment, and store right before the GEP.
+  // Split the entry block after its allocas so that they stay in the entry
+  // block.
   //
-  LLVMContext & Context = Counter->getParent()->getContext();
-  ConstantInt * One = ConstantInt::get (Type::getInt64Ty(Context), 1); 
-  LoadInst * OldValue = new LoadInst (Counter, "count", SI);
-  Instruction * NewValue = BinaryOperator::Create (BinaryOperator::Add,
-                                                   OldValue,
-                                                   One,
-                                                   "count",
-                                                   SI);
-  new StoreInst (NewValue, Counter, SI);
-  return;
+  BasicBlock * Entry = &F.getEntryBlock();
+  BasicBlock::iterator InsertPt = Entry->begin();
+  while (isa<AllocaInst>(InsertPt))
+    ++InsertPt;
+  BasicBlock * Body = Entry->splitBasicBlock (InsertPt, "dyncount.body");
+  BasicBlock * Register = BasicBlock::Create (Context, "dyncount.register",
+                                              &F, Body);
+
+  Entry->getTerminator()->eraseFromParent();
+  Value * Flag = new LoadInst (Registered, "registered", Entry);
+  Value * Done = new ICmpInst (*Entry, ICmpInst::ICMP_NE, Flag,
+                               ConstantInt::get (Flag->getType(), 0),
+                               "registered");
+  BranchInst::Create (Body, Register, Done, Entry);
+
+  Type * Int64PtrTy = Type::getInt64PtrTy (Context);
+  Constant * RegisterFn = M.getOrInsertFunction ("DYN_COUNT_register",
+                                                 Type::getVoidTy (Context),
+                                                 Int64PtrTy,
+                                                 Registered->getType(),
+                                                 NULL);
+  std::vector<Value *> args;
+  args.push_back (ConstantExpr::getBitCast (Shard, Int64PtrTy));
+  args.push_back (Registered);
+  CallInst::Create (RegisterFn, args, "", Register);
+  BranchInst::Create (Body, Register);
 }
 
 //
@@ -85,57 +181,123 @@ Dyncount::instrumentStore (GlobalVariable * Counter, StoreInst * SI) {
 //
 bool
 Dyncount::runOnModule (Module & M) {
-  //
-  // Create two global counters within the module.
-  //
   TS = &getAnalysis<dsa::TypeSafety<TDDataStructures> >();
-  ConstantInt * Zero = ConstantInt::get (Type::getInt64Ty(M.getContext()), 0); 
-  GlobalVariable * Total = new GlobalVariable (M,
-                                               Type::getInt64Ty(M.getContext()),
-                                               false,
-                                               GlobalValue::InternalLinkage,
-                                               Zero,
-                                               "Total");
-  GlobalVariable * Safe = new GlobalVariable (M,
-                                              Type::getInt64Ty(M.getContext()),
-                                              false,
-                                              GlobalValue::InternalLinkage,
-                                              Zero,
-                                              "Safe");
+  DS = &getAnalysis<TDDataStructures>();
+  Equivs = &getAnalysis<DSNodeEquivs>();
+  LLVMContext & Context = M.getContext();
 
+  //
+  // Number every load and store in the module.  The sites are collected
+  // before any instrumentation is added so that the counter updates are not
+  // counted themselves.
+  //
+  std::vector<Site> Sites;
+  std::vector<Function *> Instrumented;
+  std::string Names;
   for (Module::iterator F = M.begin(); F != M.end(); ++F){
+    unsigned Index = 0;
     for (Function::iterator B = F->begin(), FE = F->end(); B != FE; ++B) {      
       for (BasicBlock::iterator I = B->begin(), BE = B->end(); I != BE; I++) {
-        if(LoadInst *LI = dyn_cast<LoadInst>(I)) {
-          instrumentLoad(Total, LI);
-          if(TS->isTypeSafe(LI->getOperand(0),LI->getParent()->getParent()))
-            instrumentLoad(Safe, LI);
-
-          // check if safe
-        } else if(StoreInst *SI = dyn_cast<StoreInst>(I)) {
-          instrumentStore(Total, SI);
-          if(TS->isTypeSafe(SI->getOperand(1),SI->getParent()->getParent()))
-            instrumentStore(Safe, SI);
-          // check if safe
-        }
+        Value * Ptr;
+        if (LoadInst *LI = dyn_cast<LoadInst>(I))
+          Ptr = LI->getPointerOperand();
+        else if (StoreInst *SI = dyn_cast<StoreInst>(I))
+          Ptr = SI->getPointerOperand();
+        else
+          continue;
+
+        Site S;
+        S.I = I;
+        S.Function = Instrumented.size();
+        S.Index = Index++;
+        S.Node = getNodeID (Ptr, F);
+        S.IsStore = isa<StoreInst>(I);
+        S.Safe = TS->isTypeSafe (Ptr, F);
+        Sites.push_back (S);
       }
     }
+    if (Index) {
+      Instrumented.push_back (F);
+      Names += F->getName().str();
+      Names += '\0';
+    }
+  }
+
+  //
+  // Create the site table describing each counter, and the function names
+  // the table refers to.
+  //
+  Type * Int8Ty  = Type::getInt8Ty (Context);
+  Type * Int16Ty = Type::getInt16Ty (Context);
+  Type * Int32Ty = Type::getInt32Ty (Context);
+  Type * Int64Ty = Type::getInt64Ty (Context);
+  StructType * SiteTy = StructType::get (Int32Ty, Int32Ty, Int32Ty,
+                                         Int8Ty, Int8Ty, Int16Ty, NULL);
+  std::vector<Constant *> Table;
+  for (unsigned index = 0; index < Sites.size(); ++index) {
+    const Site & S = Sites[index];
+    Constant * Fields[] = {
+      ConstantInt::get (Int32Ty, S.Function),
+      ConstantInt::get (Int32Ty, S.Index),
+      ConstantInt::get (Int32Ty, S.Node),
+      ConstantInt::get (Int8Ty, S.IsStore ? DynCountStore : DynCountLoad),
+      ConstantInt::get (Int8Ty, S.Safe),
+      ConstantInt::get (Int16Ty, 0)
+    };
+    Table.push_back (ConstantStruct::get (SiteTy, Fields));
   }
+  ArrayType * TableTy = ArrayType::get (SiteTy, Sites.size());
+  GlobalVariable * SiteTable =
+    new GlobalVariable (M, TableTy, true, GlobalValue::InternalLinkage,
+                        ConstantArray::get (TableTy, Table),
+                        "__dyncount_sites");
+  Constant * NameData = ConstantDataArray::getString (Context, Names, false);
+  GlobalVariable * NameTable =
+    new GlobalVariable (M, NameData->getType(), true,
+                        GlobalValue::InternalLinkage, NameData,
+                        "__dyncount_names");
 
   //
-  // Add a call to main() that will record the values on exit().
+  // Each thread counts into its own shard of per-site counters.  The
+  // runtime learns about a shard when the thread first runs instrumented
+  // code.
+  //
+  ArrayType * ShardTy = ArrayType::get (Int64Ty, Sites.size());
+  GlobalVariable * Shard =
+    new GlobalVariable (M, ShardTy, false, GlobalValue::InternalLinkage,
+                        ConstantAggregateZero::get (ShardTy),
+                        "__dyncount_shard", 0, true);
+  GlobalVariable * Registered =
+    new GlobalVariable (M, Int8Ty, false, GlobalValue::InternalLinkage,
+                        ConstantInt::get (Int8Ty, 0),
+                        "__dyncount_registered", 0, true);
+
+  for (unsigned index = 0; index < Sites.size(); ++index)
+    instrument (Shard, index, Sites[index].I);
+  for (unsigned index = 0; index < Instrumented.size(); ++index)
+    registerThread (*Instrumented[index], Shard, Registered);
+
+  //
+  // Add a call to main() that will hand the runtime the site table, so that
+  // it can record the counts on exit().
   //
   Function *MainFunc = M.getFunction("main") ? M.getFunction("main")
     : M.getFunction ("MAIN__");
 
   BasicBlock & BB = MainFunc->getEntryBlock();
-  Constant * Setup = M.getOrInsertFunction ("DYN_COUNT_setup", Type::getVoidTy(M.getContext()), Total->getType(), Safe->getType(), NULL);
+  Type * Int8PtrTy = Type::getInt8PtrTy (Context);
+  Constant * Setup = M.getOrInsertFunction ("DYN_COUNT_setup",
+                                            Type::getVoidTy(Context),
+                                            Int8PtrTy, Int32Ty,
+                                            Int8PtrTy, Int64Ty,
+                                            NULL);
   std::vector<Value *> args;
-  args.push_back (Total);
-  args.push_back (Safe);
+  args.push_back (ConstantExpr::getBitCast (SiteTable, Int8PtrTy));
+  args.push_back (ConstantInt::get (Int32Ty, Sites.size()));
+  args.push_back (ConstantExpr::getBitCast (NameTable, Int8PtrTy));
+  args.push_back (ConstantInt::get (Int64Ty, Names.size()));
   CallInst::Create (Setup, args, "", BB.getFirstNonPHI());
 
 
   return true;
 }
-
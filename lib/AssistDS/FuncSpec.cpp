@@ -9,11 +9,13 @@
 //
 // This pass clones functions that take constant function pointers as arguments
 // from some call sites. It changes those call sites to call cloned functions.
+// Clones are ranked and limited by the shared SpecializationBudget.
 // 
 //===----------------------------------------------------------------------===//
 #define DEBUG_TYPE "funcspec"
 
 #include "assistDS/FuncSpec.h"
+#include "assistDS/SpecializationBudget.h"
 
 #include "llvm/Transforms/Utils/Cloning.h"
 #include "llvm/ADT/Statistic.h"
@@ -34,7 +36,8 @@ STATISTIC(numReplaced, "Number of Calls Replaced");
 //
 // Description:
 //  Entry point for this LLVM pass. Search for call sites, that take functions as arguments
-//  Clone those functions, and pass the clone.
+//  Clone those functions, and pass the clone.  The constant arguments are
+//  folded into each clone.
 //
 // Inputs:
 //  M - A reference to the LLVM module to transform
@@ -47,8 +50,15 @@ STATISTIC(numReplaced, "Number of Calls Replaced");
 //  false - The module was not modified.
 //
 bool FuncSpec::runOnModule(Module& M) {
-  std::map<CallInst*, std::vector<std::pair<unsigned, Constant*> > > cloneSites;
-  std::map<std::pair<Function*, std::vector<std::pair<unsigned, Constant*> > >, Function* > toClone;
+  typedef SpecializationBudget::ArgBindings ArgBindings;
+  typedef std::pair<Function*, ArgBindings> CloneKey;
+
+  SpecializationBudget &Budget = getAnalysis<SpecializationBudget>();
+  ProfileInfo *PI = &getAnalysis<ProfileInfo>();
+
+  std::map<CallInst*, ArgBindings> cloneSites;
+  std::map<CloneKey, double> siteWeights;
+  std::vector<CloneKey> order;
 
   for (Module::iterator I = M.begin(); I != M.end(); ++I)
     if (!I->isDeclaration() && !I->mayBeOverridden()) {
@@ -73,45 +83,97 @@ bool FuncSpec::runOnModule(Module& M) {
           ui != ue; ++ui) {
         if (CallInst* CI = dyn_cast<CallInst>(*ui)) {
           // Check that it is the called value (and not an argument)
-          if(CI->getCalledValue()->stripPointerCasts() == I) {
-            std::vector<std::pair<unsigned, Constant*> > Consts;
+          if(CI->getCalledFunction() == I) {
+            ArgBindings Consts;
             for (unsigned x = 0; x < FPArgs.size(); ++x)
-              if (Constant* C = dyn_cast<Constant>(ui->getOperand(FPArgs.at(x) + 1))) {
+              if (Constant* C = dyn_cast<Constant>(CI->getArgOperand(FPArgs.at(x)))) {
                 // If the argument passed, at any of the locations noted earlier
                 // is a constant function, store the pair
                 Consts.push_back(std::make_pair(FPArgs.at(x), C));
               }
             if (!Consts.empty()) {
               // If at least one of the arguments is a constant function,
-              // we must clone the function.
+              // we may want to clone the function.
+              CloneKey Key = std::make_pair(I, Consts);
               cloneSites[CI] = Consts;
-              toClone[std::make_pair(I, Consts)] = 0;
+              if (!siteWeights.count(Key))
+                order.push_back(Key);
+              siteWeights[Key] += SpecializationBudget::getSiteWeight(CI, PI);
             }
           }
         }
       }
     }
 
-  numCloned += toClone.size();
+  //
+  // Rank the specializations by how much the constant arguments simplify the
+  // clone at its call sites, relative to the size of the clone, and make as
+  // many of them as the growth budget allows.
+  //
+  std::vector<SpecializationBudget::Candidate> Candidates;
+  for (unsigned index = 0; index < order.size(); ++index) {
+    SpecializationBudget::Candidate C(order[index].first, order[index].second);
+    C.Benefit = siteWeights[order[index]] *
+                SpecializationBudget::getBenefit(C.F, C.Bindings);
+    Candidates.push_back(C);
+  }
+  SpecializationBudget::rank(Candidates);
+
+  std::map<CloneKey, Function*> toClone;
+  for (unsigned index = 0; index < Candidates.size(); ++index) {
+    Function *F = Candidates[index].F;
+    const ArgBindings &Consts = Candidates[index].Bindings;
+    CloneKey Key = std::make_pair(F, Consts);
+    if (Function *Cached = Budget.getClone(F, Consts)) {
+      toClone[Key] = Cached;
+      continue;
+    }
+    // Sites that profiling shows are never executed gain nothing
+    if (Candidates[index].Benefit <= 0 ||
+        !Budget.charge(M, Candidates[index].Cost))
+      continue;
 
-  for (std::map<std::pair<Function*, std::vector<std::pair<unsigned, Constant*> > >, Function* >::iterator I = toClone.begin(), E = toClone.end(); I != E; ++I) {
     // Clone all the functions we need cloned
-    Function* DirectF = CloneFunction(I->first.first);
-    DirectF->setName(I->first.first->getName().str() + "_SPEC");
+    Function* DirectF = CloneFunction(F);
+    DirectF->setName(F->getName().str() + "_SPEC");
     DirectF->setLinkage(GlobalValue::InternalLinkage);
-    I->first.first->getParent()->getFunctionList().push_back(DirectF);
-    I->second = DirectF;
+    F->getParent()->getFunctionList().push_back(DirectF);
+
+    // Every caller of the clone passes the same constants, so fold them in
+    for (unsigned x = 0; x < Consts.size(); ++x) {
+      Function::arg_iterator Arg = DirectF->arg_begin();
+      std::advance(Arg, Consts[x].first);
+      if (Arg->getType() == Consts[x].second->getType())
+        Arg->replaceAllUsesWith(Consts[x].second);
+    }
+
+    Budget.addClone(F, Consts, DirectF);
+    toClone[Key] = DirectF;
+    ++numCloned;
   }
 
-  for (std::map<CallInst*, std::vector<std::pair<unsigned, Constant*> > >::iterator ii = cloneSites.begin(), ee = cloneSites.end(); ii != ee; ++ii) {
+  bool changed = false;
+  for (std::map<CallInst*, ArgBindings>::iterator ii = cloneSites.begin(), ee = cloneSites.end(); ii != ee; ++ii) {
     // Transform the call sites, to call the clones
-    Function *OldCallee = cast<Function>(ii->first->getCalledValue());
-    Function *NewCallee = toClone[std::make_pair(OldCallee, ii->second)];
-    ii->first->setCalledFunction(NewCallee);
+    Function *OldCallee = ii->first->getCalledFunction();
+    std::map<CloneKey, Function*>::iterator NewCallee =
+      toClone.find(std::make_pair(OldCallee, ii->second));
+    if (NewCallee == toClone.end())
+      continue;
+    ii->first->setCalledFunction(NewCallee->second);
     ++numReplaced;
+    changed = true;
   }
 
-  return true;
+  return changed;
+}
+
+//
+// Method: getAnalysisUsage()
+//
+void FuncSpec::getAnalysisUsage(AnalysisUsage &AU) const {
+  AU.addRequired<SpecializationBudget>();
+  AU.addRequired<ProfileInfo>();
 }
 
 // Pass ID variable
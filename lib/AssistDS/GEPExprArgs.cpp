@@ -13,6 +13,7 @@
 #define DEBUG_TYPE "gepexprargs"
 
 #include "assistDS/GEPExprArgs.h"
+#include "assistDS/SpecializationBudget.h"
 #include "llvm/Constants.h"
 #include "llvm/Operator.h"
 #include "llvm/Support/GetElementPtrTypeIterator.h"
@@ -48,6 +49,7 @@ using namespace llvm;
 //  false - The module was not modified.
 //
 bool GEPExprArgs::runOnModule(Module& M) {
+  SpecializationBudget &Budget = getAnalysis<SpecializationBudget>();
   bool changed;
   do {
     changed = false;
@@ -73,11 +75,11 @@ bool GEPExprArgs::runOnModule(Module& M) {
 
           // find the argument we must replace
           Function::arg_iterator ai = F->arg_begin(), ae = F->arg_end();
-          unsigned argNum = 1;
-          for(; argNum < CI->getNumOperands();argNum++, ++ai) {
+          unsigned argNum = 0;
+          for(; argNum < CI->getNumArgOperands();argNum++, ++ai) {
             if(ai->use_empty())
               continue;
-            if (isa<GEPOperator>(CI->getOperand(argNum)))
+            if (isa<GEPOperator>(CI->getArgOperand(argNum)))
               break;
           }
 
@@ -85,7 +87,7 @@ bool GEPExprArgs::runOnModule(Module& M) {
           if(ai == ae)
             continue;
 
-          GEPOperator *GEP = dyn_cast<GEPOperator>(CI->getOperand(argNum));
+          GEPOperator *GEP = dyn_cast<GEPOperator>(CI->getArgOperand(argNum));
           if(!GEP->hasAllConstantIndices())
             continue;
 
@@ -93,64 +95,80 @@ bool GEPExprArgs::runOnModule(Module& M) {
           // Appends the struct Type at the beginning
           std::vector<Type*>TP;
           TP.push_back(GEP->getPointerOperand()->getType());
-          for(unsigned c = 1; c < CI->getNumOperands();c++) {
-            TP.push_back(CI->getOperand(c)->getType());
+          for(unsigned c = 0; c < CI->getNumArgOperands();c++) {
+            TP.push_back(CI->getArgOperand(c)->getType());
           }
 
           //return type is same as that of original instruction
           FunctionType *NewFTy = FunctionType::get(CI->getType(), TP, false);
-          Function *NewF;
-          numSimplified++;
-          if(numSimplified > 800) 
-            return true;
-
-          NewF = Function::Create(NewFTy,
-                                  GlobalValue::InternalLinkage,
-                                  F->getName().str() + ".TEST",
-                                  &M);
-
-          Function::arg_iterator NI = NewF->arg_begin();
-          NI->setName("GEParg");
-          ++NI;
 
-          ValueToValueMapTy ValueMap;
-
-          for (Function::arg_iterator II = F->arg_begin(); NI != NewF->arg_end(); ++II, ++NI) {
-            ValueMap[II] = NI;
-            NI->setName(II->getName());
-            NI->addAttr(F->getAttributes().getParamAttributes(II->getArgNo() + 1));
-          }
-          NewF->setAttributes(NewF->getAttributes().addAttr(
-              0, F->getAttributes().getRetAttributes()));
-          // Perform the cloning.
-          SmallVector<ReturnInst*,100> Returns;
-          CloneFunctionInto(NewF, F, ValueMap, false, Returns);
-          std::vector<Value*> fargs;
-          for(Function::arg_iterator ai = NewF->arg_begin(), 
-              ae= NewF->arg_end(); ai != ae; ++ai) {
-            fargs.push_back(ai);
+          // The clone is determined by the indices of the GEP and by which
+          // arguments it is passed as; describe both with the same GEP
+          // applied to a null pointer.
+          SmallVector<Constant*, 8> Indices;
+          for(User::op_iterator oi = GEP->idx_begin(), oe = GEP->idx_end();
+              oi != oe; ++oi)
+            Indices.push_back(cast<Constant>(*oi));
+          Constant *Shape = ConstantExpr::getGetElementPtr(
+              Constant::getNullValue(GEP->getPointerOperand()->getType()),
+              Indices);
+          SpecializationBudget::ArgBindings Key;
+          for(unsigned j = argNum; j < CI->getNumArgOperands();j++) {
+            if(CI->getArgOperand(j) == GEP)
+              Key.push_back(std::make_pair(j, Shape));
           }
 
-          NewF->setAttributes(NewF->getAttributes().addAttr(
-              ~0, F->getAttributes().getFnAttributes()));
-          //Get the point to insert the GEP instr.
-          SmallVector<Value*, 8> Ops(CI->op_begin()+1, CI->op_end());
-          Instruction *InsertPoint;
-          for (BasicBlock::iterator insrt = NewF->front().begin(); 
-               isa<AllocaInst>(InsertPoint = insrt); ++insrt) {;}
-
-          NI = NewF->arg_begin();
-          SmallVector<Value*, 8> Indices;
-          Indices.append(GEP->op_begin()+1, GEP->op_end());
-          GetElementPtrInst *GEP_new = GetElementPtrInst::Create(cast<Value>(NI),
-                                                                 Indices, 
-                                                                 "", InsertPoint);
-          fargs.at(argNum)->replaceAllUsesWith(GEP_new);
-          unsigned j = argNum + 1;
-          for(; j < CI->getNumOperands();j++) {
-            if(CI->getOperand(j) == GEP)
-              fargs.at(j)->replaceAllUsesWith(GEP_new);
+          Function *NewF = Budget.getClone(F, "gep-expr-arg", Key);
+          if(!NewF) {
+            if(!Budget.charge(M, SpecializationBudget::getCost(F)))
+              continue;
+
+            NewF = Function::Create(NewFTy,
+                                    GlobalValue::InternalLinkage,
+                                    F->getName().str() + ".TEST",
+                                    &M);
+            Budget.addClone(F, "gep-expr-arg", Key, NewF);
+
+            Function::arg_iterator NI = NewF->arg_begin();
+            NI->setName("GEParg");
+            ++NI;
+
+            ValueToValueMapTy ValueMap;
+
+            for (Function::arg_iterator II = F->arg_begin(); NI != NewF->arg_end(); ++II, ++NI) {
+              ValueMap[II] = NI;
+              NI->setName(II->getName());
+              NI->addAttr(F->getAttributes().getParamAttributes(II->getArgNo() + 1));
+            }
+            NewF->setAttributes(NewF->getAttributes().addAttr(
+                0, F->getAttributes().getRetAttributes()));
+            // Perform the cloning.
+            SmallVector<ReturnInst*,100> Returns;
+            CloneFunctionInto(NewF, F, ValueMap, false, Returns);
+            std::vector<Value*> fargs;
+            for(Function::arg_iterator ai = NewF->arg_begin(), 
+                ae= NewF->arg_end(); ai != ae; ++ai) {
+              fargs.push_back(ai);
+            }
+
+            NewF->setAttributes(NewF->getAttributes().addAttr(
+                ~0, F->getAttributes().getFnAttributes()));
+            //Get the point to insert the GEP instr.
+            Instruction *InsertPoint;
+            for (BasicBlock::iterator insrt = NewF->front().begin(); 
+                 isa<AllocaInst>(InsertPoint = insrt); ++insrt) {;}
+
+            NI = NewF->arg_begin();
+            SmallVector<Value*, 8> GEPIndices;
+            GEPIndices.append(GEP->op_begin()+1, GEP->op_end());
+            GetElementPtrInst *GEP_new = GetElementPtrInst::Create(cast<Value>(NI),
+                                                                   GEPIndices, 
+                                                                   "", InsertPoint);
+            // the original arguments are shifted by one in the clone
+            for(unsigned k = 0; k < Key.size(); k++)
+              fargs.at(Key[k].first + 1)->replaceAllUsesWith(GEP_new);
           }
+          numSimplified++;
 
           SmallVector<AttributeWithIndex, 8> AttributesVec;
 
@@ -163,10 +181,10 @@ bool GEPExprArgs::runOnModule(Module& M) {
 
           SmallVector<Value*, 8> Args;
           Args.push_back(GEP->getPointerOperand());
-          for(unsigned j =1;j<CI->getNumOperands();j++) {
-            Args.push_back(CI->getOperand(j));
+          for(unsigned j =0;j<CI->getNumArgOperands();j++) {
+            Args.push_back(CI->getArgOperand(j));
             // position in the AttributesVec
-            if (Attributes Attrs = CallPAL.getParamAttributes(j))
+            if (Attributes Attrs = CallPAL.getParamAttributes(j+1))
               AttributesVec.push_back(AttributeWithIndex::get(Args.size(), Attrs));
           }
           // Create the new attributes vec.
@@ -190,6 +208,13 @@ bool GEPExprArgs::runOnModule(Module& M) {
 }
 
 
+//
+// Method: getAnalysisUsage()
+//
+void GEPExprArgs::getAnalysisUsage(AnalysisUsage &AU) const {
+  AU.addRequired<SpecializationBudget>();
+}
+
 char GEPExprArgs::ID = 0;
 static RegisterPass<GEPExprArgs>
 X("gep-expr-arg", "Find GEP Exprs passed as args");
@@ -15,9 +15,11 @@
 #define DEBUG_TYPE "indclone"
 
 #include "assistDS/IndCloner.h"
+#include "assistDS/SpecializationBudget.h"
 
 #include "llvm/Transforms/Utils/Cloning.h"
 #include "llvm/ADT/Statistic.h"
+#include "llvm/Support/CallSite.h"
 
 #include <vector>
 
@@ -87,8 +89,9 @@ IndClone::runOnModule(Module& M) {
           // function.  That would make the function usable in an indirect
           // function call.
           //
-          for (unsigned index = 1; index < ui->getNumOperands(); ++index) {
-            if (ui->getOperand(index)->stripPointerCasts() == I) {
+          CallSite CS(*ui);
+          for (unsigned index = 0; index < CS.arg_size(); ++index) {
+            if (CS.getArgument(index)->stripPointerCasts() == I) {
               pleaseCloneTheFunction = true;
               break;
             }
@@ -108,38 +111,66 @@ IndClone::runOnModule(Module& M) {
   }
 
   //
-  // Update the statistics on the number of functions we'll be cloning.
-  // We only update the statistic if we want to clone one or more functions;
-  // due to the magic of how statistics work, avoiding assignment prevents it
-  // from needlessly showing up.
+  // Rank the functions by how often they are called directly relative to
+  // their size; those calls are the ones that get a precise callee once the
+  // clone exists.  Clone as many as the shared growth budget allows.
   //
-  if (toClone.size())
-    numCloned += toClone.size();
+  SpecializationBudget &Budget = getAnalysis<SpecializationBudget>();
+  ProfileInfo *PI = &getAnalysis<ProfileInfo>();
+  std::vector<SpecializationBudget::Candidate> Candidates;
+  for (unsigned index = 0; index < toClone.size(); ++index) {
+    SpecializationBudget::Candidate C(toClone[index],
+                                      SpecializationBudget::ArgBindings());
+    for (Value::use_iterator ui = C.F->use_begin(), ue = C.F->use_end();
+         ui != ue; ++ui) {
+      if (CallInst *CI = dyn_cast<CallInst>(*ui))
+        if (CI->getCalledFunction() == C.F)
+          C.Benefit += SpecializationBudget::getSiteWeight(CI, PI);
+    }
+    Candidates.push_back(C);
+  }
+  SpecializationBudget::rank(Candidates);
 
   //
   // Go through the worklist and clone each function.  After cloning a
   // function, change all direct calls to use the clone instead of using the
   // original function.
   //
-  for (unsigned index = 0; index < toClone.size(); ++index) {
-    //
-    // Clone the function and give it a name indicating that it is a clone to
-    // be used for direct function calls.
-    //
-    Function * Original = toClone[index];
-    Function* DirectF = CloneFunction(Original);
-    DirectF->setName(Original->getName() + "_DIRECT");
+  for (unsigned index = 0; index < Candidates.size(); ++index) {
+    Function * Original = Candidates[index].F;
 
     //
-    // Make the clone internal; external code can use the original function.
+    // Reuse an identical clone made by an earlier pass if it still exists.
+    // Otherwise clone the function if anything would call the clone and it
+    // fits in the budget.
     //
-    DirectF->setLinkage(GlobalValue::InternalLinkage);
-
-    //
-    // Link the cloned function into the set of functions belonging to the
-    // module.
-    //
-    Original->getParent()->getFunctionList().push_back(DirectF);
+    Function * DirectF = Budget.getClone(Original,
+                                         Candidates[index].Bindings);
+    if (!DirectF) {
+      if (Candidates[index].Benefit <= 0 ||
+          !Budget.charge(M, Candidates[index].Cost))
+        continue;
+
+      //
+      // Clone the function and give it a name indicating that it is a clone
+      // to be used for direct function calls.
+      //
+      DirectF = CloneFunction(Original);
+      DirectF->setName(Original->getName() + "_DIRECT");
+
+      //
+      // Make the clone internal; external code can use the original function.
+      //
+      DirectF->setLinkage(GlobalValue::InternalLinkage);
+
+      //
+      // Link the cloned function into the set of functions belonging to the
+      // module.
+      //
+      Original->getParent()->getFunctionList().push_back(DirectF);
+      Budget.addClone(Original, Candidates[index].Bindings, DirectF);
+      ++numCloned;
+    }
 
     //
     // Find all uses of the function that use it as a direct call.  Change
@@ -165,3 +196,11 @@ IndClone::runOnModule(Module& M) {
   return true;
 }
 
+//
+// Method: getAnalysisUsage()
+//
+void
+IndClone::getAnalysisUsage(AnalysisUsage &AU) const {
+  AU.addRequired<SpecializationBudget>();
+  AU.addRequired<ProfileInfo>();
+}
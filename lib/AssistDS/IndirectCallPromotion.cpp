@@ -0,0 +1,95 @@
+//===- IndirectCallPromotion.cpp - Promote single target indirect calls ---===//
+//
+//                     The LLVM Compiler Infrastructure
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+//
+// Indirect calls that DSA proves can only reach one function are rewritten to
+// call that function directly.  Run before -dsa-cg and -inline, the promoted
+// calls become ordinary call graph edges that the inliner can act on, while
+// the remaining indirect calls keep their DSA targets in the call graph.
+//
+//===----------------------------------------------------------------------===//
+
+#define DEBUG_TYPE "dsa-promote-calls"
+
+#include "assistDS/IndirectCallPromotion.h"
+
+#include "llvm/Instructions.h"
+#include "llvm/ADT/Statistic.h"
+#include "llvm/Support/CallSite.h"
+#include "llvm/Support/Debug.h"
+#include "llvm/Support/raw_ostream.h"
+
+#include <vector>
+
+using namespace llvm;
+
+// Pass ID variable
+char IndirectCallPromotion::ID = 0;
+
+// Register the pass
+static RegisterPass<IndirectCallPromotion>
+X("dsa-promote-calls", "Promote indirect calls with one DSA target");
+
+// Pass statistics
+STATISTIC(numPromoted,   "Number of indirect calls promoted to direct calls");
+STATISTIC(numMismatched, "Number of single target calls with a type mismatch");
+
+//
+// Method: runOnModule()
+//
+// Description:
+//  Entry point for this LLVM pass.  Find indirect call sites whose set of
+//  targets is complete and has a single member, and call that member
+//  directly.
+//
+// Return value:
+//  true  - The module was modified.
+//  false - The module was not modified.
+//
+bool
+IndirectCallPromotion::runOnModule (Module & M) {
+  CallTargetFinderTy & CTF = getAnalysis<CallTargetFinderTy>();
+
+  //
+  // Collect the call sites first; changing the called value of a call site
+  // changes how the call target finder looks it up.
+  //
+  std::vector<std::pair<CallSite, const Function *> > Worklist;
+  for (std::list<CallSite>::iterator cs = CTF.cs_begin(), ce = CTF.cs_end();
+       cs != ce; ++cs) {
+    CallSite CS = *cs;
+    if (isa<Function>(CS.getCalledValue()->stripPointerCasts()))
+      continue;
+    if (!CTF.isComplete (CS) || CTF.size (CS) != 1)
+      continue;
+
+    //
+    // Only promote when the target has the type the call site expects;
+    // otherwise the call would need a cast and would stay opaque to the
+    // inliner anyway.
+    //
+    const Function * Target = *(CTF.begin (CS));
+    if (Target->getType() != CS.getCalledValue()->getType()) {
+      ++numMismatched;
+      continue;
+    }
+
+    Worklist.push_back (std::make_pair (CS, Target));
+  }
+
+  for (unsigned index = 0; index < Worklist.size(); ++index) {
+    CallSite CS = Worklist[index].first;
+    Function * Target = const_cast<Function *>(Worklist[index].second);
+    DEBUG (errs() << "Promoting call to " << Target->getName() << " in "
+                  << CS.getCaller()->getName() << "\n");
+    CS.setCalledFunction (Target);
+    ++numPromoted;
+  }
+
+  return !Worklist.empty();
+}
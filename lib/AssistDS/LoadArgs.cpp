@@ -15,6 +15,7 @@
 #define DEBUG_TYPE "ld-args"
 
 #include "assistDS/LoadArgs.h"
+#include "assistDS/SpecializationBudget.h"
 #include "llvm/Constants.h"
 #include "llvm/Support/GetElementPtrTypeIterator.h"
 #include "llvm/Transforms/Utils/Cloning.h"
@@ -50,7 +51,7 @@ using namespace llvm;
 //  false - The module was not modified.
 //
 bool LoadArgs::runOnModule(Module& M) {
-  std::map<std::pair<Function*, const Type * > , Function* > fnCache;
+  SpecializationBudget &Budget = getAnalysis<SpecializationBudget>();
   bool changed;
   do { 
     changed = false;
@@ -92,11 +93,6 @@ bool LoadArgs::runOnModule(Module& M) {
             continue;
 
           LoadInst *LI = dyn_cast<LoadInst>(CI->getArgOperand(argNum));
-          Instruction * InsertPt = &(Func->getEntryBlock().front());
-          AllocaInst *NewVal = new AllocaInst(LI->getType(), "",InsertPt);
-
-          StoreInst *Copy = new StoreInst(LI, NewVal);
-          Copy->insertAfter(LI);
           /*if(LI->getParent() != CI->getParent())
             continue;
           // Also check that there is no store after the load.
@@ -128,22 +124,23 @@ bool LoadArgs::runOnModule(Module& M) {
 
           //return type is same as that of original instruction
           FunctionType *NewFTy = FunctionType::get(CI->getType(), TP, false);
-          numSimplified++;
-          //if(numSimplified > 1000)
-          //return true;
-
-          Function *NewF;
-          std::map<std::pair<Function*, const Type* > , Function* >::iterator Test;
-          Test = fnCache.find(std::make_pair(F, NewFTy));
-          if(Test != fnCache.end()) {
-            NewF = Test->second;
-          } else {
+
+          // The clone is determined by the argument and the pointer type
+          // it is loaded from.
+          SpecializationBudget::ArgBindings Key;
+          Key.push_back(std::make_pair(argNum,
+                        UndefValue::get(LI->getPointerOperand()->getType())));
+
+          Function *NewF = Budget.getClone(F, "ld-args", Key);
+          if(!NewF) {
+            if(!Budget.charge(M, SpecializationBudget::getCost(F)))
+              continue;
             NewF = Function::Create(NewFTy,
                                     GlobalValue::InternalLinkage,
                                     F->getName().str() + ".TEST",
                                     &M);
 
-            fnCache[std::make_pair(F, NewFTy)] = NewF;
+            Budget.addClone(F, "ld-args", Key, NewF);
             Function::arg_iterator NI = NewF->arg_begin();
 
             ValueToValueMapTy ValueMap;
@@ -178,6 +175,13 @@ bool LoadArgs::runOnModule(Module& M) {
             LoadInst *LI_new = new LoadInst(fargs.at(argNum), "", InsertPoint);
             fargs.at(argNum+1)->replaceAllUsesWith(LI_new);
           }
+          numSimplified++;
+
+          Instruction * InsertPt = &(Func->getEntryBlock().front());
+          AllocaInst *NewVal = new AllocaInst(LI->getType(), "",InsertPt);
+
+          StoreInst *Copy = new StoreInst(LI, NewVal);
+          Copy->insertAfter(LI);
           SmallVector<AttributeWithIndex, 8> AttributesVec;
           // Get the initial attributes of the call
           AttrListPtr CallPAL = CI->getAttributes();
@@ -215,6 +219,13 @@ bool LoadArgs::runOnModule(Module& M) {
   return true;
 }
 
+//
+// Method: getAnalysisUsage()
+//
+void LoadArgs::getAnalysisUsage(AnalysisUsage &AU) const {
+  AU.addRequired<SpecializationBudget>();
+}
+
 char LoadArgs::ID = 0;
 static RegisterPass<LoadArgs>
 X("ld-args", "Find Load Inst passed as args");
@@ -0,0 +1,269 @@
+//===-- SpecializationBudget.cpp - Shared Cost Model For Cloning Passes ---===//
+//
+//                     The LLVM Compiler Infrastructure
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+//
+// Clone cache, growth budget and cost model shared by the specializing
+// passes.  Candidates are ranked by benefit per instruction cloned, where the
+// benefit of a call site is its execution count (or 1 without a profile)
+// scaled by how much the bound arguments are expected to simplify the clone.
+//
+//===----------------------------------------------------------------------===//
+
+#define DEBUG_TYPE "spec-budget"
+
+#include "assistDS/SpecializationBudget.h"
+
+#include "llvm/Support/CallSite.h"
+#include "llvm/Support/CommandLine.h"
+#include "llvm/ADT/Statistic.h"
+
+#include <algorithm>
+
+using namespace llvm;
+
+// Pass ID variable
+char SpecializationBudget::ID = 0;
+
+// Register the pass
+static RegisterPass<SpecializationBudget>
+X("spec-budget", "Shared budget for function specialization", false, true);
+
+// Pass statistics
+STATISTIC(numCharged, "Number of instructions added by specialization");
+STATISTIC(numRefused, "Number of specializations refused by the budget");
+STATISTIC(numReused,  "Number of specializations served from the cache");
+
+namespace {
+  cl::opt<int> GrowthBudget("spec-growth-budget",
+         cl::desc("Percentage by which function specialization may grow the "
+                  "module (negative for no limit)"),
+         cl::init(100));
+
+  // Weight of an argument use that becomes a direct call once the argument
+  // is a known function, and so also becomes a candidate for inlining
+  const double DirectCallWeight = 10.0;
+
+  // Weight of an argument use that constant folding can simplify
+  const double FoldWeight = 2.0;
+
+  //
+  // Function: getArg()
+  //
+  // Description:
+  //  Return the formal argument of F with the specified number.
+  //
+  const Argument *
+  getArg (const Function * F, unsigned ArgNo) {
+    Function::const_arg_iterator AI = F->arg_begin();
+    std::advance (AI, ArgNo);
+    return AI;
+  }
+
+  //
+  // Function: BetterCandidate
+  //
+  // Description:
+  //  Order candidates by decreasing benefit per instruction cloned.
+  //
+  struct BetterCandidate {
+    bool operator() (const SpecializationBudget::Candidate & A,
+                     const SpecializationBudget::Candidate & B) const {
+      return A.Benefit * std::max (B.Cost, 1u) >
+             B.Benefit * std::max (A.Cost, 1u);
+    }
+  };
+}
+
+//
+// Method: getClone()
+//
+// Description:
+//  Find a specialization of F with its signature and the bound constants
+//  folded in, made by any of the specializing passes.
+//
+Function *
+SpecializationBudget::getClone (Function * F, const ArgBindings & Bindings) {
+  return getClone (F, "", Bindings);
+}
+
+//
+// Method: addClone()
+//
+// Description:
+//  Record that Clone specializes F, with F's signature, for the bindings.
+//
+void
+SpecializationBudget::addClone (Function * F, const ArgBindings & Bindings,
+                                Function * Clone) {
+  addClone (F, "", Bindings, Clone);
+}
+
+//
+// Method: getClone()
+//
+// Description:
+//  Find a clone of F of the specified kind that was made for the same
+//  bindings, either by this pass or by an earlier one.
+//
+// Return value:
+//  The clone, or NULL if there is none (or it has since been deleted).
+//
+Function *
+SpecializationBudget::getClone (Function * F, StringRef Kind,
+                                const ArgBindings & Bindings) {
+  std::map<CloneKey, CloneEntry>::iterator I =
+    Clones.find (std::make_pair (std::make_pair (F, Kind.str()), Bindings));
+  if (I == Clones.end())
+    return 0;
+
+  //
+  // An entry whose original has been deleted may now be keyed by an unrelated
+  // function allocated at the same address; drop it as well as entries whose
+  // clone was removed (e.g., by -globaldce).
+  //
+  if (I->second.Original != F || !I->second.Clone) {
+    Clones.erase (I);
+    return 0;
+  }
+
+  ++numReused;
+  return cast<Function>(I->second.Clone);
+}
+
+//
+// Method: addClone()
+//
+// Description:
+//  Record that Clone specializes F for the given kind and bindings.
+//
+void
+SpecializationBudget::addClone (Function * F, StringRef Kind,
+                                const ArgBindings & Bindings,
+                                Function * Clone) {
+  CloneEntry & Entry =
+    Clones[std::make_pair (std::make_pair (F, Kind.str()), Bindings)];
+  Entry.Original = F;
+  Entry.Clone = Clone;
+}
+
+//
+// Method: charge()
+//
+// Description:
+//  Reserve room in the growth budget for a clone of the specified size.  The
+//  budget is sized from the first module it is charged against.
+//
+// Return value:
+//  true  - The clone fits and has been charged.
+//  false - The budget is exhausted; the clone should not be made.
+//
+bool
+SpecializationBudget::charge (Module & M, unsigned Cost) {
+  if (!Initialized) {
+    Initialized = true;
+    if (GrowthBudget >= 0) {
+      long Size = 0;
+      for (Module::iterator F = M.begin(), E = M.end(); F != E; ++F)
+        Size += getCost (F);
+      Remaining = Size * GrowthBudget / 100;
+    }
+  }
+
+  if (Remaining >= 0) {
+    if ((long) Cost > Remaining) {
+      ++numRefused;
+      return false;
+    }
+    Remaining -= Cost;
+  }
+
+  numCharged += Cost;
+  return true;
+}
+
+//
+// Method: getCost()
+//
+// Description:
+//  Return the number of instructions a clone of F adds to the module.
+//
+unsigned
+SpecializationBudget::getCost (const Function * F) {
+  unsigned Size = 0;
+  for (Function::const_iterator BB = F->begin(), E = F->end(); BB != E; ++BB)
+    Size += BB->size();
+  return Size;
+}
+
+//
+// Method: getBenefit()
+//
+// Description:
+//  Estimate how much binding the specified arguments of F to constants
+//  simplifies a clone of F.  Indirect calls through a bound function pointer
+//  become direct (and inlinable) calls; comparisons, branches and arithmetic
+//  on a bound value fold.  The result is at least 1, since every clone also
+//  gives the analyses a context sensitive copy of the function.
+//
+double
+SpecializationBudget::getBenefit (const Function * F,
+                                  const ArgBindings & Bindings) {
+  double Benefit = 1.0;
+  for (unsigned index = 0; index < Bindings.size(); ++index) {
+    if (Bindings[index].first >= F->arg_size())
+      continue;
+    const Argument * Arg = getArg (F, Bindings[index].first);
+    bool IsFunction =
+      isa<Function>(Bindings[index].second->stripPointerCasts());
+    for (Value::const_use_iterator ui = Arg->use_begin(), ue = Arg->use_end();
+         ui != ue; ++ui) {
+      if (IsFunction) {
+        ImmutableCallSite CS(*ui);
+        if (CS && CS.getCalledValue()->stripPointerCasts() == Arg) {
+          Benefit += DirectCallWeight;
+          continue;
+        }
+      }
+      if (isa<CmpInst>(*ui) || isa<BranchInst>(*ui) || isa<SwitchInst>(*ui) ||
+          isa<SelectInst>(*ui) || isa<BinaryOperator>(*ui) ||
+          isa<CastInst>(*ui))
+        Benefit += FoldWeight;
+    }
+  }
+  return Benefit;
+}
+
+//
+// Method: getSiteWeight()
+//
+// Description:
+//  Return how often the specified call site executes according to the
+//  profile, or 1 if no profile information is available for it.
+//
+double
+SpecializationBudget::getSiteWeight (const Instruction * I, ProfileInfo * PI) {
+  if (!PI)
+    return 1.0;
+  double Count = PI->getExecutionCount (I->getParent());
+  if (Count == ProfileInfo::MissingValue)
+    return 1.0;
+  return Count;
+}
+
+//
+// Method: rank()
+//
+// Description:
+//  Sort candidates so that the ones with the most benefit per instruction
+//  come first.  Candidates that compare equal keep their relative order, so
+//  passes stay deterministic when no profile is loaded.
+//
+void
+SpecializationBudget::rank (std::vector<Candidate> & Candidates) {
+  std::stable_sort (Candidates.begin(), Candidates.end(), BetterCandidate());
+}
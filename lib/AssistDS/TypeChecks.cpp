@@ -21,6 +21,10 @@
 #include "llvm/Support/InstIterator.h"
 #include "llvm/Support/raw_ostream.h"
 #include "llvm/Intrinsics.h"
+#include "llvm/IntrinsicInst.h"
+#include "llvm/Analysis/ScalarEvolutionExpander.h"
+#include "llvm/Analysis/ScalarEvolutionExpressions.h"
+#include "llvm/Analysis/ValueTracking.h"
 #include "llvm/Support/CommandLine.h"
 #include "llvm/ADT/Statistic.h"
 
@@ -39,6 +43,9 @@ TC("typechecks", "Insert runtime type checks", false, true);
 STATISTIC(numLoadChecks,  "Number of Load Insts that need type checks");
 STATISTIC(numStoreChecks, "Number of Store Insts that need type checks");
 STATISTIC(numTypes, "Number of Types used in the module");
+STATISTIC(numRangeChecks, "Number of type checks coalesced into range checks");
+STATISTIC(numStridedChecks, "Number of type checks hoisted out of loops");
+STATISTIC(numInlineChecks, "Number of type checks done inline");
 
 namespace {
   static cl::opt<bool> EnablePointerTypeChecks("enable-ptr-type-checks",
@@ -49,6 +56,14 @@ namespace {
          cl::desc("Dont instrument cmp statements"),
          cl::Hidden,
          cl::init(false));
+  static cl::opt<bool> CoalesceChecks("tc-coalesce-checks",
+         cl::desc("Merge checks on one object and hoist strided loop checks"),
+         cl::Hidden,
+         cl::init(false));
+  static cl::opt<bool> InlineChecks("tc-inline-checks",
+         cl::desc("Check type tags inline, calling the runtime on a mismatch"),
+         cl::Hidden,
+         cl::init(false));
   static cl::opt<bool> TrackAllLoads("track-all-loads",
          cl::desc("Check at all loads irrespective of use"),
          cl::Hidden,
@@ -81,6 +96,8 @@ static Constant *trackUnInitInst;
 
 static Constant *getTypeTag;
 static Constant *checkTypeInst;
+static Constant *checkTypeRange;
+static Constant *checkTypeStrided;
 
 static Constant *copyTypeInfo;
 static Constant *setTypeInfo;
@@ -380,6 +397,10 @@ bool TypeChecks::runOnModule(Module &M) {
   // Remove a check if it is dominated by another check for the same instruction
   optimizeChecks(M);
 
+  // Replace the remaining getTypeTag/checkType pairs with inline code
+  if(InlineChecks)
+    inlineChecks(M);
+
   // add a global that contains the mapping from metadata to strings
   addTypeMap(M);
 
@@ -454,6 +475,22 @@ void TypeChecks::initRuntimeCheckPrototypes(Module &M) {
                                         VoidPtrTy,/*ptr*/
                                         Int32Ty,/*tag*/
                                         NULL);
+  checkTypeRange = M.getOrInsertFunction("checkTypeRange",
+                                         VoidTy,
+                                         VoidPtrTy,/*base ptr*/
+                                         Int64Ty,/*number of checks*/
+                                         Int64Ty->getPointerTo(),/*checks*/
+                                         Int32Ty,/*tag*/
+                                         NULL);
+  checkTypeStrided = M.getOrInsertFunction("checkTypeStrided",
+                                           VoidTy,
+                                           TypeTagTy,/*type*/
+                                           Int64Ty,/*size*/
+                                           VoidPtrTy,/*first ptr*/
+                                           Int64Ty,/*count*/
+                                           Int64Ty,/*stride*/
+                                           Int32Ty,/*tag*/
+                                           NULL);
   setTypeInfo = M.getOrInsertFunction("setTypeInfo",
                                       VoidTy,
                                       VoidPtrTy,/*dest ptr*/
@@ -583,6 +620,339 @@ void TypeChecks::optimizeChecks(Module &M) {
       }
     }
   }
+  if(!CoalesceChecks)
+    return;
+  for (Module::iterator MI = M.begin(), ME = M.end(); MI != ME; ++MI) {
+    Function &F = *MI;
+    if(F.isDeclaration())
+      continue;
+    ScalarEvolution & SE = getAnalysis<ScalarEvolution>(F);
+    DominatorTree & DT = getAnalysis<DominatorTree>(F);
+    LoopInfo & LI = getAnalysis<LoopInfo>(F);
+    std::vector<Loop *> Loops(LI.begin(), LI.end());
+    while(!Loops.empty()) {
+      Loop *L = Loops.back();
+      Loops.pop_back();
+      Loops.insert(Loops.end(), L->begin(), L->end());
+      hoistStridedChecks(L, DT, SE);
+    }
+    for (Function::iterator BB = F.begin(), BE = F.end(); BB != BE; ++BB)
+      coalesceRangeChecks(*BB);
+  }
+}
+
+// Return the getTypeTag call that fills the metadata read by a check, if the
+// metadata is a private buffer that is only read by checks of the same
+// pointer. Such checks may be moved or rewritten to read the shadow memory
+// directly.
+static CallInst *getTagSource(CallInst *CI) {
+  AllocaInst *AI = dyn_cast<AllocaInst>(CI->getOperand(2));
+  if(!AI)
+    return NULL;
+  CallInst *Source = NULL;
+  for(Value::use_iterator User = AI->use_begin(); User != AI->use_end(); ++User) {
+    CallInst *CI2 = dyn_cast<CallInst>(*User);
+    if(!CI2)
+      return NULL;
+    if(CI2->getCalledFunction() == checkTypeInst) {
+      if(CI2->getOperand(3) != CI->getOperand(3))
+        return NULL;
+      continue;
+    }
+    if(CI2->getCalledFunction() != getTypeTag || Source)
+      return NULL;
+    if(CI2->getOperand(0) != CI->getOperand(3))
+      return NULL;
+    Source = CI2;
+  }
+  return Source;
+}
+
+// Delete a check. Once nothing reads its metadata, delete the getTypeTag
+// call and the buffer as well.
+static void eraseCheck(CallInst *CI) {
+  Instruction *AI = cast<Instruction>(CI->getOperand(2));
+  CI->eraseFromParent();
+  if(AI->hasOneUse()) {
+    cast<Instruction>(*AI->use_begin())->eraseFromParent();
+    AI->eraseFromParent();
+  }
+}
+
+// Replace a check that runs on every iteration with an affine address by one
+// strided check in the preheader. A check on memory that was initialized but
+// not typed (0xFF) writes the type into the shadow memory, so checks are not
+// free to be reordered: the loop may make no calls other than to the type
+// check runtime, and every check in it must be of the same pointer, type and
+// size. The strided check then visits the elements in the order the loop
+// did, so each one sees the shadow memory the original check would have.
+void TypeChecks::hoistStridedChecks(Loop *L, DominatorTree &DT, ScalarEvolution &SE) {
+  BasicBlock *Preheader = L->getLoopPreheader();
+  BasicBlock *Latch = L->getLoopLatch();
+  if(!Preheader || !Latch || L->getExitingBlock() != Latch)
+    return;
+  const SCEVConstant *BTC = dyn_cast<SCEVConstant>(SE.getBackedgeTakenCount(L));
+  if(!BTC || BTC->getValue()->getValue().getActiveBits() > 63)
+    return;
+  uint64_t TripCount = BTC->getValue()->getZExtValue() + 1;
+
+  // Hoisted checks, keyed on (pointer, (type, size)).
+  typedef std::pair<Value *, std::pair<Value *, Value *> > CheckKey;
+  std::vector<CallInst *> Checks;
+  std::set<CheckKey> Keys;
+  for (Loop::block_iterator I = L->block_begin(), E = L->block_end(); I != E; ++I) {
+    for (BasicBlock::iterator bi = (*I)->begin(); bi != (*I)->end(); ++bi) {
+      if(!isa<CallInst>(bi) && !isa<InvokeInst>(bi))
+        continue;
+      if(isa<DbgInfoIntrinsic>(bi))
+        continue;
+      CallSite CS(&*bi);
+      if(CS.getCalledFunction() == getTypeTag)
+        continue;
+      if(CS.getCalledFunction() != checkTypeInst)
+        return;
+      Keys.insert(std::make_pair(CS.getArgument(3),
+                                 std::make_pair(CS.getArgument(0),
+                                                CS.getArgument(1))));
+      if(Keys.size() > 1)
+        return;
+      if(DT.dominates(*I, Latch))
+        Checks.push_back(cast<CallInst>(bi));
+    }
+  }
+
+  // The original check stays in place until the end, so later checks can be
+  // tested for dominance against it.
+  std::map<CheckKey, CallInst *> Hoisted;
+  std::vector<CallInst *> Erased;
+  SCEVExpander Expander(SE, "tc");
+  for (unsigned i = 0; i < Checks.size(); ++i) {
+    CallInst *CI = Checks[i];
+    if(!getTagSource(CI))
+      continue;
+    // A check of the same pointer against the same type and size, dominated
+    // by a hoisted one, is covered by that strided check.
+    CheckKey Key = std::make_pair(CI->getOperand(3),
+                                  std::make_pair(CI->getOperand(0),
+                                                 CI->getOperand(1)));
+    std::map<CheckKey, CallInst *>::iterator HI = Hoisted.find(Key);
+    if(HI != Hoisted.end() && DT.dominates(HI->second, CI)) {
+      Erased.push_back(CI);
+      ++numStridedChecks;
+      continue;
+    }
+    const SCEVAddRecExpr *AR = dyn_cast<SCEVAddRecExpr>(SE.getSCEV(CI->getOperand(3)));
+    if(!AR || AR->getLoop() != L || !AR->isAffine())
+      continue;
+    const SCEVConstant *Step = dyn_cast<SCEVConstant>(AR->getStepRecurrence(SE));
+    if(!Step || Step->getValue()->isZero())
+      continue;
+    if(!SE.isLoopInvariant(AR->getStart(), L))
+      continue;
+
+    Value *Start = Expander.expandCodeFor(AR->getStart(), VoidPtrTy,
+                                          Preheader->getTerminator());
+    std::vector<Value *> Args;
+    Args.push_back(CI->getOperand(0));
+    Args.push_back(CI->getOperand(1));
+    Args.push_back(Start);
+    Args.push_back(ConstantInt::get(Int64Ty, TripCount));
+    Args.push_back(ConstantInt::get(Int64Ty, Step->getValue()->getSExtValue()));
+    Args.push_back(getTagCounter());
+    CallInst::Create(checkTypeStrided, Args, "", Preheader->getTerminator());
+    Hoisted.insert(std::make_pair(Key, CI));
+    Erased.push_back(CI);
+    ++numStridedChecks;
+  }
+  for (unsigned i = 0; i < Erased.size(); ++i)
+    eraseCheck(Erased[i]);
+}
+
+// Merge the checks on constant offsets from one base pointer into a single
+// range check. Checks are only merged across a stretch of the block with no
+// other calls, so all of them run once the first getTypeTag runs and nothing
+// but the checks themselves can change the shadow memory in between. The
+// range check reads the shadow memory directly at the first getTypeTag.
+void TypeChecks::coalesceRangeChecks(BasicBlock &BB) {
+  std::vector<std::vector<CallInst *> > Segments(1);
+  for (BasicBlock::iterator bi = BB.begin(); bi != BB.end(); ++bi) {
+    if(!isa<CallInst>(bi) && !isa<InvokeInst>(bi))
+      continue;
+    if(isa<DbgInfoIntrinsic>(bi))
+      continue;
+    CallSite CS(&*bi);
+    if(CS.getCalledFunction() == getTypeTag ||
+       CS.getCalledFunction() == checkTypeInst) {
+      Segments.back().push_back(cast<CallInst>(bi));
+      continue;
+    }
+    if(!Segments.back().empty())
+      Segments.push_back(std::vector<CallInst *>());
+  }
+
+  Module &M = *BB.getParent()->getParent();
+  for (unsigned s = 0; s < Segments.size(); ++s) {
+    std::vector<CallInst *> &Segment = Segments[s];
+    std::set<Instruction *> InSegment(Segment.begin(), Segment.end());
+    std::map<Value *, std::vector<CallInst *> > ByBase;
+    std::map<CallInst *, int64_t> Offsets;
+    for (unsigned i = 0; i < Segment.size(); ++i) {
+      CallInst *CI = Segment[i];
+      if(CI->getCalledFunction() != checkTypeInst)
+        continue;
+      CallInst *Source = getTagSource(CI);
+      if(!Source || !InSegment.count(Source))
+        continue;
+      bool Local = true;
+      Value *AI = CI->getOperand(2);
+      for(Value::use_iterator User = AI->use_begin(); User != AI->use_end(); ++User)
+        if(!InSegment.count(cast<Instruction>(*User)))
+          Local = false;
+      if(!Local)
+        continue;
+      int64_t Offset = 0;
+      Value *Base = GetPointerBaseWithConstantOffset(CI->getOperand(3), Offset, *TD);
+      ByBase[Base].push_back(CI);
+      Offsets[CI] = Offset;
+    }
+
+    std::vector<CallInst *> Merged;
+    std::map<Value *, std::vector<CallInst *> >::iterator BI = ByBase.begin();
+    for (; BI != ByBase.end(); ++BI) {
+      std::vector<CallInst *> &Checks = BI->second;
+      std::set<Value *> Buffers;
+      std::set<std::pair<int64_t, std::pair<uint64_t, uint64_t> > > Ranges;
+      for (unsigned i = 0; i < Checks.size(); ++i) {
+        CallInst *CI = Checks[i];
+        Buffers.insert(CI->getOperand(2));
+        uint64_t Size = cast<ConstantInt>(CI->getOperand(1))->getZExtValue();
+        uint64_t Type = cast<ConstantInt>(CI->getOperand(0))->getZExtValue();
+        Ranges.insert(std::make_pair(Offsets[CI], std::make_pair(Size, Type)));
+      }
+      if(Buffers.size() < 2)
+        continue;
+
+      Instruction *InsertPt = 0;
+      for (unsigned i = 0; i < Segment.size() && !InsertPt; ++i)
+        if(Segment[i]->getCalledFunction() == getTypeTag &&
+           Buffers.count(Segment[i]->getOperand(2)))
+          InsertPt = Segment[i];
+
+      // Each range is an (offset, size, type) triple.
+      std::vector<uint64_t> Entries;
+      std::set<std::pair<int64_t, std::pair<uint64_t, uint64_t> > >::iterator RI;
+      for (RI = Ranges.begin(); RI != Ranges.end(); ++RI) {
+        Entries.push_back(RI->first);
+        Entries.push_back(RI->second.first);
+        Entries.push_back(RI->second.second);
+      }
+      Constant *CA = ConstantDataArray::get(M.getContext(), Entries);
+      GlobalVariable *GV = new GlobalVariable(M,
+                                              CA->getType(),
+                                              true,
+                                              GlobalValue::InternalLinkage,
+                                              CA,
+                                              "");
+      std::vector<Constant *> Indices;
+      Indices.push_back(ConstantInt::get(Int32Ty,0));
+      Indices.push_back(ConstantInt::get(Int32Ty,0));
+
+      std::vector<Value *> Args;
+      Args.push_back(castTo(BI->first, VoidPtrTy, "", InsertPt));
+      Args.push_back(ConstantInt::get(Int64Ty, Ranges.size()));
+      Args.push_back(ConstantExpr::getGetElementPtr(GV, Indices));
+      Args.push_back(getTagCounter());
+      CallInst::Create(checkTypeRange, Args, "", InsertPt);
+
+      Merged.insert(Merged.end(), Checks.begin(), Checks.end());
+    }
+    // Erase only after all bases are done; the segment still points at them.
+    for (unsigned i = 0; i < Merged.size(); ++i)
+      eraseCheck(Merged[i]);
+    numRangeChecks += Merged.size();
+  }
+}
+
+// Compute the shadow memory address of Ptr inline. The mapping is the one
+// maskAddress() in the runtime uses; its constants are read from globals the
+// runtime defines, which fold away once the runtime is linked in.
+static Value *getShadowAddress(Module &M, Value *Ptr, Instruction *InsertPt) {
+  GlobalVariable *Base = cast<GlobalVariable>(M.getOrInsertGlobal("__tc_shadow_base", Int64Ty));
+  GlobalVariable *Size = cast<GlobalVariable>(M.getOrInsertGlobal("__tc_shadow_size", Int64Ty));
+  Base->setConstant(true);
+  Size->setConstant(true);
+
+  Value *P = new PtrToIntInst(Ptr, Int64Ty, "", InsertPt);
+  Value *BaseV = new LoadInst(Base, "", InsertPt);
+  Value *SizeV = new LoadInst(Size, "", InsertPt);
+  Value *Below = new ICmpInst(InsertPt, ICmpInst::ICMP_ULT, P, BaseV, "");
+  Value *Above = BinaryOperator::CreateSub(P, SizeV, "", InsertPt);
+  Value *Masked = SelectInst::Create(Below, P, Above, "", InsertPt);
+  Value *Shadow = BinaryOperator::CreateAdd(BaseV, Masked, "", InsertPt);
+  return new IntToPtrInst(Shadow, VoidPtrTy, "", InsertPt);
+}
+
+// Turn getTypeTag calls into a memcpy from the shadow memory, and checks of
+// 1, 2, 4 or 8 bytes into a compare of the copied metadata against the
+// expected tag followed by 0xFE bytes. The runtime is only called when the
+// compare fails, to report the mismatch or to type untyped memory.
+void TypeChecks::inlineChecks(Module &M) {
+  std::vector<CallInst *> Tags;
+  std::vector<CallInst *> Checks;
+  for(Value::use_iterator User = getTypeTag->use_begin(); User != getTypeTag->use_end(); ++User)
+    if(CallInst *CI = dyn_cast<CallInst>(*User))
+      Tags.push_back(CI);
+  for(Value::use_iterator User = checkTypeInst->use_begin(); User != checkTypeInst->use_end(); ++User)
+    if(CallInst *CI = dyn_cast<CallInst>(*User))
+      Checks.push_back(CI);
+
+  Type *MemcpyTys[] = {VoidPtrTy, VoidPtrTy, Int64Ty};
+  Function *MemcpyF = Intrinsic::getDeclaration(&M, Intrinsic::memcpy, MemcpyTys);
+  for (unsigned i = 0; i < Tags.size(); ++i) {
+    CallInst *CI = Tags[i];
+    std::vector<Value *> Args;
+    Args.push_back(castTo(CI->getOperand(2), VoidPtrTy, "", CI));
+    Args.push_back(getShadowAddress(M, CI->getOperand(0), CI));
+    Args.push_back(CI->getOperand(1));
+    Args.push_back(ConstantInt::get(Int32Ty, 1));
+    Args.push_back(ConstantInt::getFalse(M.getContext()));
+    CallInst::Create(MemcpyF, Args, "", CI);
+    CI->eraseFromParent();
+  }
+
+  for (unsigned i = 0; i < Checks.size(); ++i) {
+    CallInst *CI = Checks[i];
+    if(!isa<AllocaInst>(CI->getOperand(2)))
+      continue;
+    uint64_t Size = cast<ConstantInt>(CI->getOperand(1))->getZExtValue();
+    if(Size != 1 && Size != 2 && Size != 4 && Size != 8)
+      continue;
+
+    // The metadata of a well typed value is its type followed by 0xFE bytes.
+    uint64_t Type = cast<ConstantInt>(CI->getOperand(0))->getZExtValue();
+    uint64_t Expected = 0;
+    for (unsigned b = 0; b < Size; ++b) {
+      uint64_t Byte = (b == 0) ? Type : 0xFE;
+      unsigned Shift = TD->isLittleEndian() ? b : (Size - 1 - b);
+      Expected |= Byte << (8 * Shift);
+    }
+    IntegerType *MDTy = IntegerType::get(M.getContext(), 8 * Size);
+
+    BasicBlock *Head = CI->getParent();
+    BasicBlock *Cont = Head->splitBasicBlock(CI, "tc.cont");
+    BasicBlock *Slow = BasicBlock::Create(M.getContext(), "tc.slow",
+                                          Head->getParent(), Cont);
+    Head->getTerminator()->eraseFromParent();
+    Value *MDPtr = new BitCastInst(CI->getOperand(2), MDTy->getPointerTo(), "", Head);
+    Value *MD = new LoadInst(MDPtr, "", false, 1, Head);
+    Value *Match = new ICmpInst(*Head, ICmpInst::ICMP_EQ, MD,
+                                ConstantInt::get(MDTy, Expected), "");
+    BranchInst::Create(Cont, Slow, Match, Head);
+    CI->removeFromParent();
+    Slow->getInstList().push_back(CI);
+    BranchInst::Create(Cont, Slow);
+    ++numInlineChecks;
+  }
 }
 
 // add a global that has the metadata -> typeString mapping
@@ -35,6 +35,7 @@ TC("typechecks-opt", "Remove safe runtime type checks", false, true);
 
 // Pass statistics
 STATISTIC(numSafe,  "Number of statically proven safe type checks");
+STATISTIC(numUntracked, "Number of shadow memory updates removed for safe memory");
 
 static Type *VoidTy = 0;
 static Type *Int8Ty = 0;
@@ -66,12 +67,8 @@ bool TypeChecksOpt::runOnModule(Module &M) {
   TypeTagTy = Int8Ty;
   TypeTagPtrTy = PointerType::getUnqual(TypeTagTy);
 
-  Constant *memsetF = M.getOrInsertFunction ("llvm.memset.i64", VoidTy,
-                                             VoidPtrTy,
-                                             Int8Ty,
-                                             Int64Ty,
-                                             Int32Ty,
-                                             NULL);
+  Type *MemsetTys[] = {VoidPtrTy, Int64Ty};
+  Function *memsetF = Intrinsic::getDeclaration(&M, Intrinsic::memset, MemsetTys);
   trackGlobal = M.getOrInsertFunction("trackGlobal",
                                       VoidTy,
                                       VoidPtrTy,/*ptr*/
@@ -136,14 +133,56 @@ bool TypeChecksOpt::runOnModule(Module &M) {
                                      NULL);
   MallocFunc = M.getFunction("malloc");
 
+  DS = &getAnalysis<TDDataStructures>();
+  ObservedNodes.clear();
+  ScannedGraphs.clear();
+
+  // String copies read the shadow memory of their source, so it has to be
+  // kept up to date even if the source is type-safe.
+  const char *StringCopies[] = {"trackStrcpyInst", "trackStrncpyInst", "trackStrcatInst"};
+  for (unsigned i = 0; i < 3; ++i) {
+    Function *F = M.getFunction(StringCopies[i]);
+    if(!F)
+      continue;
+    for(Value::use_iterator User = F->use_begin(); User != F->use_end(); ++User) {
+      CallInst *CI = dyn_cast<CallInst>(*User);
+      assert(CI);
+      if(const DSNode *N = getNode(CI->getOperand(1), CI->getParent()->getParent()))
+        ObservedNodes.insert(N);
+    }
+  }
+
+  // Initialization of memory that nothing outside of its DSGraph can read
+  // is never looked at; drop it. This runs before any trackInitInst calls
+  // are added below.
+  for(Value::use_iterator User = trackInitInst->use_begin(); User != trackInitInst->use_end(); ++User) {
+    CallInst *CI = dyn_cast<CallInst>(*User);
+    assert(CI);
+    if(needsNoTracking(CI->getOperand(0), CI->getParent()->getParent())) {
+      toDelete.push_back(CI);
+      ++numUntracked;
+    }
+  }
+
+  if(Function *trackArray = M.getFunction("trackArray")) {
+    for(Value::use_iterator User = trackArray->use_begin(); User != trackArray->use_end(); ++User) {
+      CallInst *CI = dyn_cast<CallInst>(*User);
+      assert(CI);
+      if(needsNoTracking(CI->getOperand(0), CI->getParent()->getParent())) {
+        toDelete.push_back(CI);
+        ++numUntracked;
+      }
+    }
+  }
+
   for(Value::use_iterator User = trackGlobal->use_begin(); User != trackGlobal->use_end(); ++User) {
     CallInst *CI = dyn_cast<CallInst>(*User);
     assert(CI);
-    if(TS->isTypeSafe(CI->getOperand(1)->stripPointerCasts(), CI->getParent()->getParent())) {
+    if(TS->isTypeSafe(CI->getOperand(0)->stripPointerCasts(), CI->getParent()->getParent())) {
       std::vector<Value*>Args;
-      Args.push_back(CI->getOperand(1));
+      Args.push_back(CI->getOperand(0));
+      Args.push_back(CI->getOperand(2));
       Args.push_back(CI->getOperand(3));
-      Args.push_back(CI->getOperand(4));
       CallInst::Create(trackInitInst, Args, "", CI);
       toDelete.push_back(CI);
     }
@@ -153,17 +192,36 @@ bool TypeChecksOpt::runOnModule(Module &M) {
     CallInst *CI = dyn_cast<CallInst>(*User);
     assert(CI);
 
-    if(TS->isTypeSafe(CI->getOperand(4)->stripPointerCasts(), CI->getParent()->getParent())) {
+    if(TS->isTypeSafe(CI->getOperand(3)->stripPointerCasts(), CI->getParent()->getParent())) {
       toDelete.push_back(CI);
     }
   }
 
+  if(Function *checkTypeRange = M.getFunction("checkTypeRange")) {
+    for(Value::use_iterator User = checkTypeRange->use_begin(); User != checkTypeRange->use_end(); ++User) {
+      CallInst *CI = dyn_cast<CallInst>(*User);
+      assert(CI);
+      if(TS->isTypeSafe(CI->getOperand(0)->stripPointerCasts(), CI->getParent()->getParent()))
+        toDelete.push_back(CI);
+    }
+  }
+
+  if(Function *checkTypeStrided = M.getFunction("checkTypeStrided")) {
+    for(Value::use_iterator User = checkTypeStrided->use_begin(); User != checkTypeStrided->use_end(); ++User) {
+      CallInst *CI = dyn_cast<CallInst>(*User);
+      assert(CI);
+      if(TS->isTypeSafe(CI->getOperand(2)->stripPointerCasts(), CI->getParent()->getParent()))
+        toDelete.push_back(CI);
+    }
+  }
+
   for(Value::use_iterator User = trackStoreInst->use_begin(); User != trackStoreInst->use_end(); ++User) {
     CallInst *CI = dyn_cast<CallInst>(*User);
     assert(CI);
 
-    if(TS->isTypeSafe(CI->getOperand(1)->stripPointerCasts(), CI->getParent()->getParent())) {
+    if(needsNoTracking(CI->getOperand(0), CI->getParent()->getParent())) {
       toDelete.push_back(CI);
+      ++numUntracked;
     }
   }
 
@@ -174,18 +232,24 @@ bool TypeChecksOpt::runOnModule(Module &M) {
     assert(CI);
 
     // check if operand is an alloca inst.
-    if(TS->isTypeSafe(CI->getOperand(1)->stripPointerCasts(), CI->getParent()->getParent())) {
-      CI->setCalledFunction(trackInitInst);
-
-      if(AllocaInst *AI = dyn_cast<AllocaInst>(CI->getOperand(1)->stripPointerCasts())) {
+    if(TS->isTypeSafe(CI->getOperand(0)->stripPointerCasts(), CI->getParent()->getParent())) {
+      if(AllocaInst *AI = dyn_cast<AllocaInst>(CI->getOperand(0)->stripPointerCasts())) {
         // Initialize the allocation to NULL
         std::vector<Value *> Args2;
-        Args2.push_back(CI->getOperand(1));
+        Args2.push_back(CI->getOperand(0));
         Args2.push_back(ConstantInt::get(Int8Ty, 0));
-        Args2.push_back(CI->getOperand(2));
+        Args2.push_back(CI->getOperand(1));
         Args2.push_back(ConstantInt::get(Int32Ty, AI->getAlignment()));
+        Args2.push_back(ConstantInt::getFalse(M.getContext()));
         CallInst::Create(memsetF, Args2, "", CI);
       }
+
+      if(needsNoTracking(CI->getOperand(0), CI->getParent()->getParent())) {
+        toDelete.push_back(CI);
+        ++numUntracked;
+      } else {
+        CI->setCalledFunction(trackInitInst);
+      }
     }
   }
 
@@ -195,8 +259,10 @@ bool TypeChecksOpt::runOnModule(Module &M) {
       if(!CI)
         continue;
       if(TS->isTypeSafe(CI, CI->getParent()->getParent())){
+        if(needsNoTracking(CI, CI->getParent()->getParent()))
+          continue;
         CastInst *BCI = BitCastInst::CreatePointerCast(CI, VoidPtrTy);
-        CastInst *Size = CastInst::CreateSExtOrBitCast(CI->getOperand(1), Int64Ty);
+        CastInst *Size = CastInst::CreateSExtOrBitCast(CI->getOperand(0), Int64Ty);
         Size->insertAfter(CI);
         BCI->insertAfter(Size);
         std::vector<Value *>Args;
@@ -216,11 +282,17 @@ bool TypeChecksOpt::runOnModule(Module &M) {
     CallInst *CI = dyn_cast<CallInst>(*User);
     assert(CI);
 
-    if(TS->isTypeSafe(CI->getOperand(1)->stripPointerCasts(), CI->getParent()->getParent())) {
+    Function *F = CI->getParent()->getParent();
+    if(needsNoTracking(CI->getOperand(0), F)) {
+      toDelete.push_back(CI);
+      ++numUntracked;
+    } else if(TS->isTypeSafe(CI->getOperand(0)->stripPointerCasts(), F) ||
+              needsNoTracking(CI->getOperand(1), F)) {
+      // The source metadata is either not needed or not maintained.
       std::vector<Value*> Args;
-      Args.push_back(CI->getOperand(1));
-      Args.push_back(CI->getOperand(3)); // size
-      Args.push_back(CI->getOperand(4));
+      Args.push_back(CI->getOperand(0));
+      Args.push_back(CI->getOperand(2)); // size
+      Args.push_back(CI->getOperand(3));
       CallInst::Create(trackInitInst, Args, "", CI);
       toDelete.push_back(CI);
     }
@@ -229,11 +301,15 @@ bool TypeChecksOpt::runOnModule(Module &M) {
     CallInst *CI = dyn_cast<CallInst>(*User);
     assert(CI);
 
-    if(TS->isTypeSafe(CI->getOperand(1)->stripPointerCasts(), CI->getParent()->getParent())) {
+    Function *F = CI->getParent()->getParent();
+    if(needsNoTracking(CI->getOperand(0), F)) {
+      toDelete.push_back(CI);
+      ++numUntracked;
+    } else if(TS->isTypeSafe(CI->getOperand(0)->stripPointerCasts(), F)) {
       std::vector<Value*> Args;
-      Args.push_back(CI->getOperand(1));
-      Args.push_back(CI->getOperand(3)); // size
-      Args.push_back(CI->getOperand(6));
+      Args.push_back(CI->getOperand(0));
+      Args.push_back(CI->getOperand(2)); // size
+      Args.push_back(CI->getOperand(5));
       CallInst::Create(trackInitInst, Args, "", CI);
       toDelete.push_back(CI);
     }
@@ -242,14 +318,15 @@ bool TypeChecksOpt::runOnModule(Module &M) {
   for(Value::use_iterator User = getTypeTag->use_begin(); User != getTypeTag->use_end(); ++User) {
     CallInst *CI = dyn_cast<CallInst>(*User);
     assert(CI);
-    if(TS->isTypeSafe(CI->getOperand(1)->stripPointerCasts(), CI->getParent()->getParent())) {
-      AllocaInst *AI = dyn_cast<AllocaInst>(CI->getOperand(3)->stripPointerCasts());
+    if(TS->isTypeSafe(CI->getOperand(0)->stripPointerCasts(), CI->getParent()->getParent())) {
+      AllocaInst *AI = dyn_cast<AllocaInst>(CI->getOperand(2)->stripPointerCasts());
       assert(AI);
       std::vector<Value*>Args;
-      Args.push_back(CI->getOperand(3));
-      Args.push_back(ConstantInt::get(Int8Ty, 255));
       Args.push_back(CI->getOperand(2));
+      Args.push_back(ConstantInt::get(Int8Ty, 255));
+      Args.push_back(CI->getOperand(1));
       Args.push_back(ConstantInt::get(Int32Ty, AI->getAlignment()));
+      Args.push_back(ConstantInt::getFalse(M.getContext()));
       CallInst::Create(memsetF, Args, "", CI);
       toDelete.push_back(CI);
     }
@@ -266,4 +343,66 @@ bool TypeChecksOpt::runOnModule(Module &M) {
   return (numSafe > 0);
 }
 
+//
+// Method: getNode()
+//
+// Description:
+//  Return the DSNode for V in the DSGraph of F, or NULL if it has none.
+//
+const DSNode *TypeChecksOpt::getNode(Value *V, Function *F) {
+  if(!DS->hasDSGraph(*F))
+    return NULL;
+  const DSGraph *G = DS->getDSGraph(*F);
+  V = V->stripPointerCasts();
+  if(!G->hasNodeForValue(V))
+    return NULL;
+  findObservedNodes(G);
+  return G->getNodeForValue(V).getNode();
+}
 
+//
+// Method: findObservedNodes()
+//
+// Description:
+//  Memory reachable from globals, from the arguments and return values of the
+//  functions of a graph, or from the arguments of its call sites is also
+//  accessed through other DSGraphs, where it need not be type-safe. Record
+//  all such nodes of G as observed.
+//
+void TypeChecksOpt::findObservedNodes(const DSGraph *G) {
+  if(!ScannedGraphs.insert(G).second)
+    return;
+
+  for (DSGraph::node_const_iterator N = G->node_begin(); N != G->node_end(); ++N)
+    if(N->isGlobalNode())
+      N->markReachableNodes(ObservedNodes);
+
+  for (DSGraph::fc_iterator CI = G->fc_begin(); CI != G->fc_end(); ++CI)
+    CI->markReachableNodes(ObservedNodes);
+
+  for (DSGraph::retnodes_iterator RI = G->retnodes_begin(); RI != G->retnodes_end(); ++RI) {
+    RI->second.getNode()->markReachableNodes(ObservedNodes);
+    const Function *F = RI->first;
+    for (Function::const_arg_iterator AI = F->arg_begin(); AI != F->arg_end(); ++AI)
+      if(G->hasNodeForValue(AI))
+        G->getNodeForValue(AI).getNode()->markReachableNodes(ObservedNodes);
+  }
+
+  for (DSGraph::vanodes_iterator VI = G->vanodes_begin(); VI != G->vanodes_end(); ++VI)
+    VI->second.getNode()->markReachableNodes(ObservedNodes);
+}
+
+//
+// Method: needsNoTracking()
+//
+// Description:
+//  Return true if V points to type-safe memory whose shadow memory is never
+//  read: every access to it is type-safe, so its checks are removed, and no
+//  other DSGraph can see it through a type-unsafe node.
+//
+bool TypeChecksOpt::needsNoTracking(Value *V, Function *F) {
+  if(!TS->isTypeSafe(V->stripPointerCasts(), F))
+    return false;
+  const DSNode *N = getNode(V, F);
+  return N && !ObservedNodes.count(N);
+}
@@ -95,11 +95,37 @@ bool AllocIdentify::runOnModule(Module& M) {
 
   allocators.insert("malloc");
   allocators.insert("calloc");
+  allocators.insert("aligned_alloc");
   //allocators.insert("realloc");
   //allocators.insert("memset");
   deallocators.insert("free");
   deallocators.insert("cfree");
 
+  // C++ operator new/delete, with 32 and 64 bit size_t manglings.
+  const char *CXXAllocators[] = {
+    "_Znwj", "_Znwm", "_Znaj", "_Znam",
+    "_ZnwjRKSt9nothrow_t", "_ZnwmRKSt9nothrow_t",
+    "_ZnajRKSt9nothrow_t", "_ZnamRKSt9nothrow_t",
+    "_ZnwjSt11align_val_t", "_ZnwmSt11align_val_t",
+    "_ZnajSt11align_val_t", "_ZnamSt11align_val_t",
+    "_ZnwjSt11align_val_tRKSt9nothrow_t", "_ZnwmSt11align_val_tRKSt9nothrow_t",
+    "_ZnajSt11align_val_tRKSt9nothrow_t", "_ZnamSt11align_val_tRKSt9nothrow_t",
+    0
+  };
+  const char *CXXDeallocators[] = {
+    "_ZdlPv", "_ZdaPv", "_ZdlPvRKSt9nothrow_t", "_ZdaPvRKSt9nothrow_t",
+    "_ZdlPvj", "_ZdlPvm", "_ZdaPvj", "_ZdaPvm",
+    "_ZdlPvSt11align_val_t", "_ZdaPvSt11align_val_t",
+    "_ZdlPvjSt11align_val_t", "_ZdlPvmSt11align_val_t",
+    "_ZdaPvjSt11align_val_t", "_ZdaPvmSt11align_val_t",
+    "_ZdlPvSt11align_val_tRKSt9nothrow_t",
+    "_ZdaPvSt11align_val_tRKSt9nothrow_t", 0
+  };
+  for (unsigned i = 0; CXXAllocators[i]; ++i)
+    allocators.insert(CXXAllocators[i]);
+  for (unsigned i = 0; CXXDeallocators[i]; ++i)
+    deallocators.insert(CXXDeallocators[i]);
+
   bool changed;
   do {
     changed = false;
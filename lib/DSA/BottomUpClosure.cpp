@@ -19,7 +19,10 @@
 #include "dsa/DataStructure.h"
 #include "dsa/DSGraph.h"
 #include "llvm/Module.h"
+#include "llvm/ADT/DenseSet.h"
+#include "llvm/ADT/EquivalenceClasses.h"
 #include "llvm/ADT/Statistic.h"
+#include "llvm/Support/CommandLine.h"
 #include "llvm/Support/Debug.h"
 #include "llvm/Support/FormattedStream.h"
 
@@ -35,6 +38,22 @@ namespace {
   STATISTIC (NumEmptyCalls, "Number of calls we know nothing about");
   STATISTIC (NumRecalculations, "Number of DSGraph recalculations");
   STATISTIC (NumRecalculationsSkipped, "Number of DSGraph recalculations skipped");
+  STATISTIC (NumSummaryNodesDropped, "Number of callee nodes left out of summaries");
+  STATISTIC (NumSummaryKLimited, "Number of summary nodes merged by k-limiting");
+  STATISTIC (NumSummaryNodesMerged, "Number of summary nodes merged by bisimulation");
+
+  static cl::opt<bool> SummarizeCallees("dsa-bu-summarize",
+         cl::desc("Inline reduced callee summaries instead of callee graphs"),
+         cl::Hidden,
+         cl::init(false));
+  static cl::opt<unsigned> SummaryKLimit("dsa-bu-summary-klimit",
+         cl::desc("Collapse summary nodes deeper than this many edges (0 = off)"),
+         cl::Hidden,
+         cl::init(0));
+  static cl::opt<bool> SummaryBisimulation("dsa-bu-summary-bisim",
+         cl::desc("Merge bisimilar nodes in callee summaries"),
+         cl::Hidden,
+         cl::init(false));
 
   RegisterPass<BUDataStructures>
   X("dsa-bu", "Bottom-up Data Structure Analysis");
@@ -289,6 +308,8 @@ BUDataStructures::postOrderInline (Module & M) {
           Graph->computeIntPtrFlags();
         }
       }
+      // Every graph changed, so no summary built so far is current.
+      clearCalleeSummaries();
     }
   }
  
@@ -329,6 +350,8 @@ BUDataStructures::postOrderInline (Module & M) {
         }
       }
     }
+
+  clearCalleeSummaries();
   return;
 }
 
@@ -488,6 +511,7 @@ BUDataStructures::calculateGraphs (const Function *F,
           setDSGraph(*I->first, SCCGraph);
         
         SCCGraph->spliceFrom(NFG);
+        invalidateCalleeSummary(NFG);
         delete NFG;
         ++SCCSize;
       }
@@ -617,6 +641,249 @@ void BUDataStructures::CloneAuxIntoGlobal(DSGraph* G) {
 }
 
 
+//===----------------------------------------------------------------------===//
+// Callee summaries
+//
+// With -dsa-bu-summarize, callers inline a compressed copy of each callee graph
+// instead of the graph itself.  The summary is built once per callee graph and
+// reused by every caller until the callee graph changes again.  Dropping the
+// nodes only local values reach is exact; k-limiting and bisimulation merging
+// trade precision for smaller summaries and are off by default.
+//===----------------------------------------------------------------------===//
+
+// collectSummaryRoots - The handles through which a caller can observe the
+// summary graph: return and vararg nodes, pointer arguments, unresolved call
+// sites and globals.
+static void collectSummaryRoots(DSGraph *G, std::vector<DSNodeHandle> &Roots) {
+  for (DSGraph::retnodes_iterator I = G->retnodes_begin(),
+       E = G->retnodes_end(); I != E; ++I)
+    Roots.push_back(I->second);
+  for (DSGraph::vanodes_iterator I = G->vanodes_begin(),
+       E = G->vanodes_end(); I != E; ++I)
+    Roots.push_back(I->second);
+  for (DSGraph::afc_iterator I = G->afc_begin(), E = G->afc_end(); I != E; ++I) {
+    Roots.push_back(I->getRetVal());
+    Roots.push_back(I->getVAVal());
+    if (I->isIndirectCall())
+      Roots.push_back(DSNodeHandle(I->getCalleeNode()));
+    for (unsigned i = 0, e = I->getNumPtrArgs(); i != e; ++i)
+      Roots.push_back(I->getPtrArg(i));
+  }
+  DSScalarMap &SM = G->getScalarMap();
+  for (DSScalarMap::iterator I = SM.begin(), E = SM.end(); I != E; ++I)
+    Roots.push_back(I->second);
+}
+
+// kLimitSummary - Merge the nodes more than Limit edges away from every root
+// into collapsed summary nodes.  A deep node joins the group of each node,
+// shallow or deep, that points to it, so everything hanging below one node at
+// the depth limit collapses together while structure reached only through
+// different nodes, such as that of two unrelated arguments, stays apart.
+static void kLimitSummary(DSGraph *G, unsigned Limit) {
+  std::vector<DSNodeHandle> Roots;
+  collectSummaryRoots(G, Roots);
+
+  DenseSet<const DSNode*> Shallow;
+  std::vector<DSNode*> RootNodes, Level, Next;
+  for (unsigned i = 0, e = Roots.size(); i != e; ++i)
+    if (DSNode *N = Roots[i].getNode())
+      if (Shallow.insert(N).second)
+        RootNodes.push_back(N);
+  Level = RootNodes;
+
+  for (unsigned D = 0; D != Limit && !Level.empty(); ++D) {
+    for (unsigned i = 0, e = Level.size(); i != e; ++i)
+      for (DSNode::edge_iterator I = Level[i]->edge_begin(),
+           E = Level[i]->edge_end(); I != E; ++I)
+        if (DSNode *N = I->second.getNode())
+          if (Shallow.insert(N).second)
+            Next.push_back(N);
+    Level.swap(Next);
+    Next.clear();
+  }
+
+  // Group the deep nodes in a single walk from all the roots.
+  EquivalenceClasses<DSNode*> Groups;
+  DenseSet<const DSNode*> Seen;
+  std::vector<DSNode*> Stack(RootNodes);
+  for (unsigned i = 0, e = RootNodes.size(); i != e; ++i)
+    Seen.insert(RootNodes[i]);
+  while (!Stack.empty()) {
+    DSNode *N = Stack.back();
+    Stack.pop_back();
+    for (DSNode::edge_iterator I = N->edge_begin(), E = N->edge_end();
+         I != E; ++I)
+      if (DSNode *M = I->second.getNode()) {
+        if (!Shallow.count(M))
+          Groups.unionSets(N, M);
+        if (Seen.insert(M).second)
+          Stack.push_back(M);
+      }
+  }
+
+  // Collect the handles first: merging forwards nodes, and handles follow the
+  // forwarding.  Merging one group can also pull in nodes of another.
+  std::vector<std::vector<DSNodeHandle> > Deep;
+  for (EquivalenceClasses<DSNode*>::iterator I = Groups.begin(),
+       E = Groups.end(); I != E; ++I) {
+    if (!I->isLeader()) continue;
+    Deep.push_back(std::vector<DSNodeHandle>());
+    for (EquivalenceClasses<DSNode*>::member_iterator
+         MI = Groups.member_begin(I), ME = Groups.member_end(); MI != ME; ++MI)
+      if (!Shallow.count(*MI))
+        Deep.back().push_back(DSNodeHandle(*MI));
+  }
+
+  for (unsigned g = 0, ge = Deep.size(); g != ge; ++g) {
+    std::vector<DSNodeHandle> &Group = Deep[g];
+    for (unsigned i = 1, e = Group.size(); i != e; ++i)
+      Group[0].mergeWith(Group[i]);
+    Group[0].getNode()->foldNodeCompletely();
+    NumSummaryKLimited += Group.size();
+  }
+}
+
+// bisimulateSummary - Merge nodes that have the same flags, size, types and
+// links to equivalent nodes.  Nodes a root points to directly and nodes that
+// hold globals keep their identity, so a caller's distinct arguments and
+// globals are never merged.
+static void bisimulateSummary(DSGraph *G) {
+  std::vector<DSNodeHandle> Roots;
+  collectSummaryRoots(G, Roots);
+  DenseSet<const DSNode*> Pinned;
+  for (unsigned i = 0, e = Roots.size(); i != e; ++i)
+    if (DSNode *N = Roots[i].getNode())
+      Pinned.insert(N);
+
+  typedef std::vector<unsigned long> SignatureTy;
+  DenseMap<const DSNode*, unsigned> Class;
+  unsigned NumClasses = 0;
+
+  // The initial partition: pinned nodes are alone in their class, the others
+  // are split by their local properties.
+  {
+    std::map<SignatureTy, unsigned> Classes;
+    for (DSGraph::node_iterator I = G->node_begin(), E = G->node_end();
+         I != E; ++I) {
+      if (Pinned.count(&*I) || I->numGlobals()) {
+        Class[&*I] = NumClasses++;
+        continue;
+      }
+      SignatureTy Sig;
+      Sig.push_back(I->getNodeFlags());
+      Sig.push_back(I->getSize());
+      for (DSNode::const_type_iterator TI = I->type_begin(),
+           TE = I->type_end(); TI != TE; ++TI) {
+        Sig.push_back(TI->first);
+        Sig.push_back((unsigned long)(const void*)TI->second);
+      }
+      std::pair<std::map<SignatureTy, unsigned>::iterator, bool> R =
+        Classes.insert(std::make_pair(Sig, NumClasses));
+      if (R.second) ++NumClasses;
+      Class[&*I] = R.first->second;
+    }
+  }
+
+  // Refine by the classes of the link targets until the partition is stable.
+  for (;;) {
+    std::map<SignatureTy, unsigned> Classes;
+    DenseMap<const DSNode*, unsigned> NewClass;
+    for (DSGraph::node_iterator I = G->node_begin(), E = G->node_end();
+         I != E; ++I) {
+      SignatureTy Sig;
+      Sig.push_back(Class[&*I]);
+      for (DSNode::edge_iterator EI = I->edge_begin(), EE = I->edge_end();
+           EI != EE; ++EI) {
+        const DSNodeHandle &Dst = EI->second;
+        Sig.push_back(EI->first);
+        Sig.push_back(Dst.getNode() ? Class[Dst.getNode()] + 1 : 0);
+        Sig.push_back(Dst.getOffset());
+      }
+      NewClass[&*I] =
+        Classes.insert(std::make_pair(Sig, (unsigned)Classes.size()))
+          .first->second;
+    }
+    bool Stable = Classes.size() == NumClasses;
+    Class.swap(NewClass);
+    NumClasses = Classes.size();
+    if (Stable) break;
+  }
+
+  // Merge each class into its first member.
+  std::vector<DSNodeHandle> Leaders(NumClasses);
+  std::vector<std::pair<unsigned, DSNodeHandle> > ToMerge;
+  for (DSGraph::node_iterator I = G->node_begin(), E = G->node_end();
+       I != E; ++I) {
+    unsigned C = Class[&*I];
+    if (Leaders[C].isNull())
+      Leaders[C] = DSNodeHandle(&*I);
+    else
+      ToMerge.push_back(std::make_pair(C, DSNodeHandle(&*I)));
+  }
+  for (unsigned i = 0, e = ToMerge.size(); i != e; ++i)
+    if (Leaders[ToMerge[i].first].getNode() != ToMerge[i].second.getNode()) {
+      Leaders[ToMerge[i].first].mergeWith(ToMerge[i].second);
+      ++NumSummaryNodesMerged;
+    }
+}
+
+// getCalleeSummary - Return the graph to inline for the callee graph G: G
+// itself, or with -dsa-bu-summarize a cached compressed copy of it.
+DSGraph *BUDataStructures::getCalleeSummary(DSGraph *G) {
+  if (!SummarizeCallees)
+    return G;
+
+  DSGraph *&Summary = CalleeSummaries[G];
+  if (Summary)
+    return Summary;
+
+  // Copy only what a caller can reach: the return, vararg and pointer
+  // argument nodes, the unresolved call sites and the globals.  Everything
+  // else is reachable only from the callee's locals.
+  Summary = new DSGraph(GlobalECs, G->getTargetData(), *TypeSS);
+  ReachabilityCloner RC(Summary, G, 0);
+  for (DSGraph::retnodes_iterator I = G->retnodes_begin(),
+       E = G->retnodes_end(); I != E; ++I) {
+    const Function *F = I->first;
+    Summary->getReturnNodes()[F] = RC.getClonedNH(I->second);
+    Summary->getVANodes()[F] = RC.getClonedNH(G->getVANodeFor(*F));
+    for (Function::const_arg_iterator AI = F->arg_begin(), AE = F->arg_end();
+         AI != AE; ++AI)
+      if (isa<PointerType>(AI->getType()))
+        Summary->getNodeForValue(AI) = RC.getClonedNH(G->getNodeForValue(AI));
+  }
+  for (DSGraph::afc_iterator I = G->afc_begin(), E = G->afc_end(); I != E; ++I)
+    if (!I->isUnresolvable())
+      Summary->addAuxFunctionCall(RC.cloneCallSite(*I));
+  const DSScalarMap &SM = G->getScalarMap();
+  for (DSScalarMap::global_iterator I = SM.global_begin(),
+       E = SM.global_end(); I != E; ++I)
+    RC.getClonedNH(G->getNodeForValue(*I));
+  NumSummaryNodesDropped += G->getGraphSize() - Summary->getGraphSize();
+
+  if (SummaryKLimit)
+    kLimitSummary(Summary, SummaryKLimit);
+  if (SummaryBisimulation)
+    bisimulateSummary(Summary);
+  Summary->removeTriviallyDeadNodes();
+  return Summary;
+}
+
+void BUDataStructures::invalidateCalleeSummary(const DSGraph *G) {
+  std::map<const DSGraph*, DSGraph*>::iterator I = CalleeSummaries.find(G);
+  if (I == CalleeSummaries.end()) return;
+  delete I->second;
+  CalleeSummaries.erase(I);
+}
+
+void BUDataStructures::clearCalleeSummaries() {
+  for (std::map<const DSGraph*, DSGraph*>::iterator I = CalleeSummaries.begin(),
+       E = CalleeSummaries.end(); I != E; ++I)
+    delete I->second;
+  CalleeSummaries.clear();
+}
+
+
 //
 // Description:
 //  Inline all graphs in the callgraph and remove callsites that are completely
@@ -624,6 +891,7 @@ void BUDataStructures::CloneAuxIntoGlobal(DSGraph* G) {
 //
 void BUDataStructures::calculateGraph(DSGraph* Graph) {
   DEBUG(Graph->AssertGraphOK(); Graph->getGlobalsGraph()->AssertGraphOK());
+  invalidateCalleeSummary(Graph);
   Graph->buildCallGraph(callgraph, GlobalFunctionList, filterCallees);
 
   // Move our call site list into TempFCs so that inline call sites go into the
@@ -699,7 +967,9 @@ void BUDataStructures::calculateGraph(DSGraph* Graph) {
       //  I believe the answer is on page 6 of the PLDI paper on DSA.  The
       //  idea is that stack objects are invalid if they escape.
       //
-      Graph->mergeInGraph(CS, *Callee, *GI,
+      // A recursive call into the graph being built must see the graph itself.
+      DSGraph *Inlined = GI == Graph ? GI : getCalleeSummary(GI);
+      Graph->mergeInGraph(CS, *Callee, *Inlined,
                           DSGraph::StripAllocaBit|DSGraph::DontCloneCallNodes);
       ++NumInlines;
       DEBUG(Graph->AssertGraphOK(););
@@ -582,20 +582,30 @@ DSCallSite DSGraph::getDSCallSiteForCallSite(CallSite CS) const {
 // markIncompleteNodes - Mark the specified node as having contents that are not
 // known with the current analysis we have performed.  Because a node makes all
 // of the nodes it can reach incomplete if the node itself is incomplete, we
-// must recursively traverse the data structure graph, marking all reachable
-// nodes as incomplete.
+// must traverse the data structure graph, marking all reachable nodes as
+// incomplete.  The traversal uses an explicit stack so that long chains of
+// nodes cannot overflow the call stack.
 //
 static void markIncompleteNode(DSNode *N) {
-  // Stop recursion if no node, or if node already marked...
+  // Stop if no node, or if node already marked...
   if (N == 0 || N->isIncompleteNode()) return;
 
   // Actually mark the node
   N->setIncompleteMarker();
 
-  // Recursively process children...
-  for (DSNode::edge_iterator ii = N->edge_begin(), ee = N->edge_end();
-       ii != ee; ++ii)
-    markIncompleteNode(ii->second.getNode());
+  // Process the children of every newly marked node...
+  std::vector<DSNode*> Stack(1, N);
+  while (!Stack.empty()) {
+    N = Stack.back();
+    Stack.pop_back();
+    for (DSNode::edge_iterator ii = N->edge_begin(), ee = N->edge_end();
+         ii != ee; ++ii)
+      if (DSNode *Child = ii->second.getNode())
+        if (!Child->isIncompleteNode()) {
+          Child->setIncompleteMarker();
+          Stack.push_back(Child);
+        }
+  }
 }
 
 static void markIncomplete(DSCallSite &Call) {
@@ -671,23 +681,30 @@ void DSGraph::markIncompleteNodes(unsigned Flags) {
 //
 // Description:
 //  Marks the specified node, and all that's reachable from it, as external.
-//  It uses 'processedNodes' to track recursion.
+//  It uses 'processedNodes' to avoid visiting a node twice, and an explicit
+//  stack so that long chains of nodes cannot overflow the call stack.
 //
 static void markExternalNode(DSNode *N, DenseSet<DSNode *> & processedNodes) {
-  // Stop recursion if no node, or if node already processed
-  if (N == 0 || processedNodes.count(N) ) return;
+  // Stop if no node, or if node already processed
+  if (N == 0 || !processedNodes.insert(N).second) return;
 
-  processedNodes.insert(N);
+  std::vector<DSNode*> Stack(1, N);
+  while (!Stack.empty()) {
+    N = Stack.back();
+    Stack.pop_back();
 
-  // Actually mark the node
-  N->setExternalMarker();
-  
-  // FIXME: Should we 'collapse' the node as well?
+    // Actually mark the node
+    N->setExternalMarker();
+
+    // FIXME: Should we 'collapse' the node as well?
 
-  // Recursively process children...
-  for (DSNode::edge_iterator ii = N->edge_begin(), ee = N->edge_end();
-       ii != ee; ++ii)
-    markExternalNode(ii->second.getNode(), processedNodes);
+    // Process children...
+    for (DSNode::edge_iterator ii = N->edge_begin(), ee = N->edge_end();
+         ii != ee; ++ii)
+      if (DSNode *Child = ii->second.getNode())
+        if (processedNodes.insert(Child).second)
+          Stack.push_back(Child);
+  }
 }
 
 // markExternal --marks the specified callsite external, using 'processedNodes' to track recursion.
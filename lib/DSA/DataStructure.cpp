@@ -46,10 +46,11 @@ namespace {
 /// isForwarding - Return true if this NodeHandle is forwarding to another
 /// one.
 bool DSNodeHandle::isForwarding() const {
-  return N && N->isForwarding();
+  return NodeID && getRawNode()->isForwarding();
 }
 
 DSNode *DSNodeHandle::HandleForwarding() const {
+  DSNode *N = getRawNode();
   assert(N->isForwarding() && "Can only be invoked if forwarding!");
   DEBUG(
     { //assert not looping
@@ -58,7 +59,7 @@ DSNode *DSNodeHandle::HandleForwarding() const {
     while(NH && NH->isForwarding()) {
     assert(seen.find(NH) == seen.end() && "Loop detected");
     seen.insert(NH);
-    NH = NH->ForwardNH.N;
+    NH = NH->ForwardNH.getRawNode();
     }
     }
     );
@@ -72,6 +73,7 @@ DSNode *DSNodeHandle::HandleForwarding() const {
   }
 
   N = Next;
+  setNodeID(N->NodeID);
   N->NumReferrers++;
 
   if (N->getSize() <= Offset) {
@@ -129,8 +131,25 @@ void DSScalarMap::spliceFrom(DSScalarMap &RHS) {
 // DSNode Implementation
 //===----------------------------------------------------------------------===//
 
+std::vector<DSNode*> DSNode::NodeTable;
+
+void DSNode::allocateNodeID() {
+  if (NodeTable.empty())
+    NodeTable.push_back(0);   // ID 0 is the null node.
+  assert(NodeTable.size() < ~0U && "Too many DSNodes for 32-bit node IDs!");
+  NodeID = NodeTable.size();
+  NodeTable.push_back(this);
+}
+
+void DSNode::releaseNodeID() {
+  if (!NodeID) return;
+  NodeTable[NodeID] = 0;
+  NodeID = 0;
+}
+
 DSNode::DSNode(DSGraph *G)
-  : NumReferrers(0), Size(0), ParentGraph(G), NodeType(0) {
+  : NumReferrers(0), Size(0), ParentGraph(G), NodeType(0), NodeID(0) {
+    allocateNodeID();
     // Add the type entry if it is specified...
     if (G) G->addNode(this);
     ++NumNodeAllocated;
@@ -139,7 +158,8 @@ DSNode::DSNode(DSGraph *G)
 // DSNode copy constructor... do not copy over the referrers list!
 DSNode::DSNode(const DSNode &N, DSGraph *G, bool NullLinks)
   : NumReferrers(0), Size(N.Size), ParentGraph(G), TyMap(N.TyMap),
-  Globals(N.Globals), NodeType(N.NodeType) {
+  Globals(N.Globals), NodeType(N.NodeType), NodeID(0) {
+    allocateNodeID();
     if (!NullLinks) Links = N.Links;
     G->addNode(this);
     ++NumNodeAllocated;
@@ -148,6 +168,7 @@ DSNode::DSNode(const DSNode &N, DSGraph *G, bool NullLinks)
 DSNode::~DSNode() {
   dropAllReferences();
   assert(hasNoReferrers() && "Referrers to dead node exist!");
+  releaseNodeID();
 }
 
 void DSNode::assertOK() const {
@@ -1060,6 +1081,13 @@ void ReachabilityCloner::mergeCallSite(DSCallSite &DestCS,
   }
 }
 
+void ReachabilityCloner::getDestNodes(std::set<DSNode*> &Nodes) const {
+  for (RCNodeMap::const_iterator I = NodeMap.begin(), E = NodeMap.end();
+       I != E; ++I)
+    if (DSNode *N = I->second.getNode())
+      Nodes.insert(N);
+}
+
 DSCallSite ReachabilityCloner::cloneCallSite(const DSCallSite& SrcCS) {
   std::vector<DSNodeHandle> Args;
   for(unsigned x = 0; x < SrcCS.getNumPtrArgs(); ++x)
@@ -1336,8 +1364,10 @@ void DataStructures::formGlobalFunctionList() {
 
 void DataStructures::formGlobalECs() {
   // Grow the equivalence classes for the globals to include anything that we
-  // now know to be aliased.
+  // now know to be aliased.  Globals equated by updateGlobalECs have not been
+  // eliminated from the function graphs yet, so do that now too.
   svset<const GlobalValue*> ECGlobals;
+  ECGlobals.swap(PendingECGlobals);
   buildGlobalECs(ECGlobals);
   if (!ECGlobals.empty()) {
     DEBUG(errs() << "Eliminating " << ECGlobals.size() << " EC Globals!\n");
@@ -1347,42 +1377,62 @@ void DataStructures::formGlobalECs() {
   }
 }
 
+/// updateGlobalECs - Grow the global equivalence classes using only the
+/// specified globals graph nodes, typically the nodes a cloneIntoGlobals call
+/// merged into.  The newly equated globals are eliminated from the function
+/// graphs by the next call to formGlobalECs.
+void DataStructures::updateGlobalECs(const std::set<DSNode*> &Nodes) {
+  for (std::set<DSNode*>::const_iterator I = Nodes.begin(), E = Nodes.end();
+       I != E; ++I)
+    unionGlobalsInNode(*I, PendingECGlobals);
+
+  DEBUG(GlobalsGraph->AssertGraphOK());
+}
+
+/// unionGlobalsInNode - If the globals graph node N contains multiple globals,
+/// union them into one equivalence class, add the non-leaders to ECGlobals and
+/// leave only the leader in the node.
+void DataStructures::unionGlobalsInNode(DSNode *N,
+                                        svset<const GlobalValue*> &ECGlobals) {
+  if (N->numGlobals() <= 1) return;
+
+  DSScalarMap &SM = GlobalsGraph->getScalarMap();
+  EquivalenceClasses<const GlobalValue*> &GlobalECs = SM.getGlobalECs();
+
+  // First, build up the equivalence set for this block of globals.
+  DSNode::globals_iterator i = N->globals_begin();
+  const GlobalValue *First = *i;
+  if (GlobalECs.findValue(*i) != GlobalECs.end())
+    First = GlobalECs.getLeaderValue(*i);
+  if (*i == First) ++i;
+  for( ; i != N->globals_end(); ++i) {
+    GlobalECs.unionSets(First, *i);
+    ECGlobals.insert(*i);
+    if (SM.find(*i) != SM.end())
+      SM.erase(SM.find(*i));
+    else
+      errs() << "Global missing in scalar map " << (*i)->getName() << "\n";
+  }
+
+  // Next, get the leader element.
+  assert(First == GlobalECs.getLeaderValue(First) &&
+         "First did not end up being the leader?");
+
+  // Finally, change the global node to only contain the leader.
+  N->clearGlobals();
+  N->addGlobal(First);
+}
+
 /// BuildGlobalECs - Look at all of the nodes in the globals graph.  If any node
 /// contains multiple globals, DSA will never, ever, be able to tell the globals
 /// apart.  Instead of maintaining this information in all of the graphs
 /// throughout the entire program, store only a single global (the "leader") in
 /// the graphs, and build equivalence classes for the rest of the globals.
 void DataStructures::buildGlobalECs(svset<const GlobalValue*> &ECGlobals) {
-  DSScalarMap &SM = GlobalsGraph->getScalarMap();
-  EquivalenceClasses<const GlobalValue*> &GlobalECs = SM.getGlobalECs();
   for (DSGraph::node_iterator I = GlobalsGraph->node_begin(), 
        E = GlobalsGraph->node_end();
-       I != E; ++I) {
-    if (I->numGlobals() <= 1) continue;
-
-    // First, build up the equivalence set for this block of globals.
-    DSNode::globals_iterator i = I->globals_begin(); 
-    const GlobalValue *First = *i;
-    if (GlobalECs.findValue(*i) != GlobalECs.end())
-      First = GlobalECs.getLeaderValue(*i);
-    if (*i == First) ++i;
-    for( ; i != I->globals_end(); ++i) {
-      GlobalECs.unionSets(First, *i);
-      ECGlobals.insert(*i);
-      if (SM.find(*i) != SM.end())
-        SM.erase(SM.find(*i));
-      else
-        errs() << "Global missing in scalar map " << (*i)->getName() << "\n";
-    }
-
-    // Next, get the leader element.
-    assert(First == GlobalECs.getLeaderValue(First) &&
-           "First did not end up being the leader?");
-
-    // Finally, change the global node to only contain the leader.
-    I->clearGlobals();
-    I->addGlobal(First);
-  }
+       I != E; ++I)
+    unionGlobalsInNode(&*I, ECGlobals);
 
   DEBUG(GlobalsGraph->AssertGraphOK());
 }
@@ -1450,7 +1500,8 @@ void DataStructures::cloneGlobalsInto(DSGraph* Graph, unsigned cloneFlags) {
 }
 
 //For all graphs
-void DataStructures::cloneIntoGlobals(DSGraph* Graph, unsigned cloneFlags) {
+void DataStructures::cloneIntoGlobals(DSGraph* Graph, unsigned cloneFlags,
+                                      std::set<DSNode*> *DestNodes) {
   // When this graph is finalized, clone the globals in the graph into the
   // globals graph to make sure it has everything, from all graphs.
   DSScalarMap &MainSM = Graph->getScalarMap();
@@ -1461,6 +1512,9 @@ void DataStructures::cloneIntoGlobals(DSGraph* Graph, unsigned cloneFlags) {
   for (DSScalarMap::global_iterator I = MainSM.global_begin(),
        E = MainSM.global_end(); I != E; ++I)
     RC.getClonedNH(MainSM[*I]);
+
+  if (DestNodes)
+    RC.getDestNodes(*DestNodes);
 }
 
 
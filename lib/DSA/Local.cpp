@@ -1388,10 +1388,15 @@ bool LocalDataStructures::runOnModule(Module &M) {
       G->maskIncompleteMarkers();
       G->markIncompleteNodes(DSGraph::MarkFormalArgs
                              |DSGraph::IgnoreGlobals);
+      // Only the globals graph nodes this graph was merged into can have
+      // gained globals, so only they need to be looked at.  The function
+      // graphs are cleaned of the newly equated globals by the formGlobalECs
+      // call below.
+      std::set<DSNode*> GlobalNodes;
       cloneIntoGlobals(G, DSGraph::DontCloneCallNodes |
                        DSGraph::DontCloneAuxCallNodes |
-                       DSGraph::StripAllocaBit);
-      formGlobalECs();
+                       DSGraph::StripAllocaBit, &GlobalNodes);
+      updateGlobalECs(GlobalNodes);
       DEBUG(G->AssertGraphOK());
     }
 
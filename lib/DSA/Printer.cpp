@@ -21,7 +21,10 @@
 #include "llvm/Assembly/Writer.h"
 #include "llvm/Support/CommandLine.h"
 #include "llvm/Support/GraphWriter.h"
+#include "llvm/ADT/DenseMap.h"
+#include "llvm/ADT/DenseSet.h"
 #include "llvm/ADT/Statistic.h"
+#include "llvm/ADT/StringExtras.h"
 #include "llvm/Config/config.h"
 #include "llvm/Support/FormattedStream.h"
 #include <sstream>
@@ -34,6 +37,31 @@ namespace {
   cl::list<std::string> OnlyPrint("dsa-only-print", cl::ReallyHidden);
   cl::opt<bool> DontPrintGraphs("dont-print-ds", cl::ReallyHidden);
   cl::opt<bool> LimitPrint("dsa-limit-print", cl::Hidden);
+
+  // The format graphs are written to files in.  Both formats are streamed
+  // record by record, so memory use does not grow with the size of the graph.
+  enum DSPrintFormat { dot, ndjson };
+  cl::opt<DSPrintFormat>
+  PrintFormat("dsa-print-format", cl::Hidden,
+              cl::desc("Format of the DSGraph files written by -analyze"),
+              cl::values(clEnumVal(dot,    "Graphviz dot file (default)"),
+                         clEnumVal(ndjson, "One JSON record per line"),
+                         clEnumValEnd), cl::init(dot));
+
+  // Slicing options: only the nodes matching all of them are written.
+  cl::list<std::string>
+  PrintSlice("dsa-print-slice", cl::Hidden, cl::CommaSeparated,
+             cl::desc("Only print nodes reachable from the named values"));
+  cl::opt<unsigned>
+  PrintSliceDepth("dsa-print-slice-depth", cl::Hidden, cl::init(2),
+                  cl::desc("Number of edges followed from -dsa-print-slice"));
+  cl::opt<bool>
+  PrintOnlyCollapsed("dsa-print-only-collapsed", cl::Hidden,
+                     cl::desc("Only print collapsed nodes"));
+  cl::opt<bool>
+  PrintOnlyIncomplete("dsa-print-only-incomplete", cl::Hidden,
+                      cl::desc("Only print incomplete nodes"));
+
   STATISTIC (MaxGraphSize   , "Maximum graph size");
   STATISTIC (NumFoldedNodes , "Number of folded nodes (in final graph)");
 }
@@ -41,22 +69,51 @@ namespace {
 void DSNode::dump() const { print(errs(), 0); }
 void DSNode::dumpParentGraph() const { getParentGraph()->dump(); }
 
-static std::string getCaption(const DSNode *N, const DSGraph *G) {
+// Get the module from ONE of the functions in the graph, or from one of its
+// globals, if either is available.
+static const Module *getModuleForGraph(const DSGraph *G) {
+  if (!G)
+    return 0;
+  if (G->retnodes_begin() != G->retnodes_end())
+    return G->retnodes_begin()->first->getParent();
+  const DSScalarMap &SM = G->getScalarMap();
+  if (SM.global_begin() != SM.global_end())
+    return (*SM.global_begin())->getParent();
+  return 0;
+}
+
+// Print the one letter abbreviations of the given node flags.
+static void printNodeFlags(raw_ostream &OS, unsigned NodeType) {
+  if (NodeType & DSNode::AllocaNode       ) OS << "S";
+  if (NodeType & DSNode::HeapNode         ) OS << "H";
+  if (NodeType & DSNode::GlobalNode       ) OS << "G";
+  if (NodeType & DSNode::UnknownNode      ) OS << "U";
+  if (NodeType & DSNode::IncompleteNode   ) OS << "I";
+  if (NodeType & DSNode::ModifiedNode     ) OS << "M";
+  if (NodeType & DSNode::ReadNode         ) OS << "R";
+  if (NodeType & DSNode::ExternalNode     ) OS << "E";
+  if (NodeType & DSNode::ExternFuncNode   ) OS << "X";
+  if (NodeType & DSNode::IntToPtrNode     ) OS << "P";
+  if (NodeType & DSNode::PtrToIntNode     ) OS << "2";
+  if (NodeType & DSNode::VAStartNode      ) OS << "V";
+
+#ifndef NDEBUG
+  if (NodeType & DSNode::DeadNode       ) OS << "<dead>";
+#endif
+}
+
+// Cache of the number of members in each global equivalence class, keyed by
+// the leader.  Counting the members walks the whole class, so the streaming
+// writer counts each class only once per graph.
+typedef DenseMap<const GlobalValue*, unsigned> ECSizeCacheTy;
+
+static std::string getCaption(const DSNode *N, const DSGraph *G,
+                              ECSizeCacheTy *ECSizes = 0) {
   std::string empty;
   raw_string_ostream OS(empty);
-  const Module *M = 0;
 
   if (!G) G = N->getParentGraph();
-
-  // Get the module from ONE of the functions in the graph it is available.
-  if (G && G->retnodes_begin() != G->retnodes_end())
-    M = G->retnodes_begin()->first->getParent();
-  if (M == 0 && G) {
-    // If there is a global in the graph, we can use it to find the module.
-    const DSScalarMap &SM = G->getScalarMap();
-    if (SM.global_begin() != SM.global_end())
-      M = (*SM.global_begin())->getParent();
-  }
+  const Module *M = getModuleForGraph(G);
 
   if (N->isNodeCompletelyFolded())
     OS << "COLLAPSED";
@@ -83,22 +140,7 @@ static std::string getCaption(const DSNode *N, const DSGraph *G) {
   }
   if (unsigned NodeType = N->getNodeFlags()) {
     OS << ": ";
-    if (NodeType & DSNode::AllocaNode       ) OS << "S";
-    if (NodeType & DSNode::HeapNode         ) OS << "H";
-    if (NodeType & DSNode::GlobalNode       ) OS << "G";
-    if (NodeType & DSNode::UnknownNode      ) OS << "U";
-    if (NodeType & DSNode::IncompleteNode   ) OS << "I";
-    if (NodeType & DSNode::ModifiedNode     ) OS << "M";
-    if (NodeType & DSNode::ReadNode         ) OS << "R";
-    if (NodeType & DSNode::ExternalNode     ) OS << "E";
-    if (NodeType & DSNode::ExternFuncNode   ) OS << "X";
-    if (NodeType & DSNode::IntToPtrNode     ) OS << "P";
-    if (NodeType & DSNode::PtrToIntNode     ) OS << "2";
-    if (NodeType & DSNode::VAStartNode      ) OS << "V";
-
-#ifndef NDEBUG
-    if (NodeType & DSNode::DeadNode       ) OS << "<dead>";
-#endif
+    printNodeFlags(OS, NodeType);
     OS << "\n";
   }
 
@@ -123,8 +165,16 @@ static std::string getCaption(const DSNode *N, const DSGraph *G) {
       EquivalenceClasses<const GlobalValue*>::iterator I =
         GlobalECs->findValue(*i);
       if (I != GlobalECs->end()) {
-        unsigned NumMembers =
-          std::distance(GlobalECs->member_begin(I), GlobalECs->member_end());
+        unsigned NumMembers = 0;
+        if (ECSizes) {
+          unsigned &Cached = (*ECSizes)[GlobalECs->getLeaderValue(*i)];
+          if (!Cached)
+            Cached = std::distance(GlobalECs->findLeader(I),
+                                   GlobalECs->member_end());
+          NumMembers = Cached;
+        } else
+          NumMembers =
+            std::distance(GlobalECs->member_begin(I), GlobalECs->member_end());
         if (NumMembers != 1) OS << " + " << (NumMembers-1) << " EC";
       }
     }
@@ -195,16 +245,7 @@ struct DOTGraphTraits<const DSGraph*> : public DefaultDOTGraphTraits {
   ///
   static void addCustomGraphFeatures(const DSGraph *G,
                                      GraphWriter<const DSGraph*> &GW) {
-    const Module *CurMod = 0;
-    if (G->retnodes_begin() != G->retnodes_end())
-      CurMod = G->retnodes_begin()->first->getParent();
-    else {
-      // If there is a global in the graph, we can use it to find the module.
-      const DSScalarMap &SM = G->getScalarMap();
-      if (SM.global_begin() != SM.global_end())
-        CurMod = (*SM.global_begin())->getParent();
-    }
-
+    const Module *CurMod = getModuleForGraph(G);
 
     if (!LimitPrint) {
       // Add scalar nodes to the graph...
@@ -290,6 +331,344 @@ struct DOTGraphTraits<const DSGraph*> : public DefaultDOTGraphTraits {
 };
 }   // end namespace llvm
 
+//===----------------------------------------------------------------------===//
+// Streaming graph writer
+//
+// GraphWriter is fine for the small graphs viewed from the debugger, but the
+// globals graph of a large program produces dot files nobody can open.  The
+// writer below emits one record per node, edge, scalar and call site straight
+// to the output stream, and can restrict the output to a slice of the graph.
+//===----------------------------------------------------------------------===//
+
+namespace {
+class DSGraphStreamWriter {
+  raw_ostream &O;
+  const DSGraph *G;
+  const Module *M;
+  bool HasSlice;
+  DenseSet<const DSNode*> Slice;
+  ECSizeCacheTy ECSizes;
+
+  void computeSlice();
+  bool isSelected(const DSNode *N) const;
+
+  void writeNodeID(const void *N) { O << "\"Node" << N << "\""; }
+  void writeDotEdge(const void *Src, const char *SrcLabel,
+                    const DSNodeHandle &Dst, const char *Attrs);
+  void writeJSONHandle(const char *Key, const DSNodeHandle &H);
+  void writeValueName(const Value *V, bool JSON);
+
+  void writeDotNode(const DSNode *N);
+  void writeJSONNode(const DSNode *N);
+  void writeScalars();
+  void writeReturnNodes();
+  void writeCallSites();
+
+public:
+  DSGraphStreamWriter(raw_ostream &O, const DSGraph *G)
+    : O(O), G(G), M(getModuleForGraph(G)), HasSlice(!PrintSlice.empty()) {
+    if (HasSlice)
+      computeSlice();
+  }
+
+  void write();
+};
+}
+
+/// isSliced - Return true if any of the options restricting the printed nodes
+/// is in effect.
+static bool isSliced() {
+  return !PrintSlice.empty() || PrintOnlyCollapsed || PrintOnlyIncomplete;
+}
+
+static void writeJSONString(raw_ostream &OS, StringRef S) {
+  static const char Hex[] = "0123456789abcdef";
+  OS << '"';
+  for (StringRef::iterator I = S.begin(), E = S.end(); I != E; ++I) {
+    unsigned char C = *I;
+    switch (C) {
+    case '"':  OS << "\\\""; break;
+    case '\\': OS << "\\\\"; break;
+    case '\n': OS << "\\n"; break;
+    case '\t': OS << "\\t"; break;
+    default:
+      if (C < 0x20)
+        OS << "\\u00" << Hex[C >> 4] << Hex[C & 15];
+      else
+        OS << C;
+    }
+  }
+  OS << '"';
+}
+
+// computeSlice - Collect the nodes within PrintSliceDepth edges of the values
+// named by -dsa-print-slice.  Only the slice is kept in memory.
+void DSGraphStreamWriter::computeSlice() {
+  std::vector<const DSNode*> Worklist, Next;
+  const DSScalarMap &SM = G->getScalarMap();
+  for (DSScalarMap::const_iterator I = SM.begin(), E = SM.end(); I != E; ++I)
+    if (I->first->hasName() &&
+        std::find(PrintSlice.begin(), PrintSlice.end(),
+                  I->first->getName().str()) != PrintSlice.end())
+      if (const DSNode *N = I->second.getNode())
+        if (Slice.insert(N).second)
+          Worklist.push_back(N);
+
+  for (unsigned Depth = 0; Depth < PrintSliceDepth && !Worklist.empty();
+       ++Depth) {
+    for (unsigned i = 0, e = Worklist.size(); i != e; ++i)
+      for (DSNode::const_edge_iterator I = Worklist[i]->edge_begin(),
+           E = Worklist[i]->edge_end(); I != E; ++I)
+        if (const DSNode *N = I->second.getNode())
+          if (Slice.insert(N).second)
+            Next.push_back(N);
+    Worklist.swap(Next);
+    Next.clear();
+  }
+}
+
+bool DSGraphStreamWriter::isSelected(const DSNode *N) const {
+  if (!N)
+    return false;
+  if (PrintOnlyCollapsed && !N->isNodeCompletelyFolded())
+    return false;
+  if (PrintOnlyIncomplete && !N->isIncompleteNode())
+    return false;
+  return !HasSlice || Slice.count(N);
+}
+
+void DSGraphStreamWriter::writeValueName(const Value *V, bool JSON) {
+  std::string Name;
+  raw_string_ostream OS(Name);
+  WriteAsOperand(OS, V, false, M);
+  if (JSON)
+    writeJSONString(O, OS.str());
+  else
+    O << '"' << DOT::EscapeString(OS.str()) << '"';
+}
+
+void DSGraphStreamWriter::writeDotEdge(const void *Src, const char *SrcLabel,
+                                       const DSNodeHandle &Dst,
+                                       const char *Attrs) {
+  O << "\t";
+  writeNodeID(Src);
+  O << " -> ";
+  writeNodeID(Dst.getNode());
+  O << " [" << Attrs;
+  if (SrcLabel || Dst.getOffset()) {
+    O << ",label=\"";
+    if (SrcLabel)
+      O << DOT::EscapeString(SrcLabel);
+    if (Dst.getOffset())
+      O << "+" << Dst.getOffset();
+    O << "\"";
+  }
+  O << "];\n";
+}
+
+void DSGraphStreamWriter::writeJSONHandle(const char *Key,
+                                          const DSNodeHandle &H) {
+  O << ",\"" << Key << "\":";
+  if (!isSelected(H.getNode())) {
+    O << "null";
+    return;
+  }
+  O << "{\"node\":\"" << (const void*)H.getNode() << "\",\"offset\":"
+    << H.getOffset() << "}";
+}
+
+void DSGraphStreamWriter::writeDotNode(const DSNode *N) {
+  O << "\t";
+  writeNodeID(N);
+  O << " [shape=Mrecord,label=\"{"
+    << DOT::EscapeString(getCaption(N, G, &ECSizes)) << "}\"];\n";
+
+  for (DSNode::const_edge_iterator I = N->edge_begin(), E = N->edge_end();
+       I != E; ++I)
+    if (isSelected(I->second.getNode())) {
+      O << "\t";
+      writeNodeID(N);
+      O << " -> ";
+      writeNodeID(I->second.getNode());
+      O << " [taillabel=\"" << I->first << "\"";
+      if (I->second.getOffset())
+        O << ",headlabel=\"" << I->second.getOffset() << "\"";
+      O << "];\n";
+    }
+}
+
+void DSGraphStreamWriter::writeJSONNode(const DSNode *N) {
+  O << "{\"kind\":\"node\",\"id\":\"" << (const void*)N << "\",\"size\":"
+    << N->getSize() << ",\"flags\":\"";
+  printNodeFlags(O, N->getNodeFlags());
+  O << "\",\"collapsed\":" << (N->isNodeCompletelyFolded() ? "true" : "false")
+    << ",\"array\":" << (N->isArrayNode() ? "true" : "false") << ",\"types\":{";
+  for (DSNode::const_type_iterator I = N->type_begin(), E = N->type_end();
+       I != E; ++I) {
+    if (I != N->type_begin())
+      O << ",";
+    O << "\"" << I->first << "\":[";
+    if (I->second)
+      for (svset<Type*>::const_iterator TI = I->second->begin(),
+           TE = I->second->end(); TI != TE; ++TI) {
+        std::string TyName;
+        raw_string_ostream TOS(TyName);
+        (*TI)->print(TOS);
+        if (TI != I->second->begin())
+          O << ",";
+        writeJSONString(O, TOS.str());
+      }
+    O << "]";
+  }
+  O << "},\"globals\":[";
+  for (DSNode::globals_iterator I = N->globals_begin(), E = N->globals_end();
+       I != E; ++I) {
+    if (I != N->globals_begin())
+      O << ",";
+    writeValueName(*I, true);
+  }
+  O << "]}\n";
+
+  for (DSNode::const_edge_iterator I = N->edge_begin(), E = N->edge_end();
+       I != E; ++I)
+    if (isSelected(I->second.getNode())) {
+      O << "{\"kind\":\"edge\",\"src\":\"" << (const void*)N
+        << "\",\"offset\":" << I->first;
+      writeJSONHandle("dst", I->second);
+      O << "}\n";
+    }
+}
+
+void DSGraphStreamWriter::writeScalars() {
+  const DSScalarMap &SM = G->getScalarMap();
+  for (DSScalarMap::const_iterator I = SM.begin(), E = SM.end(); I != E; ++I) {
+    if (isa<GlobalValue>(I->first) || !isSelected(I->second.getNode()))
+      continue;
+    if (PrintFormat == ndjson) {
+      O << "{\"kind\":\"scalar\",\"value\":";
+      writeValueName(I->first, true);
+      writeJSONHandle("dst", I->second);
+      O << "}\n";
+    } else {
+      O << "\t";
+      writeNodeID(I->first);
+      O << " [shape=plaintext,label=";
+      writeValueName(I->first, false);
+      O << "];\n";
+      writeDotEdge(I->first, 0, I->second, "arrowtail=tee,color=gray63");
+    }
+  }
+}
+
+void DSGraphStreamWriter::writeReturnNodes() {
+  for (DSGraph::retnodes_iterator I = G->retnodes_begin(),
+       E = G->retnodes_end(); I != E; ++I) {
+    if (!isSelected(I->second.getNode()))
+      continue;
+    if (PrintFormat == ndjson) {
+      O << "{\"kind\":\"return\",\"function\":";
+      writeJSONString(O, I->first->getName());
+      writeJSONHandle("dst", I->second);
+      O << "}\n";
+    } else {
+      O << "\t";
+      writeNodeID(I->first);
+      O << " [shape=circle,label=\""
+        << DOT::EscapeString(I->first->getName().str()) << " ret\"];\n";
+      writeDotEdge(I->first, 0, I->second, "arrowtail=tee,color=gray63");
+    }
+  }
+}
+
+void DSGraphStreamWriter::writeCallSites() {
+  const DSGraph::FunctionListTy &FCs =
+    G->shouldUseAuxCalls() ? G->getAuxFunctionCalls() : G->getFunctionCalls();
+  for (DSGraph::FunctionListTy::const_iterator I = FCs.begin(), E = FCs.end();
+       I != E; ++I) {
+    const DSCallSite &Call = *I;
+
+    // A call site is part of the output if any of its operands is.
+    bool Selected = !isSliced() || isSelected(Call.getRetVal().getNode()) ||
+      (Call.isIndirectCall() && isSelected(Call.getCalleeNode()));
+    for (unsigned j = 0, e = Call.getNumPtrArgs(); !Selected && j != e; ++j)
+      Selected = isSelected(Call.getPtrArg(j).getNode());
+    if (!Selected)
+      continue;
+
+    if (PrintFormat == ndjson) {
+      O << "{\"kind\":\"call\",\"id\":\"" << (const void*)&Call
+        << "\",\"callee\":";
+      if (Call.isDirectCall())
+        writeJSONString(O, Call.getCalleeFunc()->getName());
+      else
+        O << "null";
+      if (Call.isIndirectCall())
+        writeJSONHandle("calleeNode", DSNodeHandle(Call.getCalleeNode()));
+      writeJSONHandle("ret", Call.getRetVal());
+      O << ",\"args\":[";
+      for (unsigned j = 0, e = Call.getNumPtrArgs(); j != e; ++j) {
+        if (j)
+          O << ",";
+        const DSNodeHandle &Arg = Call.getPtrArg(j);
+        if (isSelected(Arg.getNode()))
+          O << "{\"node\":\"" << (const void*)Arg.getNode()
+            << "\",\"offset\":" << Arg.getOffset() << "}";
+        else
+          O << "null";
+      }
+      O << "]}\n";
+      continue;
+    }
+
+    O << "\t";
+    writeNodeID(&Call);
+    O << " [shape=box,label=\"call";
+    if (Call.isDirectCall())
+      O << " " << DOT::EscapeString(Call.getCalleeFunc()->getName().str());
+    O << "\"];\n";
+    if (isSelected(Call.getRetVal().getNode()))
+      writeDotEdge(&Call, "r", Call.getRetVal(), "color=gray63");
+    if (Call.isIndirectCall() && isSelected(Call.getCalleeNode()))
+      writeDotEdge(&Call, "f", DSNodeHandle(Call.getCalleeNode()),
+                   "color=gray63");
+    for (unsigned j = 0, e = Call.getNumPtrArgs(); j != e; ++j)
+      if (isSelected(Call.getPtrArg(j).getNode())) {
+        std::string Label = "a" + utostr(j);
+        writeDotEdge(&Call, Label.c_str(), Call.getPtrArg(j), "color=gray63");
+      }
+  }
+}
+
+void DSGraphStreamWriter::write() {
+  std::string Name = DOTGraphTraits<const DSGraph*>::getGraphName(G);
+  if (PrintFormat == ndjson) {
+    O << "{\"kind\":\"graph\",\"name\":";
+    writeJSONString(O, Name);
+    O << ",\"nodes\":" << G->getGraphSize() << ",\"sliced\":"
+      << (isSliced() ? "true" : "false") << "}\n";
+  } else {
+    O << "digraph \"" << DOT::EscapeString(Name) << "\" {\n"
+      << "\tlabel=\"" << DOT::EscapeString(Name) << "\";\n\n";
+  }
+
+  for (DSGraph::node_const_iterator I = G->node_begin(), E = G->node_end();
+       I != E; ++I)
+    if (isSelected(&*I)) {
+      if (PrintFormat == ndjson)
+        writeJSONNode(&*I);
+      else
+        writeDotNode(&*I);
+    }
+
+  if (!LimitPrint)
+    writeScalars();
+  writeReturnNodes();
+  writeCallSites();
+
+  if (PrintFormat == dot)
+    O << "}\n";
+}
+
 void DSNode::print(llvm::raw_ostream &O, const DSGraph *G) const {
   GraphWriter<const DSGraph *> W(O, G, false);
   W.writeNode(this);
@@ -299,9 +678,13 @@ void DSGraph::print(llvm::raw_ostream &O) const {
   WriteGraph(O, this, "DataStructures");
 }
 
+static const char *getGraphFileExtension() {
+  return PrintFormat == ndjson ? ".ndjson" : ".dot";
+}
+
 void DSGraph::writeGraphToFile(llvm::raw_ostream &O,
                                const std::string &GraphName) const {
-  std::string Filename = GraphName + ".dot";
+  std::string Filename = GraphName + getGraphFileExtension();
   O << "Writing '" << Filename << "'...";
   if (!DontPrintGraphs) {
     std::string Error;
@@ -312,7 +695,7 @@ void DSGraph::writeGraphToFile(llvm::raw_ostream &O,
       return;
     }
 
-    print(F);
+    DSGraphStreamWriter(F, this).write();
   } else {
     O << "(disabled by command-line flag)";
   }
@@ -359,7 +742,7 @@ static void printCollection(const Collection &C, llvm::raw_ostream &O,
         } else {
           IsDuplicateGraph = true; // Don't double count node/call nodes.
           O << "Didn't write '" << Prefix+I->getName().str()
-            << ".dot' - Graph already emitted to '" << Prefix+SCCFn->getName().str()
+            << getGraphFileExtension() << "' - Graph already emitted to '" << Prefix+SCCFn->getName().str()
             << "\n";
         }
       } else {
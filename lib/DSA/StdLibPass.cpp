@@ -157,6 +157,43 @@ const struct {
   {"valloc",    {NRET_NARGS, YRET_NARGS, YRET_NARGS,  NRET_NARGS, false}},
   {"realloc",   {NRET_NARGS, YRET_NARGS, YRET_YNARGS, YRET_YNARGS,false}},
   {"free",      {NRET_NARGS, NRET_NARGS, NRET_YNARGS, NRET_NARGS, false}},
+  {"aligned_alloc",      {NRET_NARGS, YRET_NARGS, YRET_NARGS, NRET_NARGS, false}},
+  {"malloc_usable_size", {NRET_YARGS, NRET_NARGS, NRET_NARGS, NRET_NARGS, false}},
+
+  // C++ operator new and delete.  The size_t argument is mangled as 'j' on
+  // 32-bit targets and 'm' on 64-bit targets.
+  {"_Znwj",     {NRET_NARGS, YRET_NARGS, YRET_NARGS,  NRET_NARGS, false}},
+  {"_Znwm",     {NRET_NARGS, YRET_NARGS, YRET_NARGS,  NRET_NARGS, false}},
+  {"_Znaj",     {NRET_NARGS, YRET_NARGS, YRET_NARGS,  NRET_NARGS, false}},
+  {"_Znam",     {NRET_NARGS, YRET_NARGS, YRET_NARGS,  NRET_NARGS, false}},
+  {"_ZnwjRKSt9nothrow_t",  {NRET_NARGS, YRET_NARGS, YRET_NARGS, NRET_NARGS, false}},
+  {"_ZnwmRKSt9nothrow_t",  {NRET_NARGS, YRET_NARGS, YRET_NARGS, NRET_NARGS, false}},
+  {"_ZnajRKSt9nothrow_t",  {NRET_NARGS, YRET_NARGS, YRET_NARGS, NRET_NARGS, false}},
+  {"_ZnamRKSt9nothrow_t",  {NRET_NARGS, YRET_NARGS, YRET_NARGS, NRET_NARGS, false}},
+  {"_ZnwjSt11align_val_t", {NRET_NARGS, YRET_NARGS, YRET_NARGS, NRET_NARGS, false}},
+  {"_ZnwmSt11align_val_t", {NRET_NARGS, YRET_NARGS, YRET_NARGS, NRET_NARGS, false}},
+  {"_ZnajSt11align_val_t", {NRET_NARGS, YRET_NARGS, YRET_NARGS, NRET_NARGS, false}},
+  {"_ZnamSt11align_val_t", {NRET_NARGS, YRET_NARGS, YRET_NARGS, NRET_NARGS, false}},
+  {"_ZnwjSt11align_val_tRKSt9nothrow_t", {NRET_NARGS, YRET_NARGS, YRET_NARGS, NRET_NARGS, false}},
+  {"_ZnwmSt11align_val_tRKSt9nothrow_t", {NRET_NARGS, YRET_NARGS, YRET_NARGS, NRET_NARGS, false}},
+  {"_ZnajSt11align_val_tRKSt9nothrow_t", {NRET_NARGS, YRET_NARGS, YRET_NARGS, NRET_NARGS, false}},
+  {"_ZnamSt11align_val_tRKSt9nothrow_t", {NRET_NARGS, YRET_NARGS, YRET_NARGS, NRET_NARGS, false}},
+  {"_ZdlPv",    {NRET_NARGS, NRET_NARGS, NRET_YNARGS, NRET_NARGS, false}},
+  {"_ZdaPv",    {NRET_NARGS, NRET_NARGS, NRET_YNARGS, NRET_NARGS, false}},
+  {"_ZdlPvj",   {NRET_NARGS, NRET_NARGS, NRET_YNARGS, NRET_NARGS, false}},
+  {"_ZdlPvm",   {NRET_NARGS, NRET_NARGS, NRET_YNARGS, NRET_NARGS, false}},
+  {"_ZdaPvj",   {NRET_NARGS, NRET_NARGS, NRET_YNARGS, NRET_NARGS, false}},
+  {"_ZdaPvm",   {NRET_NARGS, NRET_NARGS, NRET_YNARGS, NRET_NARGS, false}},
+  {"_ZdlPvRKSt9nothrow_t",   {NRET_NARGS, NRET_NARGS, NRET_YNARGS, NRET_NARGS, false}},
+  {"_ZdaPvRKSt9nothrow_t",   {NRET_NARGS, NRET_NARGS, NRET_YNARGS, NRET_NARGS, false}},
+  {"_ZdlPvSt11align_val_t",  {NRET_NARGS, NRET_NARGS, NRET_YNARGS, NRET_NARGS, false}},
+  {"_ZdaPvSt11align_val_t",  {NRET_NARGS, NRET_NARGS, NRET_YNARGS, NRET_NARGS, false}},
+  {"_ZdlPvjSt11align_val_t", {NRET_NARGS, NRET_NARGS, NRET_YNARGS, NRET_NARGS, false}},
+  {"_ZdlPvmSt11align_val_t", {NRET_NARGS, NRET_NARGS, NRET_YNARGS, NRET_NARGS, false}},
+  {"_ZdaPvjSt11align_val_t", {NRET_NARGS, NRET_NARGS, NRET_YNARGS, NRET_NARGS, false}},
+  {"_ZdaPvmSt11align_val_t", {NRET_NARGS, NRET_NARGS, NRET_YNARGS, NRET_NARGS, false}},
+  {"_ZdlPvSt11align_val_tRKSt9nothrow_t", {NRET_NARGS, NRET_NARGS, NRET_YNARGS, NRET_NARGS, false}},
+  {"_ZdaPvSt11align_val_tRKSt9nothrow_t", {NRET_NARGS, NRET_NARGS, NRET_YNARGS, NRET_NARGS, false}},
  
   {"strdup",    {NRET_YARGS, YRET_NARGS, YRET_NARGS, YRET_YARGS, false}},
   {"__strdup",  {NRET_YARGS, YRET_NARGS, YRET_NARGS, YRET_YARGS, false}},
@@ -370,6 +407,8 @@ const struct {
   {"compareVAArgType",     {NRET_NARGS, NRET_NARGS, NRET_NARGS, NRET_NARGS,   false}},
   {"getTypeTag",        {NRET_NARGS, NRET_NARGS, NRET_NARGS, NRET_NARGS,   false}},
   {"checkType",        {NRET_NARGS, NRET_NARGS, NRET_NARGS, NRET_NARGS,   false}},
+  {"checkTypeRange",   {NRET_NARGS, NRET_NARGS, NRET_NARGS, NRET_NARGS,   false}},
+  {"checkTypeStrided", {NRET_NARGS, NRET_NARGS, NRET_NARGS, NRET_NARGS,   false}},
   {"trackInitInst",        {NRET_NARGS, NRET_NARGS, NRET_NARGS, NRET_NARGS,   false}},
   {"trackUnInitInst",      {NRET_NARGS, NRET_NARGS, NRET_NARGS, NRET_NARGS,   false}},
   {"copyTypeInfo",         {NRET_NARGS, NRET_NARGS, NRET_NARGS, NRET_NARGS,   false}},
@@ -23,8 +23,9 @@ using namespace llvm;
 namespace {
 
   /// PoolAccessTrace - This transformation adds instrumentation to the program
-  /// to print a trace of pairs containing the address of each load and the pool
-  /// descriptor loaded from.
+  /// to record a trace of pairs containing the address of each load and the
+  /// pool descriptor loaded from.  The runtime samples the trace into a binary
+  /// file that the pa-trace tool summarizes.
   class PoolAccessTrace : public ModulePass {
     PoolAllocate *PoolAlloc;
     DataStructures *G;
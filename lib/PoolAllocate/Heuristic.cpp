@@ -16,15 +16,20 @@
 //
 //===----------------------------------------------------------------------===//
 
+#define DEBUG_TYPE "poolalloc"
+
 #include "dsa/DSGraphTraits.h"
 #include "poolalloc/Heuristic.h"
 #include "poolalloc/PoolAllocate.h"
 #include "llvm/Instructions.h"
 #include "llvm/Module.h"
 #include "llvm/ADT/DepthFirstIterator.h"
+#include "llvm/ADT/Statistic.h"
+#include "llvm/Support/CFG.h"
 #include "llvm/Support/CommandLine.h"
 #include "llvm/Support/FormattedStream.h"
 #include "llvm/Target/TargetData.h"
+#include <algorithm>
 #include <iostream>
 
 using namespace llvm;
@@ -34,6 +39,24 @@ namespace {
   cl::opt<bool>
   DisableAlignOpt("poolalloc-disable-alignopt",
                   cl::desc("Force all pool alignment to 8 bytes"));
+
+  cl::opt<unsigned>
+  SmallNodeSize("paheur-costmodel-small-size", cl::init(64),
+                cl::desc("Largest DSNode (in bytes) that may share a pool "
+                         "under the CostModel heuristic"));
+
+  cl::opt<unsigned>
+  SharedPoolBudget("paheur-costmodel-budget", cl::init(512),
+                   cl::desc("Sum of DSNode sizes (in bytes) allowed in one "
+                            "pool under the CostModel heuristic"));
+
+  cl::opt<unsigned>
+  HotNodeUses("paheur-costmodel-hot-uses", cl::init(32),
+              cl::desc("Number of pointer values into a DSNode that makes "
+                       "it hot enough for a pool of its own"));
+
+  STATISTIC (NumCoalescedPools, "Number of pools shared by several DSNodes");
+  STATISTIC (NumCoalescedNodes, "Number of DSNodes placed in shared pools");
 }
 
 //
@@ -604,6 +627,199 @@ SmartCoallesceNodesHeuristic::AssignToPools(const DSNodeList_t &NodesToPA,
   }
 }
 
+//===-- CostModel Heuristic -----------------------------------------------===//
+//
+// This heuristic gives a pool of its own only to the DSNodes that are likely
+// to profit from one, and packs the remaining small DSNodes into shared pools.
+//
+bool
+CostModelHeuristic::runOnModule (Module & Module) {
+  //
+  // Remember which module we are analyzing.
+  //
+  M = &Module;
+
+  //
+  // Get the reference to the DSA Graph.
+  //
+  Graphs = &getAnalysis<EQTDDataStructures>();   
+
+  //
+  // Find DSNodes which are reachable from globals and should be pool
+  // allocated.
+  //
+  findGlobalPoolNodes (GlobalPoolNodes);
+
+  // We never modify anything in this pass
+  return false;
+}
+
+namespace {
+  //
+  // Struct: NodeCost
+  //
+  // Description:
+  //  What the CostModel heuristic knows about one DSNode: the blocks of the
+  //  function being transformed that hold a pointer into it, and the number of
+  //  pointers into it in the whole graph.
+  //
+  struct NodeCost {
+    std::set<const BasicBlock*> UsingBlocks;
+    unsigned NumUses;
+    NodeCost() : NumUses(0) {}
+  };
+}
+
+//
+// Function: ComputeNodeCosts()
+//
+// Description:
+//  Scan the scalar map of the DSGraph and record, for each DSNode, which blocks
+//  of F hold pointers into it and how many pointers into it there are.  The
+//  EQTD graph is shared by several functions, so blocks of other functions
+//  are counted as uses but never mixed into the lifetime of a pool in F.
+//
+static void
+ComputeNodeCosts (const Function *F, DSGraph *G,
+                  std::map<const DSNode*, NodeCost> &Costs) {
+  DSScalarMap &SM = G->getScalarMap();
+  for (DSScalarMap::iterator I = SM.begin(), E = SM.end(); I != E; ++I) {
+    const Instruction *Inst = dyn_cast<Instruction>(I->first);
+    const DSNode *N = I->second.getNode();
+    if (!Inst || !N) continue;
+
+    NodeCost &C = Costs[N];
+    if (Inst->getParent()->getParent() == F)
+      C.UsingBlocks.insert(Inst->getParent());
+    ++C.NumUses;
+  }
+}
+
+//
+// Function: ComputeLiveBlocks()
+//
+// Description:
+//  Compute the blocks in which a pool used by the given blocks is live, in the
+//  same way PoolAllocate::InitializeAndDestroyPool() places poolinit and
+//  pooldestroy: a block is live if it is reachable from a using block and
+//  reaches a using block.  The result holds the layout numbers of the live
+//  blocks, so nodes with equal results get their pools created and destroyed
+//  at the same points.
+//
+static void
+ComputeLiveBlocks (const std::set<const BasicBlock*> &UsingBlocks,
+                   const std::map<const BasicBlock*, unsigned> &BlockNumbers,
+                   std::vector<unsigned> &Live) {
+  std::set<const BasicBlock*> InitializedBefore;
+  std::set<const BasicBlock*> DestroyedAfter;
+  for (std::set<const BasicBlock*>::const_iterator I = UsingBlocks.begin(),
+         E = UsingBlocks.end(); I != E; ++I) {
+    for (df_ext_iterator<const BasicBlock*, std::set<const BasicBlock*> >
+           DI = df_ext_begin(*I, InitializedBefore),
+           DE = df_ext_end(*I, InitializedBefore); DI != DE; ++DI)
+      /* empty */;
+
+    for (idf_ext_iterator<const BasicBlock*, std::set<const BasicBlock*> >
+           DI = idf_ext_begin(*I, DestroyedAfter),
+           DE = idf_ext_end(*I, DestroyedAfter); DI != DE; ++DI)
+      /* empty */;
+  }
+
+  for (std::set<const BasicBlock*>::iterator I = InitializedBefore.begin(),
+         E = InitializedBefore.end(); I != E; ++I)
+    if (DestroyedAfter.count(*I))
+      Live.push_back(BlockNumbers.find(*I)->second);
+  std::sort(Live.begin(), Live.end());
+}
+
+void
+CostModelHeuristic::AssignToPools(const DSNodeList_t &NodesToPA,
+                                  Function *F, DSGraph* G,
+                                  std::vector<OnePool> &ResultPools) {
+  //
+  // Pools of global scope live for the whole program, so every pair of nodes
+  // given to us has matching lifetimes.  This is also true of main(), whose
+  // pools are made global.
+  //
+  bool WholeProgram = (F == 0) ||
+                      (F->getName() == "main" && F->hasExternalLinkage());
+
+  std::map<const DSNode*, NodeCost> Costs;
+  ComputeNodeCosts (F, G, Costs);
+
+  std::map<const BasicBlock*, unsigned> BlockNumbers;
+  if (!WholeProgram) {
+    unsigned Num = 0;
+    for (Function::const_iterator FI = F->begin(), FE = F->end();
+         FI != FE; ++FI)
+      BlockNumbers[FI] = Num++;
+  }
+
+  //
+  // Shared pools still accepting nodes, keyed by the blocks the pool is live
+  // in, object size and alignment.  The value is the index of the pool in
+  // ResultPools.
+  //
+  typedef std::pair<std::vector<unsigned>,
+                    std::pair<unsigned, unsigned> > PoolKey;
+  std::map<PoolKey, unsigned> OpenPools;
+  std::map<unsigned, unsigned> PoolBytes;
+
+  for (unsigned i = 0, e = NodesToPA.size(); i != e; ++i) {
+    const DSNode *N = NodesToPA[i];
+    const NodeCost &C = Costs[N];
+    unsigned Size = getRecommendedSize(N);
+
+    //
+    // Arrays, recursive structures and nodes of unknown size may grow without
+    // bound, and hot nodes gain the most from being kept together; all of
+    // them get a pool of their own.
+    //
+    if (Size == 0 || Size > SmallNodeSize || N->isArrayNode() ||
+        N->isNodeCompletelyFolded() || NodeExistsInCycle(N) ||
+        C.NumUses >= HotNodeUses) {
+      ResultPools.push_back(OnePool(N));
+      continue;
+    }
+
+    //
+    // Round the size up to the alignment so that nodes whose objects take the
+    // same space in a slab can share a pool without losing the fixed-size
+    // allocation path of the run-time.
+    //
+    unsigned Align = getRecommendedAlignment(N);
+    Size = (Size + Align - 1) & ~(Align - 1);
+
+    PoolKey Key;
+    if (!WholeProgram)
+      ComputeLiveBlocks (C.UsingBlocks, BlockNumbers, Key.first);
+    Key.second = std::make_pair(Size, Align);
+
+    std::map<PoolKey, unsigned>::iterator PI = OpenPools.find(Key);
+    if (PI != OpenPools.end() &&
+        PoolBytes[PI->second] + Size <= SharedPoolBudget) {
+      OnePool &Pool = ResultPools[PI->second];
+      if (Pool.NodesInPool.size() == 1) {
+        ++NumCoalescedPools;
+        ++NumCoalescedNodes;
+      }
+      Pool.NodesInPool.push_back(N);
+      PoolBytes[PI->second] += Size;
+      ++NumCoalescedNodes;
+      continue;
+    }
+
+    //
+    // Start a new pool that later nodes with the same key may join.
+    //
+    OpenPools[Key] = ResultPools.size();
+    PoolBytes[ResultPools.size()] = Size;
+    ResultPools.push_back(OnePool(N));
+    ResultPools.back().PoolSize = Size;
+    ResultPools.back().PoolAlignment = Align;
+  }
+}
+
 #if 0
 /// NodeIsSelfRecursive - Return true if this node contains a pointer to itself.
 static bool NodeIsSelfRecursive(DSNode *N) {
@@ -875,6 +1091,7 @@ OnlyOverheadHeuristic::HackFunctionBody(Function &F,
     for (unsigned i = 0, e = OldPDUsers.size(); i != e; ++i) {
       CallSite PDUser(cast<Instruction>(OldPDUsers[i]));
       if (PDUser.getCalledValue() != PoolInit &&
+          PDUser.getCalledValue() != PA->PoolInitLazy &&
           PDUser.getCalledValue() != PoolDestroy) {
         assert(PDUser.getInstruction()->getParent()->getParent() == &F &&
                "Not in cur fn??");
@@ -912,6 +1129,9 @@ C ("paheur-CyclicNodes", "Pool allocate nodes with cycles");
 static RegisterPass<SmartCoallesceNodesHeuristic>
 D ("paheur-SmartCoallesceNodes", "Pool allocate using the smart node merging heuristic ");
 
+static RegisterPass<CostModelHeuristic>
+H ("paheur-CostModel", "Pool allocate using a pool count/locality cost model");
+
 static RegisterPass<AllInOneGlobalPoolHeuristic>
 E ("paheur-AllInOneGlobalPool", "Pool allocate using the pool library to replace malloc/free");
 
@@ -933,11 +1153,13 @@ RegisterAnalysisGroup<Heuristic> Heuristic4(D);
 RegisterAnalysisGroup<Heuristic> Heuristic5(E);
 RegisterAnalysisGroup<Heuristic> Heuristic6(F);
 RegisterAnalysisGroup<Heuristic, true> Heuristic7(G);
+RegisterAnalysisGroup<Heuristic> Heuristic8(H);
 
 char Heuristic::ID = 0;
 char AllButUnreachableFromMemoryHeuristic::ID = 0;
 char CyclicNodesHeuristic::ID = 0;
 char SmartCoallesceNodesHeuristic::ID = 0;
+char CostModelHeuristic::ID = 0;
 char AllInOneGlobalPoolHeuristic::ID = 0;
 char OnlyOverheadHeuristic::ID = 0;
 char NoNodesHeuristic::ID = 0;
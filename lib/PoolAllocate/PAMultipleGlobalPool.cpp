@@ -44,6 +44,9 @@ using namespace PA;
 
 char llvm::PoolAllocateMultipleGlobalPool::ID = 0;
 
+// Defined in PASimple.cpp.
+extern cl::opt<bool> ShardGlobalPools;
+
 namespace {
   RegisterPass<PoolAllocateMultipleGlobalPool>
   X("poolalloc-multi-global-pool", "Pool allocate objects into multiple global pools");
@@ -411,7 +414,8 @@ PoolAllocateMultipleGlobalPool::generatePool(unsigned RecSize,
     Value *AlignV = ConstantInt::get(Int32Type, Align);
     Value* Opts[3] = {GV, ElSize, AlignV};
     
-    CallInst::Create(PoolInit, Opts, "", InsertAtEnd);
+    Constant *InitFn = ShardGlobalPools ? PoolInitSharded : PoolInit;
+    CallInst::Create(InitFn, Opts, "", InsertAtEnd);
     PoolMap[Node] = GV;
   }
 }
@@ -48,6 +48,12 @@ namespace {
   RegisterAnalysisGroup<PoolAllocateGroup, true> PAGroup1(X);
 }
 
+// Also used by PoolAllocateMultipleGlobalPool.
+cl::opt<bool>
+ShardGlobalPools("poolalloc-sharded-global-pools",
+                 cl::desc("Give each thread its own shard of the global pools "
+                          "created by -poolalloc-simple"));
+
 static inline Value *
 castTo (Value * V, Type * Ty, std::string Name, Instruction * InsertPt) {
   //
@@ -505,14 +511,16 @@ PoolAllocateSimple::CreateGlobalPool (unsigned RecSize,
 
   //
   // Get the global pool constructor. Create and insert the poolinit call
-  // inside it.
+  // inside it.  A sharded pool hands each thread a private shard, so threads
+  // only synchronize when freeing each other's objects.
   //
   Function *InitFunc = createGlobalPoolCtor(M);
   Value *ElSize = ConstantInt::get(Int32Type, RecSize);
   Value *AlignV = ConstantInt::get(Int32Type, Align);
   Value *Opts[3] = { GV, ElSize, AlignV };
 
-  CallInst *InitCall = CallInst::Create(PoolInit, Opts, "");
+  Constant *InitFn = ShardGlobalPools ? PoolInitSharded : PoolInit;
+  CallInst *InitCall = CallInst::Create(InitFn, Opts, "");
   InitCall->insertBefore(&InitFunc->getEntryBlock().front());
 
   return GV;
@@ -58,11 +58,18 @@ namespace {
   cl::opt<bool>
   ADLFix("adl-pc",
          cl::desc("Enable Andrew's fixes/hacks"));
+  cl::opt<unsigned>
+  CloneBudget("pointercompress-clone-budget", cl::init(0),
+              cl::desc("Stop compressing new pools once this many functions "
+                       "have been cloned (0 = no limit)"));
   
 
   STATISTIC (NumCompressed, "Number of pools pointer compressed");
   STATISTIC (NumNotCompressed, "Number of pools not compressible");
   STATISTIC (NumCloned    , "Number of functions cloned");
+  STATISTIC (NumCloneReuse, "Number of calls sharing an existing clone");
+  STATISTIC (NumClonedInsts, "Number of instructions in cloned functions");
+  STATISTIC (NumOverBudget, "Number of pools not compressed due to clone budget");
 
   class CompressedPoolInfo;
 
@@ -107,6 +114,10 @@ namespace {
     typedef std::pair<Function*, std::set<const DSNode*> > CloneID;
     std::map<CloneID, Function *> ClonedFunctionMap;
 
+    /// NumClones - The number of function bodies cloned so far, checked
+    /// against -pointercompress-clone-budget.
+    unsigned NumClones;
+
     std::map<std::pair<Function*, std::vector<unsigned> >,
              Function*> ExtCloneFunctionMap;
 
@@ -124,7 +135,7 @@ namespace {
     typedef std::map<const DSNode*, CompressedPoolInfo> PoolInfoMap;
     static char ID;
 
-    PointerCompress() : ModulePass(ID) {}
+    PointerCompress() : ModulePass(ID), NumClones(0) {}
     /// NoArgFunctionsCalled - When we are walking the call graph, keep track of
     /// which functions are called that don't need their prototype to be
     /// changed.
@@ -930,8 +941,14 @@ void InstructionRewriter::visitPoolAlloc(CallInst &CI) {
 
 void InstructionRewriter::visitCallInst(CallInst &CI) {
   if (Function *F = CI.getCalledFunction()) {
-    // These functions are handled specially.
-    if (F->getName() == "poolinit") {
+    // These functions are handled specially.  A compressed pool is set up by
+    // poolinit_pc whichever flavor of poolinit PoolAllocate chose for it.
+    // The compressed runtime sizes its pools itself, so capacity hints are
+    // dropped, and it needs a single base, so sharded pools stop sharding.
+    if (F->getName() == "poolinit" || F->getName() == "poolinit_lazy" ||
+        F->getName() == "poolinit_hint" ||
+        F->getName() == "poolinit_lazy_hint" ||
+        F->getName() == "poolinit_sharded") {
       visitPoolInit(CI);
       return;
     } else if (F->getName() == "pooldestroy") {
@@ -1203,7 +1220,13 @@ void PointerCompress::FindPoolsToCompress(std::set<const DSNode*> &Pools,
     // Ignore potential pools that the pool allocation heuristic decided not to
     // pool allocated.
     if (!isa<ConstantPointerNull>(FI->PoolDescriptors[N])) {
-      if (PoolIsCompressible(N)) {
+      if (CloneBudget && NumClones >= CloneBudget) {
+        // Compressing another pool could require more clones.  Pools that are
+        // already compressed still get the clones they need, so this is only
+        // a soft limit.
+        DEBUG(errs() << "PCF over clone budget: "; N->dump());
+        ++NumOverBudget;
+      } else if (PoolIsCompressible(N)) {
         Pools.insert(N);
         ++NumCompressed;
       } else {
@@ -1372,19 +1395,50 @@ GetExtFunctionClone(Function *F, const std::vector<unsigned> &ArgsToComp) {
   return Clone;
 }
 
+/// getCloneSignature - Reduce the set of callee pools to compress for a call to
+/// the part that changes the clone: the pools passed in as pool arguments and
+/// the pools of pointer arguments and the return value.  Compressed global
+/// pools are found by FindPoolsToCompress on its own, so calls that only
+/// differ in those share one clone.
+static std::set<const DSNode*>
+getCloneSignature(const std::set<const DSNode*> &PoolsToCompress,
+                  PA::FuncInfo &FI, const DSGraph &CG) {
+  std::set<const DSNode*> Sig;
+  for (unsigned i = 0, e = FI.ArgNodes.size(); i != e; ++i)
+    if (PoolsToCompress.count(FI.ArgNodes[i]))
+      Sig.insert(FI.ArgNodes[i]);
+
+  const DSNode *RetN = CG.getReturnNodeFor(FI.F).getNode();
+  if (isa<PointerType>(FI.F.getReturnType()) && PoolsToCompress.count(RetN))
+    Sig.insert(RetN);
+  for (Function::arg_iterator AI = FI.F.arg_begin(), E = FI.F.arg_end();
+       AI != E; ++AI)
+    if (isa<PointerType>(AI->getType())) {
+      const DSNode *N = CG.getNodeForValue(AI).getNode();
+      if (PoolsToCompress.count(N))
+        Sig.insert(N);
+    }
+  return Sig;
+}
+
 /// GetFunctionClone - Lazily create clones of pool allocated functions that we
 /// need in compressed form.  This memoizes the functions that have been cloned
 /// to allow only one clone of each function in a desired permutation.
 Function *PointerCompress::
-GetFunctionClone(Function *F, std::set<const DSNode*> &PoolsToCompress,
+GetFunctionClone(Function *F, std::set<const DSNode*> &CallPools,
                  PA::FuncInfo &FI, const DSGraph &CG) {
-  assert(!PoolsToCompress.empty() && "No clone needed!");
+  assert(!CallPools.empty() && "No clone needed!");
+  std::set<const DSNode*> PoolsToCompress =
+    getCloneSignature(CallPools, FI, CG);
 
   // Check to see if we have already compressed this function, if so, there is
   // no need to make another clone.  This is also important to avoid infinite
   // recursion.
   Function *&Clone = ClonedFunctionMap[std::make_pair(F, PoolsToCompress)];
-  if (Clone) return Clone;
+  if (Clone) {
+    ++NumCloneReuse;
+    return Clone;
+  }
 
   // First step, construct the new function prototype.
   FunctionType *FTy = F->getFunctionType();
@@ -1461,6 +1515,9 @@ GetFunctionClone(Function *F, std::set<const DSNode*> &PoolsToCompress,
   // TODO: Should the 'ModuleLevelChanges' flag be true or false here?
   CloneFunctionInto(Clone, F, ValueMap, true, Returns);
   Returns.clear();  // Don't need this.
+  ++NumClones;
+  for (Function::iterator BB = Clone->begin(), E = Clone->end(); BB != E; ++BB)
+    NumClonedInsts += BB->size();
   
   // Invert the ValueMap into the NewToOldValueMap
   std::map<Value*, const Value*> &NewToOldValueMap = CFI.NewToOldValueMap;
@@ -1514,7 +1571,8 @@ void PointerCompress::HandleGlobalPools(Module &M) {
 /// compress runtime library functions.
 void PointerCompress::InitializePoolLibraryFunctions(Module &M) {
   Type *VoidPtrTy = PointerType::getUnqual(Int8Type);
-  Type *PoolDescPtrTy = PointerType::getUnqual(ArrayType::get(VoidPtrTy, 16));
+  Type *PoolDescPtrTy =
+    PointerType::getUnqual(PoolAlloc->getPoolType(&M.getContext()));
 
   PoolInitPC = M.getOrInsertFunction("poolinit_pc", VoidPtrTy, PoolDescPtrTy, 
                                      Int32Type, Int32Type, NULL);
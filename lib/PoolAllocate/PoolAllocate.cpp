@@ -27,6 +27,7 @@
 #include "llvm/Module.h"
 #include "llvm/Constants.h"
 #include "llvm/Attributes.h"
+#include "llvm/Analysis/LoopInfo.h"
 #include "llvm/Support/CFG.h"
 #include "llvm/Target/TargetData.h"
 #include "llvm/Transforms/Utils/BasicBlockUtils.h"
@@ -63,10 +64,13 @@ namespace {
   STATISTIC (NumArgsAdded, "Number of function arguments added");
   STATISTIC (MaxArgsAdded, "Maximum function arguments added to one function");
   STATISTIC (NumCloned   , "Number of functions cloned");
+  STATISTIC (NumClonedInsts, "Number of instructions in function clones");
+  STATISTIC (NumDupInsts , "Number of cloned instructions whose original is kept");
   STATISTIC (NumPools    , "Number of pools allocated");
   STATISTIC (NumTSPools  , "Number of typesafe pools");
   STATISTIC (NumPoolFree , "Number of poolfree's elided");
   STATISTIC (NumNonprofit, "Number of DSNodes not profitable");
+  STATISTIC (NumSizeHints, "Number of pools initialized with a size hint");
   //  STATISTIC (NumColocated, "Number of DSNodes colocated");
 
   Type *VoidPtrTy;
@@ -80,6 +84,17 @@ namespace {
   cl::opt<bool>
   DisablePoolFreeOpt("poolalloc-force-all-poolfrees",
                      cl::desc("Do not try to elide poolfree's where possible"));
+  cl::opt<bool>
+  EnableLazyInit("poolalloc-lazy-init",
+                 cl::desc("Defer pool initialization to the first allocation"));
+  cl::opt<bool>
+  EnableCapacityHints("poolalloc-capacity-hints",
+                      cl::desc("Pass expected pool sizes to poolinit_hint"));
+
+  // Don't bother the runtime with hints smaller than its first slab, and don't
+  // let a bad trip count estimate reserve absurd amounts of memory.
+  const uint64_t MinCapacityHint = 4096;
+  const uint64_t MaxCapacityHint = 1ULL << 26;
 
 }
 
@@ -220,6 +235,9 @@ void PoolAllocate::getAnalysisUsage(AnalysisUsage &AU) const {
     AU.setPreservesAll();
 
   AU.addRequired<TargetData>();
+
+  if (EnableCapacityHints)
+    AU.addRequired<LoopInfo>();
 }
 
 bool PoolAllocate::runOnModule(Module &M) {
@@ -418,6 +436,9 @@ bool PoolAllocate::runOnModule(Module &M) {
   //
   createPoolAllocInit (M);
 
+  if (EnableCapacityHints)
+    AddCapacityHints(M);
+
   //
   // FIXME: Make name more descriptive and explain, in a comment here, what this
   //        code is trying to do (namely, avoid optimizations for performance
@@ -455,6 +476,16 @@ void PoolAllocate::AddPoolPrototypes(Module* M) {
                                             PoolDescPtrTy, Int32Type,
                                             Int32Type, NULL);
 
+  // Get poolinit_lazy function.
+  PoolInitLazy = M->getOrInsertFunction("poolinit_lazy", VoidType,
+                                        PoolDescPtrTy, Int32Type,
+                                        Int32Type, NULL);
+
+  // Get poolinit_sharded function.
+  PoolInitSharded = M->getOrInsertFunction("poolinit_sharded", VoidType,
+                                           PoolDescPtrTy, Int32Type,
+                                           Int32Type, NULL);
+
   // Get pooldestroy function.
   PoolDestroy = M->getOrInsertFunction("pooldestroy", VoidType,
                                                PoolDescPtrTy, NULL);
@@ -488,6 +519,13 @@ void PoolAllocate::AddPoolPrototypes(Module* M) {
   // Get the poolfree function.
   PoolFree = M->getOrInsertFunction("poolfree", VoidType,
                                             PoolDescPtrTy, VoidPtrTy, NULL);
+  // The sized poolfree function, for C++ sized deallocation.
+  PoolFreeSized = M->getOrInsertFunction("poolfree_sized", VoidType,
+                                         PoolDescPtrTy, VoidPtrTy, Int32Type,
+                                         NULL);
+  // The poolobjsize function, for malloc_usable_size.
+  PoolObjSize = M->getOrInsertFunction("poolobjsize", Int32Type,
+                                       PoolDescPtrTy, VoidPtrTy, NULL);
   //Get the poolregister function
   PoolRegister = M->getOrInsertFunction("poolregister", VoidType,
                                  PoolDescPtrTy, VoidPtrTy, Int32Type, NULL);
@@ -978,6 +1016,18 @@ PoolAllocate::MakeFunctionClone (Function & F) {
   // TODO: Evalute the boolean parameter here...
   CloneFunctionInto(New, &F, ValueMap, true, Returns);
 
+  //
+  // Track code growth.  The original of an internal function becomes dead once
+  // its uses are replaced by the clone, but an externally visible original is
+  // kept, so its body ends up in the program twice.
+  //
+  unsigned NumInsts = 0;
+  for (Function::iterator BB = New->begin(), E = New->end(); BB != E; ++BB)
+    NumInsts += BB->size();
+  NumClonedInsts += NumInsts;
+  if (!F.hasLocalLinkage())
+    NumDupInsts += NumInsts;
+
   //
   // Invert the ValueMap into the NewToOldValueMap.
   //
@@ -1338,7 +1388,8 @@ void PoolAllocate::CalculateLivePoolFreeBlocks(std::set<BasicBlock*>&LiveBlocks,
     }
 
     CallSite U = CallSite(I->stripPointerCasts());
-    if (U.getCalledValue() != PoolFree && U.getCalledValue() != PoolDestroy) {
+    if (U.getCalledValue() != PoolFree && U.getCalledValue() != PoolFreeSized &&
+        U.getCalledValue() != PoolDestroy) {
       // This block and every block that can reach this block must keep pool
       // frees.
       for (idf_ext_iterator<BasicBlock*, std::set<BasicBlock*> >
@@ -1510,9 +1561,13 @@ void PoolAllocate::InitializeAndDestroyPool(Function &F, const DSNode *Node,
   unsigned AlignV = Heuristic::getRecommendedAlignment(Node);
   Value *Align  = ConstantInt::get(Int32Type, AlignV);
 
+  // With lazy initialization the init points only record the pool's
+  // parameters; the runtime sets the pool up on its first allocation, so
+  // paths through the live range that never allocate stay cheap.
+  Constant *InitFn = EnableLazyInit ? PoolInitLazy : PoolInit;
   for (unsigned i = 0, e = PoolInitPoints.size(); i != e; ++i) {
     Value* Opts[3] = {PD, ElSize, Align};
-    CallInst::Create(PoolInit, Opts,  "", PoolInitPoints[i]);
+    CallInst::Create(InitFn, Opts,  "", PoolInitPoints[i]);
     DEBUG(errs() << PoolInitPoints[i]->getParent()->getName().str() << " ");
   }
 
@@ -1546,6 +1601,133 @@ void PoolAllocate::InitializeAndDestroyPool(Function &F, const DSNode *Node,
 }
 
 
+//
+// Method: getExpectedPoolBytes()
+//
+// Description:
+//  Estimate the number of bytes that the program will allocate from the pool
+//  described by PD.  Every poolalloc(), poolcalloc() and poolmemalign() call
+//  on PD with a constant size contributes its size, scaled by the constant
+//  trip counts of the loops that enclose it.  Pools passed on to other
+//  functions are followed into the callee, up to a small depth.  Allocations
+//  of unknown size and loops with unknown trip counts contribute nothing
+//  beyond what is known, so the result is a lower bound rather than a guess.
+//
+uint64_t PoolAllocate::getExpectedPoolBytes(Value *PD, unsigned Depth) {
+  uint64_t Total = 0;
+  for (Value::use_iterator UI = PD->use_begin(), E = PD->use_end();
+       UI != E; ++UI) {
+    CallSite CS(*UI);
+    if (!CS.getInstruction() || CS.arg_size() == 0)
+      continue;
+
+    Value *Callee = CS.getCalledValue();
+    uint64_t Bytes = 0;
+    if (Callee == PoolAlloc) {
+      if (ConstantInt *C = dyn_cast<ConstantInt>(CS.getArgument(1)))
+        Bytes = C->getZExtValue();
+    } else if (Callee == PoolCalloc) {
+      ConstantInt *Size = dyn_cast<ConstantInt>(CS.getArgument(1));
+      ConstantInt *Num  = dyn_cast<ConstantInt>(CS.getArgument(2));
+      if (Size && Num)
+        Bytes = Size->getZExtValue() * Num->getZExtValue();
+    } else if (Callee == PoolMemAlign) {
+      if (ConstantInt *C = dyn_cast<ConstantInt>(CS.getArgument(2)))
+        Bytes = C->getZExtValue();
+    } else if (Function *F = CS.getCalledFunction()) {
+      // The pool is passed on to a function that was given pool arguments.
+      if (F->isDeclaration() || Depth >= 4) continue;
+      Function::arg_iterator AI = F->arg_begin();
+      for (unsigned i = 0, e = CS.arg_size(); i != e && AI != F->arg_end();
+           ++i, ++AI)
+        if (CS.getArgument(i) == PD) {
+          Bytes = getExpectedPoolBytes(AI, Depth + 1);
+          break;
+        }
+    }
+    if (Bytes == 0) continue;
+
+    Bytes = std::min(Bytes, MaxCapacityHint) *
+            getBlockTripCount(CS.getInstruction()->getParent());
+    Total += std::min(Bytes, MaxCapacityHint);
+    if (Total >= MaxCapacityHint)
+      return MaxCapacityHint;
+  }
+  return Total;
+}
+
+//
+// Method: getBlockTripCount()
+//
+// Description:
+//  Return the product of the constant trip counts of the loops around BB,
+//  capped at MaxCapacityHint.  LoopInfo is computed once per function, and
+//  the counts for all of its blocks are read out of it right away: asking
+//  for the LoopInfo of another function reuses the same analysis object.
+//
+uint64_t PoolAllocate::getBlockTripCount(BasicBlock *BB) {
+  Function *F = BB->getParent();
+  if (TripCountsComputed.insert(F).second) {
+    LoopInfo &LI = getAnalysis<LoopInfo>(*F);
+    for (Function::iterator I = F->begin(), E = F->end(); I != E; ++I) {
+      uint64_t Trips = 1;
+      for (Loop *L = LI.getLoopFor(I); L; L = L->getParentLoop())
+        if (unsigned N = L->getSmallConstantTripCount())
+          Trips = std::min(Trips * N, MaxCapacityHint);
+      if (Trips != 1)
+        BlockTripCounts[I] = Trips;
+    }
+  }
+
+  std::map<const BasicBlock*, uint64_t>::iterator I = BlockTripCounts.find(BB);
+  return I == BlockTripCounts.end() ? 1 : I->second;
+}
+
+//
+// Method: AddCapacityHints()
+//
+// Description:
+//  Rewrite each poolinit() call whose pool has a worthwhile expected size
+//  into a call to poolinit_hint(), which takes that size as an extra
+//  argument, and each poolinit_lazy() call into poolinit_lazy_hint().  This
+//  runs after all function bodies have been transformed, so that every
+//  allocation from a pool is visible as a use of its descriptor.
+//
+void PoolAllocate::AddCapacityHints(Module &M) {
+  Constant *PoolInitHint =
+    M.getOrInsertFunction("poolinit_hint", VoidType, PoolDescPtrTy,
+                          Int32Type, Int32Type, Int32Type, NULL);
+  Constant *PoolInitLazyHint =
+    M.getOrInsertFunction("poolinit_lazy_hint", VoidType, PoolDescPtrTy,
+                          Int32Type, Int32Type, Int32Type, NULL);
+
+  std::vector<CallInst*> Inits;
+  Constant *InitFns[2] = {PoolInit, PoolInitLazy};
+  for (unsigned i = 0; i != 2; ++i)
+    for (Value::use_iterator UI = InitFns[i]->use_begin(),
+         E = InitFns[i]->use_end(); UI != E; ++UI)
+      if (CallInst *CI = dyn_cast<CallInst>(*UI))
+        if (CI->getCalledValue() == InitFns[i])
+          Inits.push_back(CI);
+
+  for (unsigned i = 0, e = Inits.size(); i != e; ++i) {
+    CallInst *CI = Inits[i];
+    uint64_t Hint = getExpectedPoolBytes(CI->getArgOperand(0));
+    if (Hint < MinCapacityHint) continue;
+
+    Constant *HintFn =
+      CI->getCalledValue() == PoolInitLazy ? PoolInitLazyHint : PoolInitHint;
+    Value *Opts[4] = {CI->getArgOperand(0), CI->getArgOperand(1),
+                      CI->getArgOperand(2), ConstantInt::get(Int32Type, Hint)};
+    CallInst::Create(HintFn, Opts, "", CI);
+    CI->eraseFromParent();
+    ++NumSizeHints;
+  }
+
+  BlockTripCounts.clear();
+  TripCountsComputed.clear();
+}
+
 /// InitializeAndDestroyPools - This inserts calls to poolinit and pooldestroy
 /// into the function to initialize and destroy the pools in the NodesToPA list.
 ///
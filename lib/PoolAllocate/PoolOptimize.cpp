@@ -70,17 +70,40 @@ bool PoolOptimize::runOnModule(Module &M) {
   // Create LLVM types used by the pool allocation passes.
   //
   Type *VoidPtrTy = PointerType::getUnqual(Int8Type);
+  // These must match PoolAllocate::getPoolType.
   Type *PoolDescPtrTy;
   if (SAFECodeEnabled)
     PoolDescPtrTy = PointerType::getUnqual(ArrayType::get(VoidPtrTy, 92));
   else
-    PoolDescPtrTy = PointerType::getUnqual(ArrayType::get(VoidPtrTy, 16));
+    PoolDescPtrTy = PointerType::getUnqual(ArrayType::get(VoidPtrTy, 18));
 
   // Get poolinit function.
   Constant *PoolInit = M.getOrInsertFunction("poolinit", VoidType,
                                              PoolDescPtrTy, Int32Type,
                                              Int32Type, NULL);
 
+  // Get poolinit_lazy function, used instead of poolinit by
+  // -poolalloc-lazy-init.
+  Constant *PoolInitLazy = M.getOrInsertFunction("poolinit_lazy", VoidType,
+                                                 PoolDescPtrTy, Int32Type,
+                                                 Int32Type, NULL);
+
+  // Get the poolinit_hint and poolinit_lazy_hint functions, which
+  // -poolalloc-capacity-hints substitutes for the two above.
+  Constant *PoolInitHint = M.getOrInsertFunction("poolinit_hint", VoidType,
+                                                 PoolDescPtrTy, Int32Type,
+                                                 Int32Type, Int32Type, NULL);
+  Constant *PoolInitLazyHint =
+    M.getOrInsertFunction("poolinit_lazy_hint", VoidType, PoolDescPtrTy,
+                          Int32Type, Int32Type, Int32Type, NULL);
+
+  // Get poolinit_sharded function, used for global pools by
+  // -poolalloc-sharded-global-pools.
+  Constant *PoolInitSharded = M.getOrInsertFunction("poolinit_sharded",
+                                                    VoidType, PoolDescPtrTy,
+                                                    Int32Type, Int32Type,
+                                                    NULL);
+
   // Get pooldestroy function.
   Constant *PoolDestroy = M.getOrInsertFunction("pooldestroy", VoidType,
                                                 PoolDescPtrTy, NULL);
@@ -206,22 +229,29 @@ bool PoolOptimize::runOnModule(Module &M) {
   // Transform pools that only have poolinit/destroy/allocate uses into
   // bump-pointer pools.  Also, delete pools that are unused.  Find pools by
   // looking for pool inits in the program.
-  getCallsOf(PoolInit, Calls);
+  // Sharded pools are only deleted when unused: a bump pointer pool would
+  // put every thread back behind one lock.
+  Constant *InitFns[5] = {PoolInit, PoolInitLazy, PoolInitHint,
+                          PoolInitLazyHint, PoolInitSharded};
+  std::set<Value*> InitFnSet(InitFns, InitFns+5);
   std::set<Value*> Pools;
-  for (unsigned i = 0, e = Calls.size(); i != e; ++i)
-    Pools.insert(Calls[i]->getOperand(1));
+  for (unsigned f = 0; f != 5; ++f) {
+    getCallsOf(InitFns[f], Calls);
+    for (unsigned i = 0, e = Calls.size(); i != e; ++i)
+      Pools.insert(Calls[i]->getOperand(1));
+  }
 
   // Loop over all of the pools processing each as we find it.
   for (std::set<Value*>::iterator PI = Pools.begin(), E = Pools.end();
        PI != E; ++PI) {
-    bool HasPoolAlloc = false, HasOtherUse = false;
+    bool HasPoolAlloc = false, HasOtherUse = false, IsSharded = false;
     Value *PoolDesc = *PI;
     for (Value::use_iterator UI = PoolDesc->use_begin(),
            E = PoolDesc->use_end(); UI != E; ++UI) {
       if (CallInst *CI = dyn_cast<CallInst>(*UI)) {
-        if (CI->getCalledFunction() == PoolInit ||
+        if (InitFnSet.count(CI->getCalledFunction()) ||
             CI->getCalledFunction() == PoolDestroy) {
-          // ignore
+          IsSharded |= CI->getCalledFunction() == PoolInitSharded;
         } else if (CI->getCalledFunction() == PoolAlloc) {
           HasPoolAlloc = true;
         } else {
@@ -235,7 +265,7 @@ bool PoolOptimize::runOnModule(Module &M) {
     }
 
     // Can we optimize it?
-    if (!HasOtherUse) {
+    if (!HasOtherUse && !(IsSharded && HasPoolAlloc)) {
       // Yes, if there are uses at all, nuke the pool init, destroy, and the PD.
       if (!HasPoolAlloc) {
         while (!PoolDesc->use_empty())
@@ -257,9 +287,13 @@ bool PoolOptimize::runOnModule(Module &M) {
             Value *New = CallInst::Create(PoolAllocBP, Args, CI->getName(), CI);
             CI->replaceAllUsesWith(New);
             CI->eraseFromParent();
-          } else if (CI->getCalledFunction() == PoolInit) {
+          } else if (InitFnSet.count(CI->getCalledFunction())) {
+            // A bump pointer pool is cheap enough to set up that lazy
+            // initialization buys nothing, so every flavor maps to
+            // poolinit_bp.
             Args.assign(CI->op_begin()+1, CI->op_end());
             Args.erase(Args.begin()+1); // Drop the size argument.
+            Args.resize(2);             // And any capacity hint.
             CallInst::Create(PoolInitBP, Args, "", CI);
             CI->eraseFromParent();
           } else {
@@ -51,6 +51,17 @@ namespace {
     // inserted into the code.  This is seperated out from PoolUses.
     std::multimap<AllocaInst*, CallInst*> &PoolFrees;
 
+    // ThrowingNews - The calls to a throwing operator new that were replaced
+    // by a pool allocation, together with the poolalloc call and its cast.
+    // The original call is kept and becomes the fallback for a failed pool
+    // allocation once the whole function has been visited.
+    struct PendingNew {
+      Instruction *New, *PoolAlloc, *Casted;
+      PendingNew(Instruction *N, Instruction *PA, Instruction *C)
+        : New(N), PoolAlloc(PA), Casted(C) {}
+    };
+    std::vector<PendingNew> ThrowingNews;
+
     FuncTransform(PoolAllocate &P, DSGraph* g, FuncInfo &fi,
                   std::multimap<AllocaInst*, Instruction*> &poolUses,
                   std::multimap<AllocaInst*, CallInst*> &poolFrees)
@@ -73,7 +84,8 @@ namespace {
     void visitMemAlignCall(CallSite CS);
     void visitStrdupCall(CallSite CS);
     void visitRuntimeCheck(CallSite CS, const unsigned PoolArgc);
-    void visitFreeCall(CallSite &CS);
+    void visitFreeCall(CallSite &CS, bool Sized = false);
+    void visitUsableSizeCall(CallSite &CS);
     void visitCallSite(CallSite &CS);
     void visitCallInst(CallInst &CI) {
       CallSite CS(&CI);
@@ -86,9 +98,12 @@ namespace {
     void visitLoadInst(LoadInst &I);
     void visitStoreInst (StoreInst &I);
 
+    void InsertBadAllocFallbacks();
+
   private:
     Instruction *TransformAllocationInstr(Instruction *I, Value *Size);
-    Instruction *InsertPoolFreeInstr(Value *V, Instruction *Where);
+    Instruction *InsertPoolFreeInstr(Value *V, Instruction *Where,
+                                     Value *Size = 0);
 
     //
     // Method: UpdateNewToOldValueMap()
@@ -159,12 +174,126 @@ castTo (Value * V, Type * Ty, std::string Name, Instruction * InsertPt) {
   return CastInst::CreateZExtOrBitCast (V, Ty, Name, InsertPt);
 }
 
+//
+// The C++ allocation and deallocation functions, as mangled by the Itanium
+// ABI.  The size_t parameter is mangled as 'j' on 32-bit targets and as 'm'
+// on 64-bit targets.
+//
+static bool isOperatorNew (const std::string & Name) {
+  return Name == "_Znwj" || Name == "_Znwm" ||
+         Name == "_Znaj" || Name == "_Znam" ||
+         Name == "_ZnwjRKSt9nothrow_t" || Name == "_ZnwmRKSt9nothrow_t" ||
+         Name == "_ZnajRKSt9nothrow_t" || Name == "_ZnamRKSt9nothrow_t";
+}
+
+static bool isAlignedOperatorNew (const std::string & Name) {
+  return Name == "_ZnwjSt11align_val_t" || Name == "_ZnwmSt11align_val_t" ||
+         Name == "_ZnajSt11align_val_t" || Name == "_ZnamSt11align_val_t" ||
+         Name == "_ZnwjSt11align_val_tRKSt9nothrow_t" ||
+         Name == "_ZnwmSt11align_val_tRKSt9nothrow_t" ||
+         Name == "_ZnajSt11align_val_tRKSt9nothrow_t" ||
+         Name == "_ZnamSt11align_val_tRKSt9nothrow_t";
+}
+
+//
+// The throwing forms of operator new report failure with std::bad_alloc and
+// never return null, which poolalloc() and poolmemalign() do.
+//
+static bool isThrowingOperatorNew (Instruction *I) {
+  CallSite CS(I);
+  Function *CF = dyn_cast<Function>(CS.getCalledValue()->stripPointerCasts());
+  if (!CF) return false;
+  std::string Name = CF->getName();
+  return (isOperatorNew(Name) || isAlignedOperatorNew(Name)) &&
+         Name.find("nothrow_t") == std::string::npos;
+}
+
+static bool isOperatorDelete (const std::string & Name) {
+  return Name == "_ZdlPv" || Name == "_ZdaPv" ||
+         Name == "_ZdlPvRKSt9nothrow_t" || Name == "_ZdaPvRKSt9nothrow_t" ||
+         Name == "_ZdlPvSt11align_val_t" || Name == "_ZdaPvSt11align_val_t" ||
+         Name == "_ZdlPvSt11align_val_tRKSt9nothrow_t" ||
+         Name == "_ZdaPvSt11align_val_tRKSt9nothrow_t";
+}
+
+static bool isSizedOperatorDelete (const std::string & Name) {
+  return Name == "_ZdlPvj" || Name == "_ZdlPvm" ||
+         Name == "_ZdaPvj" || Name == "_ZdaPvm" ||
+         Name == "_ZdlPvjSt11align_val_t" || Name == "_ZdlPvmSt11align_val_t" ||
+         Name == "_ZdaPvjSt11align_val_t" || Name == "_ZdaPvmSt11align_val_t";
+}
+
 void
 PoolAllocate::TransformBody (DSGraph* g, PA::FuncInfo &fi,
                              std::multimap<AllocaInst*,Instruction*> &poolUses,
                              std::multimap<AllocaInst*, CallInst*> &poolFrees,
                              Function &F) {
-  FuncTransform(*this, g, fi, poolUses, poolFrees).visit(F);
+  FuncTransform FT(*this, g, fi, poolUses, poolFrees);
+  FT.visit(F);
+  FT.InsertBadAllocFallbacks();
+}
+
+//
+// Method: InsertBadAllocFallbacks()
+//
+// Description:
+//  Make every pool allocation that replaced a throwing operator new call the
+//  original operator when the pool returns null, so that running out of
+//  memory still throws std::bad_alloc instead of handing null to code that
+//  never checks for it.  This splits blocks, so it is done after the visitor
+//  has walked the whole function.
+//
+void
+FuncTransform::InsertBadAllocFallbacks() {
+  for (unsigned i = 0, e = ThrowingNews.size(); i != e; ++i) {
+    Instruction *New = ThrowingNews[i].New;
+    Instruction *V = ThrowingNews[i].PoolAlloc;
+    Instruction *Casted = ThrowingNews[i].Casted;
+
+    //
+    // Move the original call into a block of its own.  Successful pool
+    // allocations branch around it to the join block.
+    //
+    BasicBlock *BB = New->getParent();
+    BasicBlock *Fail = BB->splitBasicBlock(New, BB->getName() + ".badalloc");
+    BasicBlock *Join;
+    if (InvokeInst *II = dyn_cast<InvokeInst>(New)) {
+      BasicBlock *Normal = II->getNormalDest();
+      Join = BasicBlock::Create(New->getContext(), Normal->getName() + ".new",
+                                BB->getParent(), Normal);
+      BranchInst::Create(Normal, Join);
+      II->setNormalDest(Join);
+      for (BasicBlock::iterator I = Normal->begin(); isa<PHINode>(I); ++I) {
+        PHINode *PN = cast<PHINode>(I);
+        PN->setIncomingBlock(PN->getBasicBlockIndex(Fail), Join);
+      }
+    } else {
+      Join = Fail->splitBasicBlock(++BasicBlock::iterator(New),
+                                   BB->getName() + ".new");
+    }
+
+    PHINode *PN = PHINode::Create(Casted->getType(), 2, "", Join->begin());
+    Casted->replaceAllUsesWith(PN);
+    PN->addIncoming(Casted, BB);
+    PN->addIncoming(New, Fail);
+
+    TerminatorInst *Term = BB->getTerminator();
+    Value *Null = ConstantPointerNull::get(cast<PointerType>(V->getType()));
+    Value *Failed = new ICmpInst(Term, ICmpInst::ICMP_EQ, V, Null, "");
+    BranchInst::Create(Fail, Join, Failed, Term);
+    Term->eraseFromParent();
+
+    // The fallback and the join point to whatever the pool allocation did.
+    if (!FI.Clone) {
+      G->getScalarMap()[New] = G->getScalarMap()[V];
+      G->getScalarMap()[PN] = G->getScalarMap()[V];
+    } else {
+      const Value *Old = FI.NewToOldValueMap[V];
+      FI.NewToOldValueMap[New] = Old;
+      FI.NewToOldValueMap[PN] = Old;
+    }
+  }
+  ThrowingNews.clear();
 }
 
 //
@@ -305,6 +434,13 @@ Instruction *FuncTransform::TransformAllocationInstr(Instruction *I,
     UpdateNewToOldValueMap(I, V, V != Casted ? Casted : 0);
   }
 
+  // A throwing operator new stays behind as the fallback for a failed pool
+  // allocation.
+  if (isThrowingOperatorNew(I)) {
+    ThrowingNews.push_back(PendingNew(I, V, Casted));
+    return Casted;
+  }
+
   // If this was an invoke, fix up the CFG.
   if (InvokeInst *II = dyn_cast<InvokeInst>(I)) {
     // FIXME: Assert out since we potentially don't handle "invoke" correctly
@@ -347,6 +483,8 @@ void FuncTransform::visitAllocaInst(AllocaInst &MI) {
 //  Arg   - The value that should be freed by the call to poolfree().
 //  Where - The instruction before which the poolfree() call should be
 //          inserted.
+//  Size  - If non-NULL, the size of the object as passed to a C++ sized
+//          operator delete.  A call to poolfree_sized() is inserted instead.
 //
 // Return value:
 //  NULL - No call to poolfree() was inserted.
@@ -355,7 +493,8 @@ void FuncTransform::visitAllocaInst(AllocaInst &MI) {
 //  returned.
 //
 Instruction *
-FuncTransform::InsertPoolFreeInstr (Value *Arg, Instruction *Where){
+FuncTransform::InsertPoolFreeInstr (Value *Arg, Instruction *Where,
+                                    Value *Size) {
   //
   // Attempt to get the pool handle of the specified value.  If there is no
   // pool handle, then just return NULL.
@@ -377,8 +516,18 @@ FuncTransform::InsertPoolFreeInstr (Value *Arg, Instruction *Where){
   //
   // Insert a call to poolfree(), and mark that memory was deallocated from the pool.
   //
-  Value* Opts[2] = {PH, Casted};
-  CallInst *FreeI = CallInst::Create(PAInfo.PoolFree, Opts, "", Where);
+  CallInst *FreeI;
+  if (Size) {
+    Type *Int32Type = Type::getInt32Ty(Arg->getContext());
+    if (!Size->getType()->isIntegerTy(32))
+      Size = CastInst::CreateIntegerCast(Size, Int32Type, false,
+                                         Size->getName(), Where);
+    Value* Opts[3] = {PH, Casted, Size};
+    FreeI = CallInst::Create(PAInfo.PoolFreeSized, Opts, "", Where);
+  } else {
+    Value* Opts[2] = {PH, Casted};
+    FreeI = CallInst::Create(PAInfo.PoolFree, Opts, "", Where);
+  }
   AddPoolUse(*FreeI, PH, PoolFrees);
   return FreeI;
 }
@@ -402,13 +551,26 @@ void FuncTransform::visitFreeInst(FreeInst &FrI) {
 }
 #endif
 
+//
+// Method: visitFreeCall()
+//
+// Description:
+//  Replace a call to free() or to a C++ operator delete with a call to
+//  poolfree().  If Sized is true, the callee is a sized operator delete and
+//  its second argument is passed on to poolfree_sized().
+//
 void
-FuncTransform::visitFreeCall (CallSite & CS) {
-  //
-  // Replace the call to the free() function with a call to poolfree().
-  //
+FuncTransform::visitFreeCall (CallSite & CS, bool Sized) {
   Instruction * InsertPt = CS.getInstruction();
-  if (Instruction *I = InsertPoolFreeInstr (CS.getArgument(0), InsertPt)) {
+  Value *Size = Sized ? CS.getArgument(1) : 0;
+  if (Instruction *I = InsertPoolFreeInstr (CS.getArgument(0), InsertPt,
+                                            Size)) {
+    // If this was an invoke, fix up the CFG.
+    if (InvokeInst *II = dyn_cast<InvokeInst>(InsertPt)) {
+      BranchInst::Create (II->getNormalDest(), InsertPt);
+      II->getUnwindDest()->removePredecessor(II->getParent(), true);
+    }
+
     // Delete the now obsolete free instruction...
     // FIXME: use "eraseFromParent"? (Note this might require a refactoring)
     InsertPt->getParent()->getInstList().erase(InsertPt);
@@ -426,6 +588,44 @@ FuncTransform::visitFreeCall (CallSite & CS) {
   }
 }
 
+//
+// Method: visitUsableSizeCall()
+//
+// Description:
+//  Replace a call to malloc_usable_size() on a pool allocated object with a
+//  call to poolobjsize().  Objects that are not in a pool are left to libc.
+//
+void
+FuncTransform::visitUsableSizeCall (CallSite & CS) {
+  Instruction *I = CS.getInstruction();
+  Value *Arg = CS.getArgument(0);
+  Value *PH = getPoolHandle(Arg);
+  if (PH == 0 || isa<ConstantPointerNull>(PH)) return;
+
+  Type *VoidPtrTy = PointerType::getUnqual(Type::getInt8Ty(I->getContext()));
+  if (Arg->getType() != VoidPtrTy)
+    Arg = CastInst::CreatePointerCast(Arg, VoidPtrTy, Arg->getName(), I);
+
+  std::string Name = I->getName(); I->setName("");
+  Value* Opts[2] = {PH, Arg};
+  Instruction *V = CallInst::Create(PAInfo.PoolObjSize, Opts, Name, I);
+  Instruction *Casted = V;
+  if (V->getType() != I->getType())
+    Casted = CastInst::CreateIntegerCast(V, I->getType(), false,
+                                         V->getName(), I);
+  I->replaceAllUsesWith(Casted);
+
+  if (!FI.NewToOldValueMap.empty())
+    UpdateNewToOldValueMap(I, V, V != Casted ? Casted : 0);
+
+  // If this was an invoke, fix up the CFG.
+  if (InvokeInst *II = dyn_cast<InvokeInst>(I)) {
+    BranchInst::Create (II->getNormalDest(), I);
+    II->getUnwindDest()->removePredecessor(II->getParent(), true);
+  }
+  I->eraseFromParent();
+}
+
 void
 FuncTransform::visitMallocCall(CallSite &CS) {
   //
@@ -578,7 +778,8 @@ void FuncTransform::visitReallocCall(CallSite CS) {
 }
 
 
-/// visitMemAlignCall - Handle memalign and posix_memalign.
+/// visitMemAlignCall - Handle memalign, posix_memalign, aligned_alloc and
+/// the C++17 aligned operator new.
 ///
 void FuncTransform::visitMemAlignCall(CallSite CS) {
   Instruction *I = CS.getInstruction();
@@ -591,10 +792,16 @@ void FuncTransform::visitMemAlignCall(CallSite CS) {
   Type* Int32Type = Type::getInt32Ty(CS.getInstruction()->getContext());
 
 
-  if (CS.getCalledFunction()->getName() == "memalign") {
+  StringRef CalleeName = CS.getCalledFunction()->getName();
+  if (CalleeName == "memalign" || CalleeName == "aligned_alloc") {
     Align = CS.getArgument(0);
     Size = CS.getArgument(1);
     PH = getPoolHandle(I);
+  } else if (CalleeName.startswith("_Zn")) {
+    // operator new(size_t, std::align_val_t) and its array form.
+    Size = CS.getArgument(0);
+    Align = CS.getArgument(1);
+    PH = getPoolHandle(I);
   } else {
     assert(CS.getCalledFunction()->getName() == "posix_memalign");
     ResultDest = CS.getArgument(0);
@@ -644,6 +851,13 @@ void FuncTransform::visitMemAlignCall(CallSite CS) {
     UpdateNewToOldValueMap(I, V, V != Casted ? Casted : 0);
   }
 
+  // A throwing operator new stays behind as the fallback for a failed pool
+  // allocation.
+  if (isThrowingOperatorNew(I)) {
+    ThrowingNews.push_back(PendingNew(I, V, Casted));
+    return;
+  }
+
   // If this was an invoke, fix up the CFG.
   if (InvokeInst *II = dyn_cast<InvokeInst>(I)) {
     BranchInst::Create (II->getNormalDest(), I);
@@ -801,10 +1015,13 @@ void FuncTransform::visitCallSite(CallSite& CS) {
   if (CF && CF->isDeclaration()) {
     std::string Name = CF->getName();
 
-    if (Name == "free" || Name == "cfree") {
+    if (Name == "free" || Name == "cfree" || isOperatorDelete(Name)) {
       visitFreeCall(CS);
       return;
-    } else if (Name == "malloc") {
+    } else if (isSizedOperatorDelete(Name)) {
+      visitFreeCall(CS, true);
+      return;
+    } else if (Name == "malloc" || isOperatorNew(Name)) {
       visitMallocCall(CS);
       return;
     } else if (Name == "calloc") {
@@ -813,9 +1030,13 @@ void FuncTransform::visitCallSite(CallSite& CS) {
     } else if (Name == "realloc") {
       visitReallocCall(CS);
       return;
-    } else if (Name == "memalign" || Name == "posix_memalign") {
+    } else if (Name == "memalign" || Name == "posix_memalign" ||
+               Name == "aligned_alloc" || isAlignedOperatorNew(Name)) {
       visitMemAlignCall(CS);
       return;
+    } else if (Name == "malloc_usable_size") {
+      visitUsableSizeCall(CS);
+      return;
     } else if (Name == "strdup") {
       visitStrdupCall(CS);
       return;
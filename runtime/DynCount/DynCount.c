@@ -1,25 +1,166 @@
+/*===- DynCount.c - Runtime for the -dyncount pass -------------------------===//
+//
+// Each thread counts the loads and stores it executes into its own shard of
+// per-site counters (see the -dyncount pass).  A thread hands its shard to
+// DYN_COUNT_register() the first time it runs instrumented code.  Shards are
+// added to the totals when their thread exits, and at program exit the totals
+// are written to DYNCOUNT_FILE, along with the "Safe"/"Total" summary in
+// lsstats.  The shards of threads still running at exit are added then, and
+// marked so that their thread's exit does not add them a second time.
+//
+//===----------------------------------------------------------------------===*/
+
+#include "poolalloc_runtime/DynCount.h"
+
+#include <pthread.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+
+/* A registered thread's counters */
+typedef struct Shard {
+  uint64_t * Counts;
+  struct Shard * Next;
+  int Folded;               /* Already added to the totals */
+} Shard;
+
+static const DynCountSite * Sites = 0;
+static uint32_t NumSites = 0;
+static const char * Names = 0;
+static uint64_t NamesSize = 0;
+
+/* Counts of threads that have exited */
+static uint64_t * Totals = 0;
+
+/* Shards of threads that are still running */
+static Shard * Live = 0;
+static uint32_t NumThreads = 0;
+
+static pthread_mutex_t Lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_once_t KeyOnce = PTHREAD_ONCE_INIT;
+static pthread_key_t ShardKey;
 
-static unsigned long * Total = 0;
-static unsigned long * Safe = 0;
+/* Add a shard into the totals, once.  Called with Lock held. */
+static void
+foldShard (Shard * S) {
+  uint32_t index;
+  if (!Totals || S->Folded)
+    return;
+  for (index = 0; index < NumSites; ++index)
+    Totals[index] += S->Counts[index];
+  S->Folded = 1;
+}
+
+/* Thread exit: keep the thread's counts before its shard goes away */
+static void
+releaseShard (void * Data) {
+  Shard * S = (Shard *) Data;
+  Shard ** Link;
+
+  pthread_mutex_lock (&Lock);
+  foldShard (S);
+  for (Link = &Live; *Link; Link = &(*Link)->Next) {
+    if (*Link == S) {
+      *Link = S->Next;
+      break;
+    }
+  }
+  pthread_mutex_unlock (&Lock);
+  free (S);
+}
 
 static void
-printItAll (void) {
-  FILE * fp = fopen ("lsstats", "w");
-  fprintf (fp, "%lu Safe \n", *Safe);
-  fprintf (fp, "%lu Total \n", *Total);
-  fflush (fp);
+createKey (void) {
+  pthread_key_create (&ShardKey, releaseShard);
+}
+
+static void
+writeCounts (void) {
+  DynCountHeader Header;
+  DynCountRecord Record;
+  uint64_t Safe = 0, Total = 0;
+  uint32_t index, NumFunctions = 0;
+  Shard * S;
+  FILE * fp;
+
+  /*
+   * Threads may still be exiting and folding their shards, so hold the lock
+   * until the totals have been written.
+   */
+  pthread_mutex_lock (&Lock);
+  for (S = Live; S; S = S->Next)
+    foldShard (S);
+  Live = 0;
+
+  for (index = 0; index < NumSites; ++index) {
+    Total += Totals[index];
+    if (Sites[index].Safe)
+      Safe += Totals[index];
+  }
+
+  fp = fopen ("lsstats", "w");
+  if (fp) {
+    fprintf (fp, "%llu Safe \n", (unsigned long long) Safe);
+    fprintf (fp, "%llu Total \n", (unsigned long long) Total);
+    fclose (fp);
+  }
+
+  for (index = 0; index < NamesSize; ++index)
+    if (!Names[index])
+      ++NumFunctions;
+
+  fp = fopen (DYNCOUNT_FILE, "wb");
+  if (!fp) {
+    pthread_mutex_unlock (&Lock);
+    return;
+  }
+  memset (&Header, 0, sizeof (Header));
+  memcpy (Header.Magic, DYNCOUNT_MAGIC, sizeof (Header.Magic));
+  Header.Version = DYNCOUNT_VERSION;
+  Header.NumSites = NumSites;
+  Header.NumFunctions = NumFunctions;
+  Header.NumThreads = NumThreads;
+  Header.NamesSize = NamesSize;
+  fwrite (&Header, sizeof (Header), 1, fp);
+  for (index = 0; index < NumSites; ++index) {
+    Record.Count = Totals[index];
+    Record.Site = Sites[index];
+    fwrite (&Record, sizeof (Record), 1, fp);
+  }
+  fwrite (Names, 1, NamesSize, fp);
   fclose (fp);
-  return;
+  pthread_mutex_unlock (&Lock);
 }
 
 void
-DYN_COUNT_setup (unsigned long * total, unsigned long * safe) {
-  Total = total;
-  Safe = safe;
-  atexit (printItAll);
+DYN_COUNT_setup (const void * sites, uint32_t numSites,
+                 const char * names, uint64_t namesSize) {
+  pthread_mutex_lock (&Lock);
+  Sites = (const DynCountSite *) sites;
+  NumSites = numSites;
+  Names = names;
+  NamesSize = namesSize;
+  Totals = (uint64_t *) calloc (numSites ? numSites : 1, sizeof (uint64_t));
+  pthread_mutex_unlock (&Lock);
+  atexit (writeCounts);
   return;
 }
 
+void
+DYN_COUNT_register (uint64_t * counts, uint8_t * registered) {
+  Shard * S = (Shard *) malloc (sizeof (Shard));
+  *registered = 1;
+  if (!S)
+    return;
+  S->Counts = counts;
+  S->Folded = 0;
 
+  pthread_once (&KeyOnce, createKey);
+  pthread_mutex_lock (&Lock);
+  S->Next = Live;
+  Live = S;
+  ++NumThreads;
+  pthread_mutex_unlock (&Lock);
+  pthread_setspecific (ShardKey, S);
+  return;
+}
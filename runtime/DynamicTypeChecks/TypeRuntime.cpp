@@ -64,6 +64,15 @@ std::map<void *, struct va_info> VA_InfoMap;
 // Pointer to the shadow_memory
 TypeTagTy * const shadow_begin = BASE;
 
+// The shadow mapping, for checks that the compiler inlines. Once the runtime
+// is linked in, loads of these fold to constants.
+extern "C" {
+  extern const uint64_t __tc_shadow_base;
+  extern const uint64_t __tc_shadow_size;
+}
+const uint64_t __tc_shadow_base = (uintptr_t)BASE;
+const uint64_t __tc_shadow_size = SIZE;
+
 // Map from type numbers to type names.
 extern char* typeNames[];
 
@@ -81,6 +90,8 @@ extern "C" {
   void checkVAArgType(void *va_list, TypeTagTy TypeAccessed, uint32_t tag) ;
   void getTypeTag(void *ptr, uint64_t size, TypeTagTy *dest, uint32_t tag) ;
   void checkType(TypeTagTy typeNumber, uint64_t size, TypeTagTy *metadata, void *ptr, uint32_t tag);
+  void checkTypeRange(void *base, uint64_t count, int64_t *checks, uint32_t tag);
+  void checkTypeStrided(TypeTagTy typeNumber, uint64_t size, void *ptr, uint64_t count, int64_t stride, uint32_t tag);
   void trackInitInst(void *ptr, uint64_t size, uint32_t tag) ;
   void trackUnInitInst(void *ptr, uint64_t size, uint32_t tag) ;
   void copyTypeInfo(void *dstptr, void *srcptr, uint64_t size, uint32_t tag) ;
@@ -279,6 +290,29 @@ checkType(TypeTagTy typeNumber, uint64_t size, TypeTagTy *metadata, void *ptr, u
   }
 }
 
+/**
+ * Check count (offset, size, type) triples of the object at base against
+ * the shadow memory in one call.
+ */
+void checkTypeRange(void *base, uint64_t count, int64_t *checks, uint32_t tag) {
+  for (uint64_t i = 0; i < count; ++i) {
+    char *ptr = (char *)base + checks[3*i];
+    checkType((TypeTagTy)checks[3*i + 2], checks[3*i + 1],
+              &shadow_begin[maskAddress(ptr)], ptr, tag);
+  }
+}
+
+/**
+ * Check count elements of the given type, stride bytes apart, starting at ptr.
+ * Replaces a check that ran on every iteration of a loop.
+ */
+void checkTypeStrided(TypeTagTy typeNumber, uint64_t size, void *ptr, uint64_t count, int64_t stride, uint32_t tag) {
+  char *p = (char *)ptr;
+  for (uint64_t i = 0; i < count; ++i, p += stride) {
+    checkType(typeNumber, size, &shadow_begin[maskAddress(p)], p, tag);
+  }
+}
+
 /**
  *  For memset type instructions, that set values. 
  *  0xFF type indicates that any type can be read, 
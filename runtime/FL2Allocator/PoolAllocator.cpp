@@ -16,16 +16,23 @@
 
 #include "PoolAllocator.h"
 #include "poolalloc/MMAPSupport.h"
+#include "poolalloc_runtime/AccessTrace.h"
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
 
 typedef long intptr_t;
 typedef unsigned long uintptr_t;
 
 // Performance tweaking macros.
 #define INITIAL_SLAB_SIZE 4096
+#define MAX_INITIAL_SLAB_SIZE (64 << 20)
 #define LARGE_SLAB_SIZE   4096
+#define SLAB_STAGGER_STRIDE 64    // Bytes between slab start offsets.
+#define MAX_SLAB_STAGGER    64    // Offsets wrap after one 4K page.
 
 #ifndef NDEBUG
 #define NDEBUG
@@ -243,6 +250,39 @@ public:
   PoolSlab<PoolTraits> *getNext() const { return Next; }
 };
 
+// SlabStagger - The number of cache-line offsets at which new slabs start,
+// taken from PA_SLAB_STAGGER.  Zero or one disables staggering.
+static int SlabStagger = -1;
+static unsigned NextSlabStagger = 0;
+
+/// getSlabStaggerOffset - Return how far into its body a new slab of the given
+/// size should start.  Large slabs come straight from mmap and so all start at
+/// the same offset within a page; objects at the same index of pools walked in
+/// lockstep then fight over the same cache sets.  Offsets are handed out round
+/// robin across all pools, and never take more than 1/16th of the slab, since
+/// the space comes out of the slab rather than being allocated on top.
+static unsigned getSlabStaggerOffset(unsigned Size, unsigned Alignment) {
+  int N = __atomic_load_n(&SlabStagger, __ATOMIC_RELAXED);
+  if (N < 0) {
+    // Racing threads all compute the same value.
+    N = 0;
+    if (const char *S = getenv("PA_SLAB_STAGGER"))
+      N = atoi(S);
+    if (N < 0) N = 0;
+    if (N > MAX_SLAB_STAGGER) N = MAX_SLAB_STAGGER;
+    __atomic_store_n(&SlabStagger, N, __ATOMIC_RELAXED);
+  }
+  if (N <= 1) return 0;
+
+  unsigned Stride = SLAB_STAGGER_STRIDE;
+  if (Alignment > Stride) Stride = Alignment;
+  unsigned Offset =
+    (__sync_fetch_and_add(&NextSlabStagger, 1) % N) * Stride;
+  while (Offset > Size/16)
+    Offset -= Stride;
+  return Offset;
+}
+
 // create - Create a new (empty) slab and add it to the end of the Pools list.
 template<typename PoolTraits>
 void PoolSlab<PoolTraits>::create(PoolTy<PoolTraits> *Pool, unsigned SizeHint) {
@@ -274,6 +314,12 @@ void PoolSlab<PoolTraits>::create(PoolTy<PoolTraits> *Pool, unsigned SizeHint) {
     Size -= Alignment-sizeof(FreedNodeHeader<PoolTraits>);
   }
 
+  // Stagger the start of the body by whole cache lines if PA_SLAB_STAGGER
+  // asks for it.
+  unsigned Stagger = getSlabStaggerOffset(Size, Alignment);
+  PoolBody += Stagger;
+  Size -= Stagger;
+
   // Add the body of the slab to the free list.
   FreedNodeHeader<PoolTraits> *SlabBody =(FreedNodeHeader<PoolTraits>*)PoolBody;
   SlabBody->Header.Size = Size;
@@ -476,13 +522,11 @@ void pooldestroy_bp(PoolTy<NormalPoolTraits> *Pool) {
 //
 //===----------------------------------------------------------------------===//
 
-// poolinit - Initialize a pool descriptor to empty
+// InitPoolDescriptor - Set up a zeroed pool descriptor.
 //
 template<typename PoolTraits>
-static void poolinit_internal(PoolTy<PoolTraits> *Pool,
-                              unsigned DeclaredSize, unsigned ObjAlignment) {
-  assert(Pool && "Null pool pointer passed into poolinit!\n");
-  memset(Pool, 0, sizeof(PoolTy<PoolTraits>));
+static void InitPoolDescriptor(PoolTy<PoolTraits> *Pool,
+                               unsigned DeclaredSize, unsigned ObjAlignment) {
   Pool->thread_refcount = 1;
   pthread_mutex_init(&Pool->pool_lock,NULL);
   Pool->AllocSize = INITIAL_SLAB_SIZE;
@@ -516,16 +560,108 @@ static void poolinit_internal(PoolTy<PoolTraits> *Pool,
   DO_IF_PNP(InitPrintNumPools<PoolTraits>());
 }
 
+// Every init and destroy writes the whole PoolTy, so it must fit in the
+// descriptor the compiler reserves, or global and stack pools get corrupted.
+typedef char PoolTyFitsDescriptor[sizeof(PoolTy<NormalPoolTraits>) <=
+                                  PoolDescriptorWords*sizeof(void*) ? 1 : -1];
+typedef char CompressedPoolTyFitsDescriptor[
+  sizeof(PoolTy<CompressedPoolTraits>) <=
+  PoolDescriptorWords*sizeof(void*) ? 1 : -1];
+
+// poolinit - Initialize a pool descriptor to empty
+//
+template<typename PoolTraits>
+static void poolinit_internal(PoolTy<PoolTraits> *Pool,
+                              unsigned DeclaredSize, unsigned ObjAlignment) {
+  assert(Pool && "Null pool pointer passed into poolinit!\n");
+  memset(Pool, 0, sizeof(PoolTy<PoolTraits>));
+  InitPoolDescriptor(Pool, DeclaredSize, ObjAlignment);
+}
+
 void poolinit(PoolTy<NormalPoolTraits> *Pool,
               unsigned DeclaredSize, unsigned ObjAlignment) {
   poolinit_internal(Pool, DeclaredSize, ObjAlignment);
 }
 
+void poolinit_lazy(PoolTy<NormalPoolTraits> *Pool, unsigned DeclaredSize,
+                   unsigned ObjAlignment) {
+  assert(Pool && "Null pool pointer passed into poolinit_lazy!\n");
+  memset(Pool, 0, sizeof(PoolTy<NormalPoolTraits>));
+  Pool->DeclaredSize = DeclaredSize;
+  Pool->Alignment = ObjAlignment;
+  Pool->thread_refcount = 1;
+  Pool->LazyInit = 1;
+}
+
+/// ApplyCapacityHint - Start the pool with a slab large enough for
+/// ExpectedBytes bytes of objects instead of growing to it one doubling at a
+/// time.
+static void ApplyCapacityHint(PoolTy<NormalPoolTraits> *Pool,
+                              unsigned ExpectedBytes) {
+  // Account for the node header in front of every object if we know how big
+  // the objects are.
+  unsigned long long Bytes = ExpectedBytes;
+  if (Pool->DeclaredSize) {
+    unsigned long long NumObjs =
+      (Bytes + Pool->DeclaredSize - 1) / Pool->DeclaredSize;
+    Bytes = NumObjs * (Pool->DeclaredSize + sizeof(NodeHeader<NormalPoolTraits>));
+  }
+  if (Bytes > MAX_INITIAL_SLAB_SIZE) Bytes = MAX_INITIAL_SLAB_SIZE;
+  if (Bytes > Pool->AllocSize) Pool->AllocSize = (unsigned)Bytes;
+}
+
+void poolinit_lazy_hint(PoolTy<NormalPoolTraits> *Pool, unsigned DeclaredSize,
+                        unsigned ObjAlignment, unsigned ExpectedBytes) {
+  // Until the pool is materialized, AllocSize holds the hint.
+  poolinit_lazy(Pool, DeclaredSize, ObjAlignment);
+  Pool->AllocSize = ExpectedBytes;
+}
+
+/// MaterializeLazyPool - Initialize a pool set up by poolinit_lazy before the
+/// first use of it.  The pool may already be shared with other threads, so
+/// only one of them gets to initialize it.  LazyInit stays non-zero until the
+/// descriptor and its lock are set up, and the other threads wait for it.
+static void __attribute__((noinline, cold))
+MaterializeLazyPool(PoolTy<NormalPoolTraits> *Pool) {
+  if (__sync_bool_compare_and_swap(&Pool->LazyInit, 1, 2)) {
+    // poolinit_lazy zeroed the rest of the descriptor, so it only needs the
+    // fields filled in, not another memset that would clear LazyInit early.
+    int RefCount = Pool->thread_refcount;
+    unsigned ExpectedBytes = Pool->AllocSize;
+    InitPoolDescriptor(Pool, Pool->DeclaredSize, Pool->Alignment);
+    Pool->thread_refcount = RefCount;
+    if (ExpectedBytes)
+      ApplyCapacityHint(Pool, ExpectedBytes);
+    __atomic_store_n(&Pool->LazyInit, 0, __ATOMIC_RELEASE);
+  } else {
+    while (__atomic_load_n(&Pool->LazyInit, __ATOMIC_ACQUIRE))
+      ;
+  }
+}
+
+#define MATERIALIZE_IF_LAZY(Pool) \
+  if (Pool && \
+      __builtin_expect(__atomic_load_n(&Pool->LazyInit, __ATOMIC_ACQUIRE), 0)) \
+    MaterializeLazyPool(Pool)
+
+void poolinit_hint(PoolTy<NormalPoolTraits> *Pool, unsigned DeclaredSize,
+                   unsigned ObjAlignment, unsigned ExpectedBytes) {
+  poolinit_internal(Pool, DeclaredSize, ObjAlignment);
+  ApplyCapacityHint(Pool, ExpectedBytes);
+}
+
+static void DestroyShardTable(ShardTable *T);
+
 // pooldestroy - Release all memory allocated for a pool
 //
 void pooldestroy(PoolTy<NormalPoolTraits> *Pool) {
   assert(Pool && "Null pool pointer passed in to pooldestroy!\n");
 
+  // A pool that was never initialized, or was initialized lazily and never
+  // allocated from, owns no memory.
+  if (Pool->thread_refcount == 0 && Pool->Alignment == 0)
+    return;
+
 #ifdef USE_DYNCALL
   __sync_fetch_and_add(&Pool->thread_refcount,-1);
 #else
@@ -534,6 +670,17 @@ void pooldestroy(PoolTy<NormalPoolTraits> *Pool) {
   if(Pool->thread_refcount)
 	  return;
 
+  if (Pool->LazyInit) {
+    Pool->Alignment = 0;
+    Pool->LazyInit = 0;
+    return;
+  }
+
+  if (Pool->Shards) {
+    DestroyShardTable(Pool->Shards);
+    Pool->Shards = 0;
+  }
+
   pthread_mutex_destroy(&Pool->pool_lock);
 
 #ifdef ENABLE_POOL_IDS
@@ -558,6 +705,10 @@ void pooldestroy(PoolTy<NormalPoolTraits> *Pool) {
     free(LAH);
     LAH = Next;
   }
+
+  // Leave the descriptor in the never-initialized state, so that a later
+  // pooldestroy without an intervening poolinit is harmless.
+  Pool->Alignment = 0;
 }
 
 template<typename PoolTraits>
@@ -711,6 +862,32 @@ LargeObject:
   return LAH+1;
 }
 
+/// getAlignedNodeBase - If Node was handed out by poolmemalign from inside a
+/// larger node, return the start of that node.  Otherwise return Node.
+template<typename PoolTraits>
+static inline void *getAlignedNodeBase(void *Node) {
+  AlignedNodeHeader<PoolTraits> *H = ((AlignedNodeHeader<PoolTraits>*)Node)-1;
+  if (H->Header.Size != (typename PoolTraits::NodeHeaderType)AlignedNodeMarker)
+    return Node;
+  return (char*)Node - H->Offset;
+}
+
+/// getNodeSize - Return the number of bytes usable at Node, which must be an
+/// allocated object of a non-null pool.
+template<typename PoolTraits>
+static unsigned getNodeSize(void *Node) {
+  void *Base = getAlignedNodeBase<PoolTraits>(Node);
+  FreedNodeHeader<PoolTraits> *FNH =
+    (FreedNodeHeader<PoolTraits>*)((char*)Base-sizeof(NodeHeader<PoolTraits>));
+  assert((FNH->Header.Size & 1) && "Node not allocated!");
+  unsigned Size = FNH->Header.Size & ~1;
+
+  // Large arrays keep their size in the LargeArrayHeader.
+  if (Size == ~1U)
+    Size = (((LargeArrayHeader*)Base)-1)->Size;
+  return Size - (unsigned)((char*)Node - (char*)Base);
+}
+
 template<typename PoolTraits>
 static void poolfree_internal(PoolTy<PoolTraits> *Pool, void *Node) {
   if (Node == 0) return;
@@ -725,6 +902,9 @@ static void poolfree_internal(PoolTy<PoolTraits> *Pool, void *Node) {
     return;
   }
 
+  // An over-aligned object is released as the node it was carved out of.
+  Node = getAlignedNodeBase<PoolTraits>(Node);
+
   // Check to see how many elements were allocated to this node...
   FreedNodeHeader<PoolTraits> *FNH =
     (FreedNodeHeader<PoolTraits>*)((char*)Node-sizeof(NodeHeader<PoolTraits>));
@@ -820,6 +1000,16 @@ static void *poolrealloc_internal(PoolTy<PoolTraits> *Pool, void *Node,
     (FreedNodeHeader<PoolTraits>*)((char*)Node-sizeof(NodeHeader<PoolTraits>));
   assert((FNH->Header.Size & 1) && "Node not allocated!");
   unsigned Size = FNH->Header.Size & ~1;
+  if (FNH->Header.Size == AlignedNodeMarker) {
+    // realloc does not have to preserve the alignment of memalign'd objects,
+    // so move over-aligned objects into an ordinary node.
+    Size = getNodeSize<PoolTraits>(Node);
+    void *New = poolalloc_internal(Pool, NumBytes);
+    memcpy(New, Node, Size < NumBytes ? Size : NumBytes);
+    poolfree_internal(Pool, Node);
+    DO_IF_TRACE(fprintf(stderr, "0x%X (moved)\n", New));
+    return New;
+  }
   if (Size != ~1U) {
     // FIXME: This is obviously much worse than it could be.  In particular, we
     // never try to expand something in a pool.  This might hurt some programs!
@@ -850,8 +1040,11 @@ static void *poolrealloc_internal(PoolTy<PoolTraits> *Pool, void *Node,
   return NewLAH+1;
 }
 
+static unsigned ShardedObjSize(void *Node);
+
 unsigned poolobjsize(PoolTy<NormalPoolTraits> *Pool, void *Node) {
   if (Node == 0) return 0;
+  if (Pool && Pool->Shards) return ShardedObjSize(Node);
 
   // If a null pool descriptor is passed in, this is not a pool allocated data
   // structure.  We don't really have any way to service this!!
@@ -861,22 +1054,204 @@ unsigned poolobjsize(PoolTy<NormalPoolTraits> *Pool, void *Node) {
     abort();
   }
 
-  // Check to see how many bytes were allocated to this node.
-  FreedNodeHeader<NormalPoolTraits> *FNH =
-    (FreedNodeHeader<NormalPoolTraits>*)((char*)Node -
-                                         sizeof(NodeHeader<NormalPoolTraits>));
-  assert((FNH->Header.Size & 1) && "Node not allocated!");
-  unsigned Size = FNH->Header.Size & ~1;
-  if (Size != ~1U) return Size;
+  return getNodeSize<NormalPoolTraits>(Node);
+}
 
-  // Otherwise, we have a large array.
-  LargeArrayHeader *LAH = ((LargeArrayHeader*)Node)-1;
-  return LAH->Size;
+
+//===----------------------------------------------------------------------===//
+//
+//  Sharded pool implementation
+//
+//===----------------------------------------------------------------------===//
+//
+// A sharded pool keeps one ordinary pool per thread that allocates from it.
+// Only the owning thread touches a shard's pool, so it is used without taking
+// its lock.  Every object is preceded by a ShardedObjHeader naming the shard
+// it came from; a thread freeing another shard's object pushes it onto that
+// shard's inbox, which the owner drains the next time it allocates.  When a
+// thread exits its shard is orphaned and adopted by the next new thread, so
+// the number of shards stays bounded by the peak number of threads.
+//
+
+struct PoolShard {
+  PoolTy<NormalPoolTraits> Pool;
+  PoolShard *Next;                  // All shards of the same table.
+  void * volatile Inbox;            // Objects freed by other threads.
+  volatile unsigned Orphaned;       // The owning thread has exited.
+};
+
+struct ShardTable {
+  pthread_key_t Key;                // The calling thread's PoolShard.
+  PoolShard * volatile Shards;
+  unsigned DeclaredSize;
+  unsigned Alignment;
+  unsigned HeaderSize;              // Bytes reserved before each object.
+};
+
+// ShardedObjHeader - Sits immediately before each object of a sharded pool.
+// Base is what the shard's pool returned; it differs from the header address
+// only for over-aligned objects.  Queued objects are linked through the first
+// word of Base.
+struct ShardedObjHeader {
+  void *Base;
+  PoolShard *Owner;
+};
+
+static inline ShardedObjHeader *getShardedObjHeader(void *Node) {
+  return ((ShardedObjHeader*)Node) - 1;
 }
 
+static void ShardThreadExit(void *S) {
+  __sync_fetch_and_or(&((PoolShard*)S)->Orphaned, 1);
+}
+
+/// getShard - Return the calling thread's shard of the table, adopting an
+/// orphaned shard or creating a new one on first use.
+static PoolShard *getShard(ShardTable *T) {
+  PoolShard *S = (PoolShard*)pthread_getspecific(T->Key);
+  if (__builtin_expect(S != 0, 1))
+    return S;
+
+  // Other threads push new shards and orphan or adopt existing ones while we
+  // walk the list, so every shared field is read with an atomic load.
+  for (S = __atomic_load_n(&T->Shards, __ATOMIC_ACQUIRE); S;
+       S = __atomic_load_n(&S->Next, __ATOMIC_ACQUIRE))
+    if (__atomic_load_n(&S->Orphaned, __ATOMIC_ACQUIRE) &&
+        __sync_bool_compare_and_swap(&S->Orphaned, 1, 0))
+      break;
+
+  if (!S) {
+    S = (PoolShard*)malloc(sizeof(PoolShard));
+    poolinit_internal(&S->Pool, T->DeclaredSize, T->Alignment);
+    S->Inbox = 0;
+    S->Orphaned = 0;
+    do {
+      S->Next = __atomic_load_n(&T->Shards, __ATOMIC_ACQUIRE);
+    } while (!__sync_bool_compare_and_swap(&T->Shards, S->Next, S));
+  }
+
+  pthread_setspecific(T->Key, S);
+  return S;
+}
+
+/// DrainShardInbox - Free the objects other threads have handed back to this
+/// shard.
+static void DrainShardInbox(PoolShard *S) {
+  if (__atomic_load_n(&S->Inbox, __ATOMIC_ACQUIRE) == 0) return;
+  void *List = __sync_lock_test_and_set(&S->Inbox, (void*)0);
+  while (List) {
+    void *Next = *(void**)List;
+    poolfree_internal(&S->Pool, List);
+    List = Next;
+  }
+}
+
+static void *ShardedAlloc(ShardTable *T, unsigned NumBytes,
+                          unsigned Alignment) {
+  PoolShard *S = getShard(T);
+  DrainShardInbox(S);
+
+  unsigned Extra = T->HeaderSize;
+  if (Alignment > T->Alignment)
+    Extra += Alignment - 1;
+  char *Base = (char*)poolalloc_internal(&S->Pool, NumBytes + Extra);
+  if (Base == 0) return 0;
+
+  uintptr_t Obj = (uintptr_t)Base + T->HeaderSize;
+  if (Alignment > T->Alignment)
+    Obj = (Obj + (Alignment - 1)) & ~((uintptr_t)Alignment - 1);
+
+  ShardedObjHeader *H = getShardedObjHeader((void*)Obj);
+  H->Base = Base;
+  H->Owner = S;
+  return (void*)Obj;
+}
+
+static void ShardedFree(ShardTable *T, void *Node) {
+  if (Node == 0) return;
+  ShardedObjHeader *H = getShardedObjHeader(Node);
+  void *Base = H->Base;
+  PoolShard *Owner = H->Owner;
+
+  if (Owner == (PoolShard*)pthread_getspecific(T->Key)) {
+    poolfree_internal(&Owner->Pool, Base);
+    return;
+  }
+
+  void *Head;
+  do {
+    Head = __atomic_load_n(&Owner->Inbox, __ATOMIC_ACQUIRE);
+    *(void**)Base = Head;
+  } while (!__sync_bool_compare_and_swap(&Owner->Inbox, Head, Base));
+}
+
+static unsigned ShardedObjSize(void *Node) {
+  ShardedObjHeader *H = getShardedObjHeader(Node);
+  return poolobjsize(&H->Owner->Pool, H->Base) -
+         (unsigned)((char*)Node - (char*)H->Base);
+}
+
+static void *ShardedRealloc(ShardTable *T, void *Node, unsigned NumBytes) {
+  if (Node == 0) return ShardedAlloc(T, NumBytes, 0);
+  if (NumBytes == 0) {
+    ShardedFree(T, Node);
+    return 0;
+  }
+
+  unsigned OldSize = ShardedObjSize(Node);
+  if (NumBytes <= OldSize &&
+      getShardedObjHeader(Node)->Owner == pthread_getspecific(T->Key))
+    return Node;
+
+  void *New = ShardedAlloc(T, NumBytes, 0);
+  if (New) {
+    memcpy(New, Node, OldSize < NumBytes ? OldSize : NumBytes);
+    ShardedFree(T, Node);
+  }
+  return New;
+}
+
+static void DestroyShardTable(ShardTable *T) {
+  pthread_key_delete(T->Key);
+  PoolShard *S = T->Shards;
+  while (S) {
+    PoolShard *Next = S->Next;
+    pooldestroy(&S->Pool);
+    free(S);
+    S = Next;
+  }
+  free(T);
+}
+
+void poolinit_sharded(PoolTy<NormalPoolTraits> *Pool, unsigned DeclaredSize,
+                      unsigned ObjAlignment) {
+  poolinit_internal(Pool, DeclaredSize, ObjAlignment);
+
+  ShardTable *T = (ShardTable*)malloc(sizeof(ShardTable));
+  T->Shards = 0;
+  T->Alignment = Pool->Alignment;
+  T->HeaderSize = sizeof(ShardedObjHeader);
+  if (T->HeaderSize < T->Alignment)
+    T->HeaderSize = T->Alignment;
+  T->DeclaredSize = DeclaredSize ? DeclaredSize + T->HeaderSize : 0;
+
+  // Each sharded pool uses a key of its own.  If the process has run out of
+  // keys, fall back to the ordinary locked pool that is already set up.
+  if (pthread_key_create(&T->Key, ShardThreadExit)) {
+    DO_IF_TRACE(fprintf(stderr, "poolinit_sharded(%p): out of thread keys, "
+                        "pool is not sharded\n", Pool));
+    free(T);
+    return;
+  }
+  Pool->Shards = T;
+}
+
+#define IS_SHARDED(Pool) (Pool && __builtin_expect(Pool->Shards != 0, 0))
 
 void *poolalloc(PoolTy<NormalPoolTraits> *Pool, unsigned NumBytes) {
   DO_IF_FORCE_MALLOCFREE(return malloc(NumBytes));
+  MATERIALIZE_IF_LAZY(Pool);
+  if (IS_SHARDED(Pool)) return ShardedAlloc(Pool->Shards, NumBytes, 0);
   if (Pool) pthread_mutex_lock(&Pool->pool_lock);
   void* to_return = poolalloc_internal(Pool, NumBytes);
   if (Pool) pthread_mutex_unlock(&Pool->pool_lock);
@@ -897,22 +1272,90 @@ void *poolmemalign(PoolTy<NormalPoolTraits> *Pool,
                    unsigned Alignment, unsigned NumBytes) {
   //punt and use pool alloc.
   //I don't know if this is safe or breaks any assumptions in the runtime
+  MATERIALIZE_IF_LAZY(Pool);
+  if (IS_SHARDED(Pool))
+    return ShardedAlloc(Pool->Shards, NumBytes, Alignment);
   if (Pool) pthread_mutex_lock(&Pool->pool_lock);
-  intptr_t base = (intptr_t)poolalloc_internal(Pool, NumBytes + Alignment - 1);
-  if (Pool) pthread_mutex_unlock(&Pool->pool_lock);
-  return (void*)((base + (Alignment - 1)) & ~((intptr_t)Alignment -1));
+
+  // If the pool already hands out suitably aligned memory, return the node
+  // itself so that it can later be passed to poolfree.
+  if (Pool && Alignment <= Pool->Alignment) {
+    void *Result = poolalloc_internal(Pool, NumBytes);
+    pthread_mutex_unlock(&Pool->pool_lock);
+    return Result;
+  }
+
+  // Memory from the system heap must be returned as is to be freeable.
+  if (Pool == 0) {
+    void *Result = 0;
+    if (Alignment < sizeof(void*))
+      Alignment = sizeof(void*);
+    if (posix_memalign(&Result, Alignment, NumBytes))
+      return 0;
+    return Result;
+  }
+
+  // Carve the object out of a larger node, leaving room for the header that
+  // leads poolfree back to the start of the node.
+  typedef AlignedNodeHeader<NormalPoolTraits> HeaderTy;
+  uintptr_t Base = (uintptr_t)poolalloc_internal(Pool, NumBytes +
+                                                 sizeof(HeaderTy) +
+                                                 Alignment - 1);
+  pthread_mutex_unlock(&Pool->pool_lock);
+  uintptr_t Obj = (Base + sizeof(HeaderTy) + (Alignment - 1)) &
+                  ~((uintptr_t)Alignment - 1);
+  HeaderTy *H = ((HeaderTy*)Obj)-1;
+  H->Offset = Obj - Base;
+  H->Header.Size = AlignedNodeMarker;
+  return (void*)Obj;
 }
 
 void poolfree(PoolTy<NormalPoolTraits> *Pool, void *Node) {
   DO_IF_FORCE_MALLOCFREE(free(Node); return);
+  MATERIALIZE_IF_LAZY(Pool);
+  if (IS_SHARDED(Pool)) return ShardedFree(Pool->Shards, Node);
   if (Pool) pthread_mutex_lock(&Pool->pool_lock);
   poolfree_internal(Pool, Node);
   if (Pool) pthread_mutex_unlock(&Pool->pool_lock);
 }
 
+void poolfree_sized(PoolTy<NormalPoolTraits> *Pool, void *Node,
+                    unsigned NumBytes) {
+  DO_IF_FORCE_MALLOCFREE(free(Node); return);
+  MATERIALIZE_IF_LAZY(Pool);
+  if (Pool == 0 || Node == 0 || NumBytes > Pool->DeclaredSize ||
+      Pool->Shards) {
+    poolfree(Pool, Node);
+    return;
+  }
+
+  pthread_mutex_lock(&Pool->pool_lock);
+  FreedNodeHeader<NormalPoolTraits> *FNH =
+    (FreedNodeHeader<NormalPoolTraits>*)((char*)Node -
+                                         sizeof(NodeHeader<NormalPoolTraits>));
+  assert((FNH->Header.Size & 1) && "Node not allocated!");
+
+  // The header is still needed to tell a node of exactly the declared size
+  // from a larger or coalesced one, but such nodes are the common case for
+  // sized deletes and can be recycled without looking at their neighbors.
+  if (FNH->Header.Size == (Pool->DeclaredSize | 1)) {
+    DO_IF_TRACE(fprintf(stderr, "[%d] poolfree_sized(%p) %d bytes\n",
+                        getPoolNumber(Pool), Node, NumBytes));
+    DO_IF_PNP(CurHeapSize -= (Pool->DeclaredSize +
+                              sizeof(NodeHeader<NormalPoolTraits>)));
+    FNH->Header.Size = Pool->DeclaredSize;
+    AddNodeToFreeList(Pool, FNH);
+  } else {
+    poolfree_internal(Pool, Node);
+  }
+  pthread_mutex_unlock(&Pool->pool_lock);
+}
+
 void *poolrealloc(PoolTy<NormalPoolTraits> *Pool, void *Node,
                   unsigned NumBytes) {
   DO_IF_FORCE_MALLOCFREE(return realloc(Node, NumBytes));
+  MATERIALIZE_IF_LAZY(Pool);
+  if (IS_SHARDED(Pool)) return ShardedRealloc(Pool->Shards, Node, NumBytes);
   if (Pool) pthread_mutex_lock(&Pool->pool_lock);
   void* to_return = poolrealloc_internal(Pool, Node, NumBytes);
   if (Pool) pthread_mutex_unlock(&Pool->pool_lock);
@@ -1133,56 +1576,219 @@ void* poolrealloc_pca(PoolTy<CompressedPoolTraits> *Pool, void* Node,
 // Access Tracing Runtime Library Support
 //===----------------------------------------------------------------------===//
 
-static FILE *FD = 0;
+//
+// Each thread samples accesses into a private buffer of records.  Full
+// buffers are appended to a memory-mapped trace file by atomically reserving
+// space in it, so tracing threads never wait for each other.  The file format
+// is described in poolalloc_runtime/AccessTrace.h; use the pa-trace tool to
+// summarize it.
+//
+// At exit the buffers of all threads are flushed.  Each buffer has a lock,
+// taken only when a sample is recorded, so that the exiting thread can flush
+// the buffers of threads that are still running.  Flushes hold TraceMapLock
+// for reading, and the mapping is only torn down with it held for writing.
+//
+// The following environment variables control tracing:
+//   PA_TRACE_FILE   - Trace file name (default trace.pa.bin).
+//   PA_TRACE_SAMPLE - Keep one in this many accesses, rounded up to a power
+//                     of two (default 32).
+//   PA_TRACE_MB     - Maximum size of the trace file (default 256).
+//
+
+#define NUMLRU 2
+#define TRACE_BUFFER_RECORDS 4096
+
+struct ThreadTraceBuffer {
+  unsigned ThreadID;
+  unsigned Count;
+  unsigned Sampler;
+  unsigned Time;
+  uintptr_t LRUWindow[NUMLRU];
+  pthread_mutex_t Lock;             // Guards Count and Records.
+  ThreadTraceBuffer *Next, **Prev;  // All live buffers, see TraceBuffers.
+  PoolTrace::Record Records[TRACE_BUFFER_RECORDS];
+};
+
+static PoolTrace::FileHeader *TraceHeader = 0;
+static char * volatile TraceData = 0;
+static size_t TraceCapacity = 0;
+static size_t TraceReserved = 0;
+static unsigned TraceSampleMask = 31;
+static unsigned TraceNumThreads = 0;
+static int TraceFD = -1;
+static pthread_key_t TraceBufferKey;
+static __thread ThreadTraceBuffer *TraceBuffer = 0;
+static ThreadTraceBuffer *TraceBuffers = 0;
+static pthread_mutex_t TraceBuffersLock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_rwlock_t TraceMapLock = PTHREAD_RWLOCK_INITIALIZER;
+
+/// FlushTraceBuffer - Append the records of a thread's buffer to the trace
+/// file as one chunk, or count them as dropped if the file is full or has
+/// already been closed.  The caller must hold Buf->Lock.
+static void FlushTraceBuffer(ThreadTraceBuffer *Buf) {
+  if (Buf->Count == 0) return;
+  pthread_rwlock_rdlock(&TraceMapLock);
+  if (TraceData) {
+    size_t Bytes = sizeof(PoolTrace::ChunkHeader) +
+                   Buf->Count*sizeof(PoolTrace::Record);
+    size_t Offset = __sync_fetch_and_add(&TraceReserved, Bytes);
+    if (Offset + Bytes > TraceCapacity) {
+      __sync_fetch_and_add(&TraceHeader->Dropped, (uint64_t)Buf->Count);
+    } else {
+      PoolTrace::ChunkHeader *CH = (PoolTrace::ChunkHeader*)(TraceData+Offset);
+      memcpy(CH+1, Buf->Records, Buf->Count*sizeof(PoolTrace::Record));
+      CH->ThreadID = Buf->ThreadID;
+      // Publish the chunk last so a reader never sees a partial one.
+      __sync_synchronize();
+      CH->NumRecords = Buf->Count;
+    }
+  }
+  pthread_rwlock_unlock(&TraceMapLock);
+  Buf->Count = 0;
+}
+
+static void ThreadTraceExit(void *B) {
+  ThreadTraceBuffer *Buf = (ThreadTraceBuffer*)B;
+  pthread_mutex_lock(&TraceBuffersLock);
+  *Buf->Prev = Buf->Next;
+  if (Buf->Next) Buf->Next->Prev = Buf->Prev;
+  pthread_mutex_unlock(&TraceBuffersLock);
+
+  pthread_mutex_lock(&Buf->Lock);
+  FlushTraceBuffer(Buf);
+  pthread_mutex_unlock(&Buf->Lock);
+  pthread_mutex_destroy(&Buf->Lock);
+  free(Buf);
+}
+
+static ThreadTraceBuffer *CreateThreadTraceBuffer() {
+  ThreadTraceBuffer *Buf =
+    (ThreadTraceBuffer*)calloc(1, sizeof(ThreadTraceBuffer));
+  Buf->ThreadID = __sync_fetch_and_add(&TraceNumThreads, 1);
+  pthread_mutex_init(&Buf->Lock, 0);
+
+  pthread_mutex_lock(&TraceBuffersLock);
+  Buf->Next = TraceBuffers;
+  if (Buf->Next) Buf->Next->Prev = &Buf->Next;
+  Buf->Prev = &TraceBuffers;
+  TraceBuffers = Buf;
+  pthread_mutex_unlock(&TraceBuffersLock);
+
+  pthread_setspecific(TraceBufferKey, Buf);
+  TraceBuffer = Buf;
+  return Buf;
+}
+
+static void poolaccesstracefinish() {
+  if (TraceData == 0) return;
+
+  // Other threads may still be running, so flush their buffers under their
+  // locks rather than just the calling thread's.
+  pthread_mutex_lock(&TraceBuffersLock);
+  for (ThreadTraceBuffer *Buf = TraceBuffers; Buf; Buf = Buf->Next) {
+    pthread_mutex_lock(&Buf->Lock);
+    FlushTraceBuffer(Buf);
+    pthread_mutex_unlock(&Buf->Lock);
+  }
+  pthread_mutex_unlock(&TraceBuffersLock);
+
+  // Wait for flushes in progress, and unmap the file only once no thread can
+  // be writing to it.  Later flushes find TraceData null and drop records.
+  pthread_rwlock_wrlock(&TraceMapLock);
+  size_t Used = TraceReserved < TraceCapacity ? TraceReserved : TraceCapacity;
+  TraceHeader->DataSize = Used;
+  TraceHeader->NumThreads = TraceNumThreads;
+  if (TraceHeader->Dropped)
+    fprintf(stderr, "poolaccesstrace: trace file full, %llu samples dropped\n",
+            (unsigned long long)TraceHeader->Dropped);
+
+  TraceData = 0;
+  munmap(TraceHeader, sizeof(PoolTrace::FileHeader) + TraceCapacity);
+  TraceHeader = 0;
+  if (ftruncate(TraceFD, sizeof(PoolTrace::FileHeader) + Used) != 0)
+    perror("poolaccesstrace: ftruncate");
+  close(TraceFD);
+  pthread_rwlock_unlock(&TraceMapLock);
+}
+
 void poolaccesstraceinit() {
+  const char *Name = getenv("PA_TRACE_FILE");
+  if (!Name) {
 #ifdef ALWAYS_USE_MALLOC_FREE
-  FD = fopen("trace.malloc.csv", "w");
+    Name = "trace.malloc.bin";
 #else
-  FD = fopen("trace.pa.csv", "w");
+    Name = "trace.pa.bin";
 #endif
-}
+  }
 
-#define NUMLRU 2
-static void *LRUWindow[NUMLRU];
+  unsigned SampleRate = 32;
+  if (const char *S = getenv("PA_TRACE_SAMPLE"))
+    SampleRate = atoi(S);
+  unsigned Rate = 1;
+  while (Rate < SampleRate && Rate < (1U << 31)) Rate <<= 1;
+  TraceSampleMask = Rate-1;
+
+  size_t MB = 256;
+  if (const char *S = getenv("PA_TRACE_MB"))
+    MB = atoi(S);
+  TraceCapacity = MB << 20;
+  size_t Total = sizeof(PoolTrace::FileHeader) + TraceCapacity;
+
+  TraceFD = open(Name, O_RDWR | O_CREAT | O_TRUNC, 0644);
+  if (TraceFD < 0 || ftruncate(TraceFD, Total) != 0) {
+    perror("poolaccesstrace: cannot create trace file");
+    return;
+  }
+  void *Map = mmap(0, Total, PROT_READ | PROT_WRITE, MAP_SHARED, TraceFD, 0);
+  if (Map == MAP_FAILED) {
+    perror("poolaccesstrace: cannot map trace file");
+    close(TraceFD);
+    return;
+  }
+
+  TraceHeader = (PoolTrace::FileHeader*)Map;
+  memcpy(TraceHeader->Magic, PoolTrace::Magic, sizeof(PoolTrace::Magic));
+  TraceHeader->Version = PoolTrace::Version;
+  TraceHeader->SampleRate = Rate;
+  TraceHeader->BlockShift = PoolTrace::BlockShift;
+  TraceData = (char*)(TraceHeader+1);
+
+  pthread_key_create(&TraceBufferKey, ThreadTraceExit);
+  atexit(poolaccesstracefinish);
+}
 
 void poolaccesstrace(void *Ptr, void *PD) {
-  static unsigned Time = ~0U;
+  // Not pool memory, or not tracing?  TraceData is checked again under
+  // TraceMapLock before the trace file is written.
+  if (PD == 0 || TraceData == 0) return;
 
-  // Not pool memory?
-  if (PD == 0) return;
-  
-  // Filter out stuff that is not to the heap.
-  ++Time;
-  if ((uintptr_t)Ptr > 1000000000UL)
-    return;
+  ThreadTraceBuffer *Buf = TraceBuffer;
+  if (Buf == 0) Buf = CreateThreadTraceBuffer();
+  ++Buf->Time;
 
-  Ptr = (void*)((intptr_t)Ptr & ~31L);
+  uintptr_t Block = (uintptr_t)Ptr >> PoolTrace::BlockShift;
 
-#if 1
   // Drop duplicate points.
   for (unsigned i = 0; i != NUMLRU; ++i)
-    if (Ptr == LRUWindow[i]) {
-      memmove(LRUWindow+1, LRUWindow, sizeof(void*)*i);
-      LRUWindow[0] = Ptr;
+    if (Block == Buf->LRUWindow[i]) {
+      memmove(Buf->LRUWindow+1, Buf->LRUWindow, sizeof(uintptr_t)*i);
+      Buf->LRUWindow[0] = Block;
       return;
     }
 
   // Rotate LRU window.
-  memmove(LRUWindow+1, LRUWindow, sizeof(void*)*(NUMLRU-1));
-  LRUWindow[0] = Ptr;
-#endif
+  memmove(Buf->LRUWindow+1, Buf->LRUWindow, sizeof(uintptr_t)*(NUMLRU-1));
+  Buf->LRUWindow[0] = Block;
 
   // Delete many points to reduce data.
-  static unsigned int Ctr;
-  if ((++Ctr & 31)) return;
-
-
-  fprintf(FD, "%d", Time);
-#if defined(ENABLE_POOL_IDS)
-  for (unsigned PID = getPoolNumber(PD)+1; PID; --PID)
-    fprintf(FD,"\t?");
-#else
-  fprintf(FD, "\t%p ", PD);
-#endif
-  fprintf(FD, "\t%lu\n", (intptr_t)Ptr);
+  if ((++Buf->Sampler & TraceSampleMask)) return;
+
+  pthread_mutex_lock(&Buf->Lock);
+  PoolTrace::Record &R = Buf->Records[Buf->Count];
+  R.Block = Block;
+  R.PoolID = PoolTrace::hashPoolDescriptor(PD);
+  R.Time = Buf->Time;
+  if (++Buf->Count == TRACE_BUFFER_RECORDS)
+    FlushTraceBuffer(Buf);
+  pthread_mutex_unlock(&Buf->Lock);
 }
@@ -117,6 +117,19 @@ struct FreedNodeHeader {
 };
 
 
+// Objects from poolmemalign that need more alignment than the pool provides
+// are carved out of an ordinary, larger node.  The two words before such an
+// object hold its distance from the start of that node and a marker in place
+// of the node size, so that poolfree can find the node again.
+template<typename PoolTraits>
+struct AlignedNodeHeader {
+  typename PoolTraits::NodeHeaderType Offset;
+  NodeHeader<PoolTraits> Header;
+};
+
+enum { AlignedNodeMarker = ~2U };
+
+
 // Large Arrays are passed on to directly malloc, and are not necessarily page
 // aligned.  These arrays are marked by setting the object size preheader to ~1.
 // LargeArrays are on their own list to allow for efficient deletion.
@@ -146,6 +159,11 @@ struct LargeArrayHeader {
 };
 
 
+// PoolDescriptorWords - The number of pointer-sized words the compiler
+// reserves for every pool descriptor (PoolAllocate::getPoolType).  PoolTy must
+// fit in that space on every target, including 32-bit ones.
+enum { PoolDescriptorWords = 18 };
+
 template<typename PoolTraits>
 struct PoolTy {
   // Slabs - the list of slabs in this pool.  NOTE: This must remain the first
@@ -181,11 +199,48 @@ struct PoolTy {
 
   // Thread reference count for the pool
   int thread_refcount;
+
+  // LazyInit - Set by poolinit_lazy until the first allocation from the pool
+  // actually initializes it.  A descriptor that is all zeros has never been
+  // initialized at all; pooldestroy accepts both states.
+  unsigned LazyInit;
+
+  // Shards - For pools set up by poolinit_sharded, the per-thread pools that
+  // actually hold the objects.  Null for every other kind of pool.
+  struct ShardTable *Shards;
 };
 
 extern "C" {
   void poolinit(PoolTy<NormalPoolTraits> *Pool,
                 unsigned DeclaredSize, unsigned ObjAlignment);
+
+  /// poolinit_hint - Like poolinit, but the compiler expects about
+  /// ExpectedBytes bytes of objects to be allocated from the pool, so the
+  /// first slab is made large enough to hold them.
+  ///
+  void poolinit_hint(PoolTy<NormalPoolTraits> *Pool, unsigned DeclaredSize,
+                     unsigned ObjAlignment, unsigned ExpectedBytes);
+
+  /// poolinit_lazy - Like poolinit, but only record the pool parameters.  The
+  /// pool is really initialized by the first allocation from it, and a pool
+  /// that is never allocated from costs nothing to destroy.
+  ///
+  void poolinit_lazy(PoolTy<NormalPoolTraits> *Pool, unsigned DeclaredSize,
+                     unsigned ObjAlignment);
+
+  /// poolinit_lazy_hint - poolinit_lazy with the capacity hint of
+  /// poolinit_hint, applied when the pool is initialized.
+  ///
+  void poolinit_lazy_hint(PoolTy<NormalPoolTraits> *Pool, unsigned DeclaredSize,
+                          unsigned ObjAlignment, unsigned ExpectedBytes);
+
+  /// poolinit_sharded - Like poolinit, but give each thread that allocates
+  /// from the pool a private shard of it.  Objects freed by a thread other
+  /// than the one that allocated them are handed back to the owning shard
+  /// through a lock-free inbox.  Intended for long lived global pools.
+  ///
+  void poolinit_sharded(PoolTy<NormalPoolTraits> *Pool, unsigned DeclaredSize,
+                        unsigned ObjAlignment);
   void poolmakeunfreeable(PoolTy<NormalPoolTraits> *Pool);
   void pooldestroy(PoolTy<NormalPoolTraits> *Pool);
   void *poolalloc(PoolTy<NormalPoolTraits> *Pool, unsigned NumBytes);
@@ -196,6 +251,14 @@ extern "C" {
                      unsigned Alignment, unsigned NumBytes);
   void poolfree(PoolTy<NormalPoolTraits> *Pool, void *Node);
 
+  /// poolfree_sized - Free an object whose size is known to the caller, as
+  /// with the C++14 sized operator delete.  Objects that exactly fill a node
+  /// of the pool's declared size skip coalescing and go straight back onto
+  /// the object free list.
+  ///
+  void poolfree_sized(PoolTy<NormalPoolTraits> *Pool, void *Node,
+                      unsigned NumBytes);
+
   /// poolobjsize - Return the size of the object at the specified address, in
   /// the specified pool.  Note that this cannot be used in normal cases, as it
   /// is completely broken if things land in the system heap.  Perhaps in the
@@ -0,0 +1,38 @@
+; A target that gets most of the profiled calls is tested for and called
+; directly at the call site, with the calling convention and the parameter
+; attributes of the original call.  Calls to the other target still go
+; through the bounce function.
+; The profile has one FunctionInfo packet with the entry counts of @f0, @f1
+; and @main, in module order.
+;RUN: printf '\002\000\000\000\003\000\000\000\132\000\000\000\012\000\000\000\001\000\000\000' > %t.prof
+;RUN: adsaopt %s -profile-loader -profile-info-file=%t.prof -devirt -o %t.bc
+;RUN: llvm-dis %t.bc -o %t.ll
+;RUN: grep "devirt.hot" %t.ll
+;RUN: grep "call fastcc i32 @f0(i32 inreg %argc)" %t.ll
+;RUN: grep "call i32 @devirtbounce" %t.ll
+;RUN: not grep "call fastcc i32 %fp" %t.ll
+target datalayout = "e-p:64:64:64-i1:8:8-i8:8:8-i16:16:16-i32:32:32-i64:64:64-f32:32:32-f64:64:64-v64:64:64-v128:128:128-a0:0:64-s0:64:64-f80:128:128-n8:16:32:64"
+target triple = "x86_64-unknown-linux-gnu"
+
+@table = internal global [2 x i32 (i32)*] [i32 (i32)* @f0, i32 (i32)* @f1]
+
+define internal fastcc i32 @f0(i32 inreg %x) nounwind {
+entry:
+  %r = add i32 %x, 0
+  ret i32 %r
+}
+
+define internal fastcc i32 @f1(i32 inreg %x) nounwind {
+entry:
+  %r = add i32 %x, 1
+  ret i32 %r
+}
+
+define i32 @main(i32 %argc, i8** %argv) nounwind {
+entry:
+  %idx = sext i32 %argc to i64
+  %slot = getelementptr inbounds [2 x i32 (i32)*]* @table, i64 0, i64 %idx
+  %fp = load i32 (i32)** %slot, align 8
+  %call = call fastcc i32 %fp(i32 inreg %argc)
+  ret i32 %call
+}
@@ -0,0 +1,59 @@
+;RUN: adsaopt %s -devirt -devirt-search-threshold=2 -o %t.bc
+;RUN: llvm-dis %t.bc -o %t.ll
+;RUN: grep "devirtbounce.table = internal global \[4 x" %t.ll
+;RUN: grep "^search.found" %t.ll
+;RUN: grep "switch i32 %index" %t.ll
+;RUN: grep "call void @qsort" %t.ll
+;RUN: grep "@llvm.global_ctors = appending global" %t.ll
+; Bounce functions with more targets than the threshold find the remaining
+; targets with a binary search over a table that a constructor sorts by
+; function address when the program starts.
+target datalayout = "e-p:64:64:64-i1:8:8-i8:8:8-i16:16:16-i32:32:32-i64:64:64-f32:32:32-f64:64:64-v64:64:64-v128:128:128-a0:0:64-s0:64:64-f80:128:128-n8:16:32:64"
+target triple = "x86_64-unknown-linux-gnu"
+
+@table = internal global [6 x i32 (i32)*] [i32 (i32)* @f0, i32 (i32)* @f1, i32 (i32)* @f2, i32 (i32)* @f3, i32 (i32)* @f4, i32 (i32)* @f5]
+
+define internal i32 @f0(i32 %x) nounwind {
+entry:
+  %r = add i32 %x, 0
+  ret i32 %r
+}
+
+define internal i32 @f1(i32 %x) nounwind {
+entry:
+  %r = add i32 %x, 1
+  ret i32 %r
+}
+
+define internal i32 @f2(i32 %x) nounwind {
+entry:
+  %r = add i32 %x, 2
+  ret i32 %r
+}
+
+define internal i32 @f3(i32 %x) nounwind {
+entry:
+  %r = add i32 %x, 3
+  ret i32 %r
+}
+
+define internal i32 @f4(i32 %x) nounwind {
+entry:
+  %r = add i32 %x, 4
+  ret i32 %r
+}
+
+define internal i32 @f5(i32 %x) nounwind {
+entry:
+  %r = add i32 %x, 5
+  ret i32 %r
+}
+
+define i32 @main(i32 %argc, i8** %argv) nounwind {
+entry:
+  %idx = sext i32 %argc to i64
+  %slot = getelementptr inbounds [6 x i32 (i32)*]* @table, i64 0, i64 %idx
+  %fp = load i32 (i32)** %slot, align 8
+  %call = call i32 %fp(i32 %argc)
+  ret i32 %call
+}
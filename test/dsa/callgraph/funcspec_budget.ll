@@ -0,0 +1,29 @@
+;RUN: adsaopt %s -funcspec -o %t.bc
+;RUN: llvm-dis %t.bc -o %t.ll
+;RUN: grep "call i32 @inc(" %t.ll
+;RUN: grep "define internal i32 @apply_SPEC" %t.ll
+;RUN: adsaopt %s -funcspec -spec-growth-budget=0 -o %t0.bc
+;RUN: llvm-dis %t0.bc -o %t0.ll
+;RUN: not grep "_SPEC" %t0.ll
+; Specializing @apply for the constant function pointer folds the pointer into
+; the clone, making the call direct.  With no growth budget nothing is cloned.
+target datalayout = "e-p:64:64:64-i1:8:8-i8:8:8-i16:16:16-i32:32:32-i64:64:64-f32:32:32-f64:64:64-v64:64:64-v128:128:128-a0:0:64-s0:64:64-f80:128:128-n8:16:32:64"
+target triple = "x86_64-unknown-linux-gnu"
+
+define internal i32 @inc(i32 %x) nounwind uwtable {
+entry:
+  %add = add nsw i32 %x, 1
+  ret i32 %add
+}
+
+define internal i32 @apply(i32 (i32)* %f, i32 %x) nounwind uwtable {
+entry:
+  %call = call i32 %f(i32 %x)
+  ret i32 %call
+}
+
+define i32 @main() nounwind uwtable {
+entry:
+  %call = call i32 @apply(i32 (i32)* @inc, i32 1)
+  ret i32 %call
+}
@@ -0,0 +1,25 @@
+;RUN: adsaopt %s -dsa-promote-calls -o %t.bc
+;RUN: llvm-dis %t.bc -o %t.ll
+;RUN: grep "call i32 @twice(" %t.ll
+;RUN: adsaopt %s -dsa-promote-calls -dsa-cg -inline -o %t1.bc
+;RUN: llvm-dis %t1.bc -o %t1.ll
+;RUN: not grep "call i32 @twice(" %t1.ll
+; The only function @op can hold is @twice, so the indirect call is made
+; direct and the inliner, running on the DSA call graph, can inline it.
+target datalayout = "e-p:64:64:64-i1:8:8-i8:8:8-i16:16:16-i32:32:32-i64:64:64-f32:32:32-f64:64:64-v64:64:64-v128:128:128-a0:0:64-s0:64:64-f80:128:128-n8:16:32:64"
+target triple = "x86_64-unknown-linux-gnu"
+
+@op = internal global i32 (i32)* @twice, align 8
+
+define internal i32 @twice(i32 %x) nounwind uwtable {
+entry:
+  %mul = shl nsw i32 %x, 1
+  ret i32 %mul
+}
+
+define i32 @main() nounwind uwtable {
+entry:
+  %0 = load i32 (i32)** @op, align 8
+  %call = call i32 %0(i32 21)
+  ret i32 %call
+}
@@ -0,0 +1,26 @@
+; %buf in main is passed to @deref, so its node and that of %p share a class;
+; %other is never passed anywhere and stays in a class of its own.
+;RUN: adsaopt -dsnodeequivs -analyze %s > %t.out
+;RUN: grep "equivalence classes" %t.out
+;RUN: grep "%p in @deref.*%buf in @main" %t.out
+;RUN: grep "%other in @main" %t.out | not grep "@deref"
+target datalayout = "e-p:64:64:64-i1:8:8-i8:8:8-i16:16:16-i32:32:32-i64:64:64-f32:32:32-f64:64:64-v64:64:64-v128:128:128-a0:0:64-s0:64:64-f80:128:128-n8:16:32:64"
+target triple = "x86_64-unknown-linux-gnu"
+
+define internal i32 @deref(i32* %p) nounwind uwtable {
+entry:
+  %v = load i32* %p, align 4
+  ret i32 %v
+}
+
+define i32 @main() nounwind uwtable {
+entry:
+  %buf = alloca i32, align 4
+  %other = alloca i32, align 4
+  store i32 1, i32* %buf, align 4
+  store i32 2, i32* %other, align 4
+  %call = call i32 @deref(i32* %buf)
+  %o = load i32* %other, align 4
+  %add = add nsw i32 %call, %o
+  ret i32 %add
+}
@@ -0,0 +1,24 @@
+; -dsa-canonicalize removes the integer round trip of the pointer, and
+; reports the size of the Local graphs before and after.
+;RUN: adsaopt %s -dsa-canonicalize -dsa-canonicalize-measure -o %t.bc -stats 2>%t.stats
+;RUN: llvm-dis %t.bc -o %t.ll
+;RUN: not grep "ptrtoint" %t.ll
+;RUN: grep "Local DSNodes after canonicalization" %t.stats
+;RUN: grep "Collapsed Local DSNodes before canonicalization" %t.stats
+target datalayout = "e-p:64:64:64-i1:8:8-i8:8:8-i16:16:16-i32:32:32-i64:64:64-f32:32:32-f64:64:64-v64:64:64-v128:128:128-a0:0:64-s0:64:64-f80:128:128-n8:16:32:64"
+target triple = "x86_64-unknown-linux-gnu"
+
+define i64 @roundtrip(i64 %x) nounwind uwtable {
+entry:
+  %p = inttoptr i64 %x to i32*
+  %i = ptrtoint i32* %p to i64
+  ret i64 %i
+}
+
+define i32 @main() nounwind uwtable {
+entry:
+  %a = alloca i32, align 4
+  store i32 0, i32* %a, align 4
+  %0 = load i32* %a, align 4
+  ret i32 %0
+}
@@ -0,0 +1,23 @@
+; -dsa-print-format=ndjson streams the graph as JSON records, and
+; -dsa-print-slice keeps only the nodes reachable from the named value.
+;RUN: rm -rf %t && mkdir -p %t && cd %t
+;RUN: dsaopt %s -dsa-local -analyze -dsa-only-print=main -dsa-print-format=ndjson -dsa-print-slice=pp -dsa-print-slice-depth=1
+;RUN: grep '"kind":"graph"' %t/local.main.ndjson
+;RUN: grep '"kind":"edge"' %t/local.main.ndjson
+;RUN: grep '"value":"%pp"' %t/local.main.ndjson
+;RUN: not grep '"value":"%other"' %t/local.main.ndjson
+;RUN: dsaopt %s -dsa-local -analyze -dsa-only-print=main -dsa-print-only-collapsed
+;RUN: grep "digraph" %t/local.main.dot
+;RUN: not grep "shape=Mrecord" %t/local.main.dot
+target datalayout = "e-p:64:64:64-i1:8:8-i8:8:8-i16:16:16-i32:32:32-i64:64:64-f32:32:32-f64:64:64-v64:64:64-v128:128:128-a0:0:64-s0:64:64-f80:128:128-n8:16:32:64"
+target triple = "x86_64-unknown-linux-gnu"
+
+define i32 @main() nounwind uwtable {
+entry:
+  %p = alloca i32, align 4
+  %pp = alloca i32*, align 8
+  %other = alloca i64, align 8
+  store i32* %p, i32** %pp, align 8
+  store i64 0, i64* %other, align 8
+  ret i32 0
+}
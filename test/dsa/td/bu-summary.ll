@@ -0,0 +1,70 @@
+; Callee summaries: dropping the callee's local-only nodes must not change the
+; caller's graph, while k-limiting and bisimulation merge the two objects that
+; @build hangs off its result.  K-limiting keeps structure below different
+; objects apart, so the deep objects @pair builds for its two arguments do
+; not alias.
+
+;RUN: dsaopt %s -dsa-bu -analyze -check-not-same-node "main:p:0:0,main:p:0:8"
+;RUN: dsaopt %s -dsa-bu -dsa-bu-summarize -analyze \
+;RUN:   -check-not-same-node "main:p:0:0,main:p:0:8"
+;RUN: dsaopt %s -dsa-bu -dsa-bu-summarize -analyze \
+;RUN:   -check-not-same-node "main:p:0,main:p:0:0"
+;RUN: dsaopt %s -dsa-bu -dsa-bu-summarize -analyze -verify-flags "main:p:0+H"
+
+;RUN: dsaopt %s -dsa-bu -dsa-bu-summarize -dsa-bu-summary-klimit=1 -analyze \
+;RUN:   -check-same-node "main:p:0:0,main:p:0:8"
+;RUN: dsaopt %s -dsa-bu -dsa-bu-summarize -dsa-bu-summary-klimit=1 -analyze \
+;RUN:   -check-not-same-node "main:p:0,main:p:0:0"
+;RUN: dsaopt %s -dsa-bu -dsa-bu-summarize -dsa-bu-summary-klimit=1 -analyze \
+;RUN:   -check-not-same-node "main:x:0:0,main:y:0:0"
+;RUN: dsaopt %s -dsa-bu -dsa-bu-summarize -dsa-bu-summary-bisim -analyze \
+;RUN:   -check-same-node "main:p:0:0,main:p:0:8"
+
+target datalayout = "e-p:64:64:64-i1:8:8-i8:8:8-i16:16:16-i32:32:32-i64:64:64-f32:32:32-f64:64:64-v64:64:64-v128:128:128-a0:0:64-s0:64:64-f80:128:128-n8:16:32:64"
+target triple = "x86_64-unknown-linux-gnu"
+
+declare noalias i8* @malloc(i64) nounwind
+
+; Stores a two-pointer object in *p whose fields point to two fresh objects.
+; The scratch object is only reachable from a local.
+define void @build(i8*** %p) {
+entry:
+  %scratch = call noalias i8* @malloc(i64 8) nounwind
+  store i8 0, i8* %scratch
+  %a = call noalias i8* @malloc(i64 16) nounwind
+  %a.ptrs = bitcast i8* %a to i8**
+  store i8** %a.ptrs, i8*** %p
+  %b = call noalias i8* @malloc(i64 8) nounwind
+  store i8* %b, i8** %a.ptrs
+  %a.1 = getelementptr i8** %a.ptrs, i64 1
+  %c = call noalias i8* @malloc(i64 8) nounwind
+  store i8* %c, i8** %a.1
+  ret void
+}
+
+; Stores a fresh object in each of *p and *q, each with a field pointing to
+; another fresh object.
+define void @pair(i8*** %p, i8*** %q) {
+entry:
+  %a = call noalias i8* @malloc(i64 8) nounwind
+  %a.ptrs = bitcast i8* %a to i8**
+  store i8** %a.ptrs, i8*** %p
+  %b = call noalias i8* @malloc(i64 8) nounwind
+  store i8* %b, i8** %a.ptrs
+  %c = call noalias i8* @malloc(i64 8) nounwind
+  %c.ptrs = bitcast i8* %c to i8**
+  store i8** %c.ptrs, i8*** %q
+  %d = call noalias i8* @malloc(i64 8) nounwind
+  store i8* %d, i8** %c.ptrs
+  ret void
+}
+
+define i32 @main() {
+entry:
+  %p = alloca i8**
+  call void @build(i8*** %p)
+  %x = alloca i8**
+  %y = alloca i8**
+  call void @pair(i8*** %x, i8*** %y)
+  ret i32 0
+}
@@ -0,0 +1,126 @@
+;Check that objects from aligned operator new can be freed through the pool
+;RUN: paopt %s -paheur-AllButUnreachableFromMemory -poolalloc -o %t.bc
+;RUN: llvm-dis %t.bc -o %t.ll
+;RUN: grep "call.*@poolmemalign" %t.ll
+;RUN: grep "call.*@poolfree(" %t.ll
+;RUN: grep "call.*@poolfree_sized" %t.ll
+;RUN: not grep "call.*@_Z" %t.ll
+;RUN: pa-build %t.bc %t.pa
+;RUN: %t.pa
+target datalayout = "e-p:64:64:64-i1:8:8-i8:8:8-i16:16:16-i32:32:32-i64:64:64-f32:32:32-f64:64:64-v64:64:64-v128:128:128-a0:0:64-s0:64:64-f80:128:128-n8:16:32:64"
+target triple = "x86_64-unknown-linux-gnu"
+
+%struct.node = type { %struct.node*, i64 }
+%"struct.std::nothrow_t" = type { i8 }
+
+@_ZSt7nothrow = external global %"struct.std::nothrow_t"
+
+; Build a list whose odd elements come from over-aligned operator new, free it
+; with the matching deletes, and check the alignment and the contents.  The
+; pool hands out 8 byte aligned nodes, so the 64 byte aligned objects are
+; interior to larger pool nodes.
+define i32 @main() {
+entry:
+  br label %alloc
+
+alloc:
+  %i = phi i64 [ 0, %entry ], [ %i.next, %join ]
+  %head = phi %struct.node* [ null, %entry ], [ %n, %join ]
+  %odd = and i64 %i, 1
+  %isodd = icmp ne i64 %odd, 0
+  br i1 %isodd, label %aligned, label %plain
+
+aligned:
+  %three = and i64 %i, 3
+  %nothrow = icmp eq i64 %three, 3
+  br i1 %nothrow, label %aligned.nothrow, label %aligned.throw
+
+aligned.throw:
+  %am = call noalias i8* @_ZnwmSt11align_val_t(i64 16, i64 64)
+  br label %aligned.check
+
+aligned.nothrow:
+  %anm = call noalias i8* @_ZnwmSt11align_val_tRKSt9nothrow_t(i64 16, i64 64, %"struct.std::nothrow_t"* @_ZSt7nothrow)
+  br label %aligned.check
+
+aligned.check:
+  %a = phi i8* [ %am, %aligned.throw ], [ %anm, %aligned.nothrow ]
+  %addr = ptrtoint i8* %a to i64
+  %mis = and i64 %addr, 63
+  %bad = icmp ne i64 %mis, 0
+  br i1 %bad, label %fail, label %join
+
+plain:
+  %pm = call noalias i8* @_Znwm(i64 16)
+  br label %join
+
+join:
+  %m = phi i8* [ %a, %aligned.check ], [ %pm, %plain ]
+  %n = bitcast i8* %m to %struct.node*
+  %next = getelementptr inbounds %struct.node* %n, i64 0, i32 0
+  store %struct.node* %head, %struct.node** %next, align 8
+  %val = getelementptr inbounds %struct.node* %n, i64 0, i32 1
+  store i64 %i, i64* %val, align 8
+  %i.next = add i64 %i, 1
+  %more = icmp ult i64 %i.next, 1000
+  br i1 %more, label %alloc, label %walk
+
+walk:
+  %cur = phi %struct.node* [ %n, %join ], [ %cur.next, %freed ]
+  %sum = phi i64 [ 0, %join ], [ %sum.next, %freed ]
+  %done = icmp eq %struct.node* %cur, null
+  br i1 %done, label %check, label %visit
+
+visit:
+  %cur.nextp = getelementptr inbounds %struct.node* %cur, i64 0, i32 0
+  %cur.next = load %struct.node** %cur.nextp, align 8
+  %cur.valp = getelementptr inbounds %struct.node* %cur, i64 0, i32 1
+  %cur.val = load i64* %cur.valp, align 8
+  %sum.next = add i64 %sum, %cur.val
+  %mem = bitcast %struct.node* %cur to i8*
+  %cur.odd = and i64 %cur.val, 1
+  %cur.isodd = icmp ne i64 %cur.odd, 0
+  br i1 %cur.isodd, label %free.aligned, label %free.plain
+
+free.aligned:
+  %cur.three = and i64 %cur.val, 7
+  %sized = icmp eq i64 %cur.three, 1
+  br i1 %sized, label %free.aligned.sized, label %free.aligned.unsized
+
+free.aligned.sized:
+  call void @_ZdlPvmSt11align_val_t(i8* %mem, i64 16, i64 64)
+  br label %freed
+
+free.aligned.unsized:
+  call void @_ZdlPvSt11align_val_t(i8* %mem, i64 64)
+  br label %freed
+
+free.plain:
+  call void @_ZdlPvm(i8* %mem, i64 16)
+  br label %freed
+
+freed:
+  br label %walk
+
+check:
+  %ok = icmp eq i64 %sum, 499500
+  br i1 %ok, label %pass, label %fail
+
+pass:
+  ret i32 0
+
+fail:
+  ret i32 1
+}
+
+declare noalias i8* @_Znwm(i64)
+
+declare noalias i8* @_ZnwmSt11align_val_t(i64, i64)
+
+declare noalias i8* @_ZnwmSt11align_val_tRKSt9nothrow_t(i64, i64, %"struct.std::nothrow_t"*)
+
+declare void @_ZdlPvm(i8*, i64)
+
+declare void @_ZdlPvSt11align_val_t(i8*, i64)
+
+declare void @_ZdlPvmSt11align_val_t(i8*, i64, i64)
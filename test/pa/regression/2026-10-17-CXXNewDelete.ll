@@ -0,0 +1,39 @@
+;Check that C++ operator new/delete and malloc_usable_size use the pool
+;RUN: paopt %s -paheur-AllButUnreachableFromMemory -poolalloc -o %t.bc
+;RUN: llvm-dis %t.bc -o %t.ll
+;RUN: grep "call.*@poolalloc" %t.ll
+;RUN: grep "call.*@poolfree_sized" %t.ll
+;RUN: grep "call.*@poolfree(" %t.ll
+;RUN: grep "call.*@poolobjsize" %t.ll
+;RUN: not grep "call.*@_Z" %t.ll
+target datalayout = "e-p:64:64:64-i1:8:8-i8:8:8-i16:16:16-i32:32:32-i64:64:64-f32:32:32-f64:64:64-v64:64:64-v128:128:128-a0:0:64-s0:64:64-f80:128:128-n8:16:32:64"
+target triple = "x86_64-unknown-linux-gnu"
+
+%struct.node = type { %struct.node*, i32 }
+
+define i32 @main(i32 %argc, i8** nocapture %argv) {
+entry:
+  %mem = call noalias i8* @_Znwm(i64 16)
+  %n = bitcast i8* %mem to %struct.node*
+  %next = getelementptr inbounds %struct.node* %n, i64 0, i32 0
+  store %struct.node* null, %struct.node** %next, align 8
+  %size = call i64 @malloc_usable_size(i8* %mem)
+  call void @_ZdlPvm(i8* %mem, i64 16)
+  %arr = call noalias i8* @_Znam(i64 64)
+  %arrn = bitcast i8* %arr to %struct.node*
+  %first = getelementptr inbounds %struct.node* %arrn, i64 0, i32 0
+  store %struct.node* %arrn, %struct.node** %first, align 8
+  call void @_ZdaPv(i8* %arr)
+  %ret = trunc i64 %size to i32
+  ret i32 %ret
+}
+
+declare noalias i8* @_Znwm(i64)
+
+declare noalias i8* @_Znam(i64)
+
+declare void @_ZdlPvm(i8*, i64)
+
+declare void @_ZdaPv(i8*)
+
+declare i64 @malloc_usable_size(i8*)
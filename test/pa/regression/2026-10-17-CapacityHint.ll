@@ -0,0 +1,34 @@
+;Check that pools allocated from in a counted loop get a capacity hint
+;RUN: paopt %s -paheur-AllButUnreachableFromMemory -poolalloc -poolalloc-capacity-hints -o %t.bc
+;RUN: llvm-dis %t.bc -o %t.ll
+;RUN: grep "call.*@poolinit_hint(.*i32 16000)" %t.ll
+;RUN: paopt %s -paheur-AllButUnreachableFromMemory -poolalloc -poolalloc-capacity-hints -poolalloc-lazy-init -o %t.lazy.bc
+;RUN: llvm-dis %t.lazy.bc -o %t.lazy.ll
+;RUN: grep "call.*@poolinit_lazy_hint(.*i32 16000)" %t.lazy.ll
+target datalayout = "e-p:64:64:64-i1:8:8-i8:8:8-i16:16:16-i32:32:32-i64:64:64-f32:32:32-f64:64:64-v64:64:64-v128:128:128-a0:0:64-s0:64:64-f80:128:128-n8:16:32:64"
+target triple = "x86_64-unknown-linux-gnu"
+
+%struct.node = type { %struct.node*, i32 }
+
+define i32 @main(i32 %argc, i8** nocapture %argv) nounwind {
+entry:
+  br label %loop
+
+loop:
+  %i = phi i32 [ 0, %entry ], [ %i.next, %loop ]
+  %head = phi %struct.node* [ null, %entry ], [ %n, %loop ]
+  %mem = call noalias i8* @malloc(i64 16) nounwind
+  %n = bitcast i8* %mem to %struct.node*
+  %next = getelementptr inbounds %struct.node* %n, i64 0, i32 0
+  store %struct.node* %head, %struct.node** %next, align 8
+  %i.next = add i32 %i, 1
+  %done = icmp eq i32 %i.next, 1000
+  br i1 %done, label %exit, label %loop
+
+exit:
+  %val = getelementptr inbounds %struct.node* %n, i64 0, i32 1
+  %r = load i32* %val, align 4
+  ret i32 %r
+}
+
+declare noalias i8* @malloc(i64) nounwind
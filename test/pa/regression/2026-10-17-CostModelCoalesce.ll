@@ -0,0 +1,41 @@
+;Check that -paheur-CostModel puts small DSNodes with the same size and
+;lifetime into one pool.
+;RUN: paopt %s -paheur-CostModel -poolalloc -o %t.bc
+;RUN: llvm-dis %t.bc -o %t.ll
+;RUN: grep -c "call.*@poolinit(" %t.ll | grep "^1$"
+;RUN: grep -c "call.*@pooldestroy(" %t.ll | grep "^1$"
+target datalayout = "e-p:64:64:64-i1:8:8-i8:8:8-i16:16:16-i32:32:32-i64:64:64-f32:32:32-f64:64:64-v64:64:64-v128:128:128-a0:0:64-s0:64:64-f80:128:128-n8:16:32:64"
+target triple = "x86_64-unknown-linux-gnu"
+
+%struct.pair = type { i64, i32 }
+%struct.range = type { i32, i32, i64 }
+
+define internal i64 @work(i64 %x) nounwind {
+entry:
+  %m1 = call noalias i8* @malloc(i64 16) nounwind
+  %p = bitcast i8* %m1 to %struct.pair*
+  %m2 = call noalias i8* @malloc(i64 16) nounwind
+  %r = bitcast i8* %m2 to %struct.range*
+  %pf = getelementptr inbounds %struct.pair* %p, i64 0, i32 0
+  store i64 %x, i64* %pf, align 8
+  %rf = getelementptr inbounds %struct.range* %r, i64 0, i32 2
+  store i64 %x, i64* %rf, align 8
+  %a = load i64* %pf, align 8
+  %b = load i64* %rf, align 8
+  %s = add i64 %a, %b
+  call void @free(i8* %m1) nounwind
+  call void @free(i8* %m2) nounwind
+  ret i64 %s
+}
+
+define i32 @main(i32 %argc, i8** nocapture %argv) nounwind {
+entry:
+  %x = sext i32 %argc to i64
+  %s = call i64 @work(i64 %x)
+  %r = trunc i64 %s to i32
+  ret i32 %r
+}
+
+declare noalias i8* @malloc(i64) nounwind
+
+declare void @free(i8*) nounwind
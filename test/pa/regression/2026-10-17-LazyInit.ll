@@ -0,0 +1,38 @@
+;Check that -poolalloc-lazy-init uses poolinit_lazy for local pools
+;RUN: paopt %s -paheur-AllButUnreachableFromMemory -poolalloc -poolalloc-lazy-init -o %t.bc
+;RUN: llvm-dis %t.bc -o %t.ll
+;RUN: grep "call.*@poolinit_lazy" %t.ll
+;RUN: not grep "call.*@poolinit(" %t.ll
+;RUN: grep "call.*@pooldestroy" %t.ll
+target datalayout = "e-p:64:64:64-i1:8:8-i8:8:8-i16:16:16-i32:32:32-i64:64:64-f32:32:32-f64:64:64-v64:64:64-v128:128:128-a0:0:64-s0:64:64-f80:128:128-n8:16:32:64"
+target triple = "x86_64-unknown-linux-gnu"
+
+%struct.node = type { %struct.node*, i32 }
+
+define internal i32 @work(i32 %fail) nounwind {
+entry:
+  %cold = icmp ne i32 %fail, 0
+  br i1 %cold, label %error, label %done
+
+error:
+  %mem = call noalias i8* @malloc(i64 16) nounwind
+  %n = bitcast i8* %mem to %struct.node*
+  %val = getelementptr inbounds %struct.node* %n, i64 0, i32 1
+  store i32 %fail, i32* %val, align 4
+  %r = load i32* %val, align 4
+  call void @free(i8* %mem) nounwind
+  ret i32 %r
+
+done:
+  ret i32 0
+}
+
+define i32 @main(i32 %argc, i8** nocapture %argv) nounwind {
+entry:
+  %r = call i32 @work(i32 %argc)
+  ret i32 %r
+}
+
+declare noalias i8* @malloc(i64) nounwind
+
+declare void @free(i8*) nounwind
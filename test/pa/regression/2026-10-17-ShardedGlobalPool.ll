@@ -0,0 +1,24 @@
+;Check that -poolalloc-sharded-global-pools initializes the global pool of
+;-poolalloc-simple with poolinit_sharded.
+;RUN: paopt %s -poolalloc-simple -poolalloc-sharded-global-pools -o %t.bc
+;RUN: llvm-dis %t.bc -o %t.ll
+;RUN: grep "call.*@poolinit_sharded(.*@__poolalloc_GlobalPool" %t.ll
+;RUN: not grep "call.*@poolinit(" %t.ll
+;RUN: grep "call.*@poolalloc(.*@__poolalloc_GlobalPool" %t.ll
+;RUN: grep "call.*@poolfree(.*@__poolalloc_GlobalPool" %t.ll
+target datalayout = "e-p:64:64:64-i1:8:8-i8:8:8-i16:16:16-i32:32:32-i64:64:64-f32:32:32-f64:64:64-v64:64:64-v128:128:128-a0:0:64-s0:64:64-f80:128:128-n8:16:32:64"
+target triple = "x86_64-unknown-linux-gnu"
+
+define i32 @main(i32 %argc, i8** nocapture %argv) nounwind {
+entry:
+  %mem = call noalias i8* @malloc(i64 16) nounwind
+  %p = bitcast i8* %mem to i32*
+  store i32 %argc, i32* %p, align 4
+  %r = load i32* %p, align 4
+  call void @free(i8* %mem) nounwind
+  ret i32 %r
+}
+
+declare noalias i8* @malloc(i64) nounwind
+
+declare void @free(i8*) nounwind
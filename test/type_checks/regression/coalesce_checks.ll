@@ -0,0 +1,58 @@
+; Loads of adjacent fields are checked by one range check, and the check on
+; the array walked by the loop is hoisted into a single strided check.
+; RUN: adsaopt -typechecks -tc-coalesce-checks %s -o %t.bc
+; RUN: llvm-dis %t.bc -o %t.ll
+; RUN: grep "call void @checkTypeRange" %t.ll
+; RUN: grep "call void @checkTypeStrided" %t.ll
+; RUN: not grep "call void @checkType(" %t.ll
+target datalayout = "e-p:64:64:64-i1:8:8-i8:8:8-i16:16:16-i32:32:32-i64:64:64-f32:32:32-f64:64:64-v64:64:64-v128:128:128-a0:0:64-s0:64:64-f80:128:128-n8:16:32:64"
+target triple = "x86_64-unknown-linux-gnu"
+
+%struct.pair = type { i32, i32 }
+
+define internal i32 @sum(%struct.pair* %p) nounwind uwtable {
+entry:
+  %a = getelementptr inbounds %struct.pair* %p, i64 0, i32 0
+  %0 = load i32* %a, align 4
+  %b = getelementptr inbounds %struct.pair* %p, i64 0, i32 1
+  %1 = load i32* %b, align 4
+  %add = add nsw i32 %0, %1
+  ret i32 %add
+}
+
+define internal i32 @total(i32* %arr) nounwind uwtable {
+entry:
+  br label %loop
+
+loop:
+  %i = phi i64 [ 0, %entry ], [ %inc, %loop ]
+  %s = phi i32 [ 0, %entry ], [ %s.next, %loop ]
+  %ptr = getelementptr inbounds i32* %arr, i64 %i
+  %v = load i32* %ptr, align 4
+  %s.next = add nsw i32 %s, %v
+  %inc = add i64 %i, 1
+  %cmp = icmp eq i64 %inc, 16
+  br i1 %cmp, label %exit, label %loop
+
+exit:
+  ret i32 %s.next
+}
+
+define i32 @main() nounwind uwtable {
+entry:
+  %pair = alloca %struct.pair, align 4
+  %arr = alloca [16 x i32], align 16
+  %x = getelementptr inbounds %struct.pair* %pair, i64 0, i32 0
+  store i32 1, i32* %x, align 4
+  %y = getelementptr inbounds %struct.pair* %pair, i64 0, i32 1
+  store i32 2, i32* %y, align 4
+  %arr0 = getelementptr inbounds [16 x i32]* %arr, i64 0, i64 0
+  %arr1 = bitcast i32* %arr0 to i8*
+  call void @llvm.memset.p0i8.i64(i8* %arr1, i8 0, i64 64, i32 16, i1 false)
+  %call = call i32 @sum(%struct.pair* %pair)
+  %call1 = call i32 @total(i32* %arr0)
+  %res = add nsw i32 %call, %call1
+  ret i32 %res
+}
+
+declare void @llvm.memset.p0i8.i64(i8* nocapture, i8, i64, i32, i1) nounwind
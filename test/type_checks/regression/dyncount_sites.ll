@@ -0,0 +1,29 @@
+; Every load and store gets its own counter in the thread local shard, and
+; functions with counters register the shard with the runtime.  All three
+; accesses touch %a, so they report the same node although @read sees it
+; through its own graph.
+; RUN: adsaopt -dyncount %s -o %t.bc
+; RUN: llvm-dis %t.bc -o %t.ll
+; RUN: grep "__dyncount_sites = internal constant \[3 x" %t.ll
+; RUN: grep "__dyncount_shard = internal thread_local global \[3 x i64\]" %t.ll
+; RUN: grep -c "call void @DYN_COUNT_register" %t.ll | grep "^2$"
+; RUN: grep "call void @DYN_COUNT_setup" %t.ll
+; RUN: grep -o "i32 [0-9]*, i8 [01], i8 [01], i16" %t.ll | cut -d, -f1 | sort -u | wc -l | grep "^ *1$"
+target datalayout = "e-p:64:64:64-i1:8:8-i8:8:8-i16:16:16-i32:32:32-i64:64:64-f32:32:32-f64:64:64-v64:64:64-v128:128:128-a0:0:64-s0:64:64-f80:128:128-n8:16:32:64"
+target triple = "x86_64-unknown-linux-gnu"
+
+define internal i32 @read(i32* %p) nounwind uwtable {
+entry:
+  %0 = load i32* %p, align 4
+  ret i32 %0
+}
+
+define i32 @main() nounwind uwtable {
+entry:
+  %a = alloca i32, align 4
+  store i32 1, i32* %a, align 4
+  %0 = load i32* %a, align 4
+  %call = call i32 @read(i32* %a)
+  %add = add nsw i32 %0, %call
+  ret i32 %add
+}
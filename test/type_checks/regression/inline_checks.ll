@@ -0,0 +1,24 @@
+; With -tc-inline-checks the shadow memory is read inline and the runtime is
+; only called when the tag compare fails.
+; RUN: adsaopt -typechecks -tc-inline-checks %s -o %t.bc
+; RUN: llvm-dis %t.bc -o %t.ll
+; RUN: grep "__tc_shadow_base" %t.ll
+; RUN: grep "tc.slow:" %t.ll
+; RUN: not grep "call void @getTypeTag" %t.ll
+target datalayout = "e-p:64:64:64-i1:8:8-i8:8:8-i16:16:16-i32:32:32-i64:64:64-f32:32:32-f64:64:64-v64:64:64-v128:128:128-a0:0:64-s0:64:64-f80:128:128-n8:16:32:64"
+target triple = "x86_64-unknown-linux-gnu"
+
+define internal i32 @read(i32* %p) nounwind uwtable {
+entry:
+  %0 = load i32* %p, align 4
+  %add = add nsw i32 %0, 1
+  ret i32 %add
+}
+
+define i32 @main() nounwind uwtable {
+entry:
+  %a = alloca i32, align 4
+  store i32 1, i32* %a, align 4
+  %call = call i32 @read(i32* %a)
+  ret i32 %call
+}
@@ -0,0 +1,26 @@
+; Type-safe memory that never leaves main needs neither checks nor shadow
+; memory updates. %b is passed to @read, so its stores are still tracked.
+; RUN: adsaopt -typechecks -typechecks-opt %s -o %t.bc
+; RUN: llvm-dis %t.bc -o %t.ll
+; RUN: grep -c "call void @trackStoreInst" %t.ll | grep "^1$"
+; RUN: not grep "call void @checkType(" %t.ll
+target datalayout = "e-p:64:64:64-i1:8:8-i8:8:8-i16:16:16-i32:32:32-i64:64:64-f32:32:32-f64:64:64-v64:64:64-v128:128:128-a0:0:64-s0:64:64-f80:128:128-n8:16:32:64"
+target triple = "x86_64-unknown-linux-gnu"
+
+define internal i32 @read(i32* %p) nounwind uwtable {
+entry:
+  %0 = load i32* %p, align 4
+  ret i32 %0
+}
+
+define i32 @main() nounwind uwtable {
+entry:
+  %a = alloca i32, align 4
+  %b = alloca i32, align 4
+  store i32 1, i32* %a, align 4
+  store i32 2, i32* %b, align 4
+  %0 = load i32* %a, align 4
+  %call = call i32 @read(i32* %b)
+  %add = add nsw i32 %0, %call
+  ret i32 %add
+}
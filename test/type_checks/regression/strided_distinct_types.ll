@@ -0,0 +1,46 @@
+; The loaded value is used both as an i64 and, through a bitcast, as a double.
+; The array is memset, so the first check of each element writes its type into
+; the shadow memory and the second one sees it. Two strided checks would run
+; all the i64 checks before any of the double checks, so both stay in the loop.
+; RUN: adsaopt -typechecks -tc-coalesce-checks %s -o %t.bc
+; RUN: llvm-dis %t.bc -o %t.ll
+; RUN: not grep "call void @checkTypeStrided" %t.ll
+; RUN: grep -c "call void @checkType(" %t.ll | grep "^2$"
+target datalayout = "e-p:64:64:64-i1:8:8-i8:8:8-i16:16:16-i32:32:32-i64:64:64-f32:32:32-f64:64:64-v64:64:64-v128:128:128-a0:0:64-s0:64:64-f80:128:128-n8:16:32:64"
+target triple = "x86_64-unknown-linux-gnu"
+
+define internal double @total(i64* %arr) nounwind uwtable {
+entry:
+  br label %loop
+
+loop:
+  %i = phi i64 [ 0, %entry ], [ %inc, %loop ]
+  %s = phi i64 [ 0, %entry ], [ %s.next, %loop ]
+  %d = phi double [ 0.000000e+00, %entry ], [ %d.next, %loop ]
+  %ptr = getelementptr inbounds i64* %arr, i64 %i
+  %v = load i64* %ptr, align 8
+  %s.next = add nsw i64 %s, %v
+  %f = bitcast i64 %v to double
+  %d.next = fadd double %d, %f
+  %inc = add i64 %i, 1
+  %cmp = icmp eq i64 %inc, 16
+  br i1 %cmp, label %exit, label %loop
+
+exit:
+  %sf = sitofp i64 %s.next to double
+  %res = fadd double %sf, %d.next
+  ret double %res
+}
+
+define i32 @main() nounwind uwtable {
+entry:
+  %arr = alloca [16 x i64], align 16
+  %arr0 = getelementptr inbounds [16 x i64]* %arr, i64 0, i64 0
+  %arr1 = bitcast i64* %arr0 to i8*
+  call void @llvm.memset.p0i8.i64(i8* %arr1, i8 0, i64 128, i32 16, i1 false)
+  %call = call double @total(i64* %arr0)
+  %res = fptosi double %call to i32
+  ret i32 %res
+}
+
+declare void @llvm.memset.p0i8.i64(i8* nocapture, i8, i64, i32, i1) nounwind
@@ -0,0 +1,168 @@
+//===-- dyncount-report - Summarize per-site load/store counts ------------===//
+//
+//                     Automatic Pool Allocation Project
+//
+// This file was developed by the LLVM research group and is distributed
+// under the University of Illinois Open Source License. See LICENSE.TXT for
+// details.
+//
+//===----------------------------------------------------------------------===//
+//
+// This program reads the counts written by the DynCount runtime (see the
+// -dyncount pass) and prints the most frequently executed load and store
+// sites, followed by the same counts summed over the DSNode each site
+// accesses.  Hot type-unsafe sites and nodes are the ones worth fixing.
+//
+//===----------------------------------------------------------------------===//
+
+#include "poolalloc_runtime/DynCount.h"
+#include "llvm/Support/CommandLine.h"
+#include "llvm/Support/Format.h"
+#include "llvm/Support/raw_ostream.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <map>
+#include <string>
+#include <vector>
+
+using namespace llvm;
+
+static cl::opt<std::string>
+InputFilename(cl::Positional, cl::desc("<count file>"),
+              cl::init(DYNCOUNT_FILE));
+
+static cl::opt<unsigned>
+TopN("top", cl::init(20),
+     cl::desc("Number of sites and nodes to list (0 for all)"));
+
+static cl::opt<bool>
+UnsafeOnly("unsafe-only", cl::init(false),
+           cl::desc("Only list accesses that are not type safe"));
+
+namespace {
+  /// NodeSummary - The counts of all listed sites that access one DSNode.
+  struct NodeSummary {
+    uint64_t Count;
+    unsigned Sites;
+    bool Safe;
+    uint32_t Function;           // Function of the hottest site.
+    uint64_t Hottest;
+    NodeSummary() : Count(0), Sites(0), Safe(true), Function(0), Hottest(0) {}
+  };
+
+  struct HotterRecord {
+    bool operator()(const DynCountRecord &A, const DynCountRecord &B) const {
+      return A.Count > B.Count;
+    }
+  };
+
+  struct HotterNode {
+    bool operator()(const std::pair<uint32_t, NodeSummary> &A,
+                    const std::pair<uint32_t, NodeSummary> &B) const {
+      return A.second.Count > B.second.Count;
+    }
+  };
+}
+
+static std::string percent(uint64_t Part, uint64_t Whole) {
+  std::string S;
+  raw_string_ostream OS(S);
+  OS << format("%6.2f%%", Whole ? 100.0 * Part / Whole : 0.0);
+  return OS.str();
+}
+
+int main(int argc, char **argv) {
+  cl::ParseCommandLineOptions(argc, argv, " load/store count summarizer\n");
+
+  FILE *F = fopen(InputFilename.c_str(), "rb");
+  if (!F) {
+    errs() << argv[0] << ": cannot open '" << InputFilename << "'\n";
+    return 1;
+  }
+
+  DynCountHeader Header;
+  if (fread(&Header, sizeof(Header), 1, F) != 1 ||
+      memcmp(Header.Magic, DYNCOUNT_MAGIC, sizeof(Header.Magic)) ||
+      Header.Version != DYNCOUNT_VERSION) {
+    errs() << argv[0] << ": '" << InputFilename << "' is not a count file\n";
+    return 1;
+  }
+
+  std::vector<DynCountRecord> Records(Header.NumSites);
+  std::vector<char> NameData(Header.NamesSize);
+  if ((Header.NumSites &&
+       fread(&Records[0], sizeof(DynCountRecord), Header.NumSites, F) !=
+       Header.NumSites) ||
+      (Header.NamesSize &&
+       fread(&NameData[0], 1, Header.NamesSize, F) != Header.NamesSize)) {
+    errs() << argv[0] << ": '" << InputFilename << "' is truncated\n";
+    return 1;
+  }
+  fclose(F);
+
+  std::vector<std::string> Names;
+  for (size_t Start = 0, i = 0; i != NameData.size(); ++i)
+    if (!NameData[i]) {
+      Names.push_back(std::string(&NameData[Start], i - Start));
+      Start = i + 1;
+    }
+
+  uint64_t Total = 0, Safe = 0;
+  std::vector<DynCountRecord> Listed;
+  std::map<uint32_t, NodeSummary> Nodes;
+  for (unsigned i = 0; i != Records.size(); ++i) {
+    const DynCountRecord &R = Records[i];
+    Total += R.Count;
+    if (R.Site.Safe)
+      Safe += R.Count;
+    if (!R.Count || (UnsafeOnly && R.Site.Safe))
+      continue;
+    Listed.push_back(R);
+
+    NodeSummary &N = Nodes[R.Site.Node];
+    N.Count += R.Count;
+    ++N.Sites;
+    N.Safe &= R.Site.Safe != 0;
+    if (R.Count > N.Hottest) {
+      N.Hottest = R.Count;
+      N.Function = R.Site.Function;
+    }
+  }
+
+  outs() << Header.NumSites << " sites, " << Header.NumThreads
+         << " threads, " << Total << " accesses, " << Safe << " type safe ("
+         << percent(Safe, Total) << ")\n";
+
+  std::stable_sort(Listed.begin(), Listed.end(), HotterRecord());
+  size_t Limit = TopN ? std::min<size_t>(TopN, Listed.size()) : Listed.size();
+  outs() << "\nHottest sites:\n";
+  for (size_t i = 0; i != Limit; ++i) {
+    const DynCountRecord &R = Listed[i];
+    const DynCountSite &S = R.Site;
+    outs() << format("%14llu", (unsigned long long)R.Count) << " "
+           << percent(R.Count, Total) << "  "
+           << (S.Kind == DynCountStore ? "store" : "load ") << " "
+           << (S.Safe ? "safe  " : "unsafe") << "  node "
+           << format("%-6u", S.Node) << " "
+           << (S.Function < Names.size() ? Names[S.Function] : "?")
+           << "#" << S.Index << "\n";
+  }
+
+  std::vector<std::pair<uint32_t, NodeSummary> > ByNode(Nodes.begin(),
+                                                         Nodes.end());
+  std::stable_sort(ByNode.begin(), ByNode.end(), HotterNode());
+  Limit = TopN ? std::min<size_t>(TopN, ByNode.size()) : ByNode.size();
+  outs() << "\nHottest nodes:\n";
+  for (size_t i = 0; i != Limit; ++i) {
+    const NodeSummary &N = ByNode[i].second;
+    outs() << format("%14llu", (unsigned long long)N.Count) << " "
+           << percent(N.Count, Total) << "  node "
+           << format("%-6u", ByNode[i].first) << " "
+           << (N.Safe ? "safe  " : "unsafe") << "  " << N.Sites
+           << " sites, hottest in "
+           << (N.Function < Names.size() ? Names[N.Function] : "?") << "\n";
+  }
+  return 0;
+}
@@ -0,0 +1,194 @@
+//===-- pa-trace - Summarize pool access traces ---------------------------===//
+//
+//                     Automatic Pool Allocation Project
+//
+// This file was developed by the LLVM research group and is distributed
+// under the University of Illinois Open Source License. See LICENSE.TXT for
+// details.
+//
+//===----------------------------------------------------------------------===//
+//
+// This program reads a binary trace written by the poolaccesstrace runtime
+// (see the -poolaccesstrace pass) and prints, for each pool, a histogram of
+// reuse distances and a histogram of the distance between consecutive
+// accesses.  Both are measured in trace blocks (see PoolTrace::BlockShift)
+// over the sampled accesses of that pool, in the order they were recorded by
+// each thread.
+//
+//===----------------------------------------------------------------------===//
+
+#include "poolalloc_runtime/AccessTrace.h"
+#include "llvm/ADT/DenseMap.h"
+#include "llvm/Support/CommandLine.h"
+#include "llvm/Support/Format.h"
+#include "llvm/Support/raw_ostream.h"
+
+#include <cstdio>
+#include <cstring>
+#include <map>
+#include <vector>
+
+using namespace llvm;
+
+static cl::opt<std::string>
+InputFilename(cl::Positional, cl::desc("<trace file>"),
+              cl::init("trace.pa.bin"));
+
+static cl::opt<unsigned>
+MinSamples("min-samples", cl::init(1),
+           cl::desc("Do not report pools with fewer samples than this"));
+
+enum { NumBuckets = 33 };
+
+namespace {
+  /// PoolStream - The sampled accesses to one pool, as (thread, block) pairs
+  /// in the order they appear in the trace.
+  struct PoolStream {
+    std::vector<std::pair<uint32_t, uint64_t> > Accesses;
+  };
+
+  /// FenwickTree - Prefix sums over positions in an access stream, used to
+  /// count the distinct blocks touched between two uses of the same block.
+  class FenwickTree {
+    std::vector<int> Tree;
+  public:
+    explicit FenwickTree(size_t N) : Tree(N + 1, 0) {}
+    void add(size_t I, int V) {
+      for (++I; I < Tree.size(); I += I & -I)
+        Tree[I] += V;
+    }
+    int prefix(size_t I) const {        // Sum over [0, I).
+      int Sum = 0;
+      for (; I; I -= I & -I)
+        Sum += Tree[I];
+      return Sum;
+    }
+  };
+}
+
+/// getBucket - Histogram bucket for a distance: 0 for 0, then one bucket per
+/// power of two.
+static unsigned getBucket(uint64_t D) {
+  unsigned B = 0;
+  while (D && B + 1 < NumBuckets) {
+    D >>= 1;
+    ++B;
+  }
+  return B;
+}
+
+static void printHistogram(const char *Title, const uint64_t *Hist,
+                           uint64_t Extra, const char *ExtraName) {
+  outs() << "  " << Title << ":\n";
+  for (unsigned i = 0; i != NumBuckets; ++i) {
+    if (!Hist[i]) continue;
+    if (i == 0)
+      outs() << "    0";
+    else if (i == 1)
+      outs() << "    1";
+    else
+      outs() << "    " << (1ULL << (i-1)) << "-" << ((1ULL << i) - 1);
+    outs() << "\t" << Hist[i] << "\n";
+  }
+  if (Extra)
+    outs() << "    " << ExtraName << "\t" << Extra << "\n";
+}
+
+static void analyzePool(uint32_t ID, const PoolStream &S) {
+  size_t N = S.Accesses.size();
+  uint64_t Reuse[NumBuckets], Stride[NumBuckets];
+  memset(Reuse, 0, sizeof(Reuse));
+  memset(Stride, 0, sizeof(Stride));
+  uint64_t Cold = 0;
+
+  // Reuse distance: the number of distinct blocks touched since the last
+  // access to the same block.  Only the most recent access to each block is
+  // marked in the tree, so a range sum counts distinct blocks.
+  FenwickTree Marks(N);
+  DenseMap<unsigned long long, size_t> LastUse;
+  DenseMap<uint32_t, uint64_t> LastBlock;
+  for (size_t i = 0; i != N; ++i) {
+    uint32_t Thread = S.Accesses[i].first;
+    uint64_t Block = S.Accesses[i].second;
+
+    DenseMap<unsigned long long, size_t>::iterator LI = LastUse.find(Block);
+    if (LI == LastUse.end()) {
+      ++Cold;
+    } else {
+      size_t Prev = LI->second;
+      ++Reuse[getBucket(Marks.prefix(i) - Marks.prefix(Prev + 1))];
+      Marks.add(Prev, -1);
+    }
+    Marks.add(i, 1);
+    LastUse[Block] = i;
+
+    // Locality: distance to the previous block this thread touched.
+    DenseMap<uint32_t, uint64_t>::iterator BI = LastBlock.find(Thread);
+    if (BI != LastBlock.end()) {
+      uint64_t Prev = BI->second;
+      ++Stride[getBucket(Block > Prev ? Block - Prev : Prev - Block)];
+      BI->second = Block;
+    } else {
+      LastBlock[Thread] = Block;
+    }
+  }
+
+  outs() << "Pool " << format("0x%08x", ID) << ": " << N << " samples, "
+         << LastUse.size() << " distinct blocks\n";
+  printHistogram("reuse distance (distinct blocks)", Reuse, Cold, "cold");
+  printHistogram("access distance (blocks)", Stride, 0, 0);
+}
+
+int main(int argc, char **argv) {
+  cl::ParseCommandLineOptions(argc, argv, " pool access trace summarizer\n");
+
+  FILE *F = fopen(InputFilename.c_str(), "rb");
+  if (!F) {
+    errs() << argv[0] << ": cannot open '" << InputFilename << "'\n";
+    return 1;
+  }
+
+  PoolTrace::FileHeader Header;
+  if (fread(&Header, sizeof(Header), 1, F) != 1 ||
+      memcmp(Header.Magic, PoolTrace::Magic, sizeof(Header.Magic)) ||
+      Header.Version != PoolTrace::Version) {
+    errs() << argv[0] << ": '" << InputFilename << "' is not a pool trace\n";
+    return 1;
+  }
+
+  outs() << "Sample rate 1/" << Header.SampleRate << ", "
+         << (1U << Header.BlockShift) << " byte blocks, "
+         << Header.NumThreads << " threads";
+  if (Header.Dropped)
+    outs() << ", " << Header.Dropped << " samples dropped";
+  outs() << "\n";
+
+  std::map<uint32_t, PoolStream> Pools;
+  std::vector<PoolTrace::Record> Records;
+  uint64_t Remaining = Header.DataSize;
+  while (Remaining >= sizeof(PoolTrace::ChunkHeader)) {
+    PoolTrace::ChunkHeader CH;
+    if (fread(&CH, sizeof(CH), 1, F) != 1 || CH.NumRecords == 0)
+      break;
+    Remaining -= sizeof(CH);
+    if (Remaining < CH.NumRecords * sizeof(PoolTrace::Record))
+      break;
+
+    Records.resize(CH.NumRecords);
+    if (fread(&Records[0], sizeof(PoolTrace::Record), CH.NumRecords, F) !=
+        CH.NumRecords)
+      break;
+    Remaining -= CH.NumRecords * sizeof(PoolTrace::Record);
+
+    for (unsigned i = 0; i != CH.NumRecords; ++i)
+      Pools[Records[i].PoolID].Accesses.push_back(
+                        std::make_pair(CH.ThreadID, Records[i].Block));
+  }
+  fclose(F);
+
+  for (std::map<uint32_t, PoolStream>::iterator I = Pools.begin(),
+       E = Pools.end(); I != E; ++I)
+    if (I->second.Accesses.size() >= MinSamples)
+      analyzePool(I->first, I->second);
+  return 0;
+}